@@ -0,0 +1,70 @@
+//
+// Created by 11361 on 25-4-25.
+//
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace MemoryPoolV2
+{
+// 追踪记录的操作类型
+enum class TraceOp : uint8_t {
+    Alloc = 0,          // 分配，在分配完成后记录
+    Free = 1,           // 释放，在实际释放之前记录（保证同一地址被其他线程复用时记录的先后顺序正确）
+    ReallocFrom = 2,    // reallocate 的原内存块，在调用之前记录
+    ReallocTo = 3,      // reallocate 的新内存块，在调用之后记录，与同一线程上一条 ReallocFrom 配对（失败时 ptr 为 0）
+};
+
+// 追踪文件中的一条记录
+struct TraceRecord {
+    uint64_t timestamp;     // 相对于开始追踪的纳秒数
+    uint64_t ptr;           // 内存块地址，回放时据此将同一内存块的分配与释放关联起来
+    uint32_t size;          // 请求的字节数（超过 4GB 时截断为 UINT32_MAX）
+    uint16_t thread;        // 线程编号（按线程首次记录的顺序从 0 开始）
+    uint8_t op;             // TraceOp
+    uint8_t align_log2;     // 对齐分配时为 log2(align)，否则为 0
+};
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord must stay compact");
+
+// 追踪文件头，之后紧跟 TraceRecord 数组
+struct TraceHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    std::atomic<uint64_t> count;    // 已申请的记录槽数，超过 capacity 的部分被丢弃
+    uint64_t capacity;              // 文件能容纳的记录数
+};
+
+// 分配追踪：编译时定义 MEMORYPOOL_TRACE 后，MemoryPool 的每次分配/释放都会写入内存映射的追踪文件，
+// 记录的全局顺序即各线程操作的交错顺序，可由 trace_replay 在不同的分配器上确定性地回放。
+// 通过 start 或环境变量 MEMORYPOOL_TRACE_FILE 开启追踪；未开启时 record 只有一次原子加载
+class AllocTrace {
+public:
+    static constexpr uint64_t MAGIC = 0x45434152544d504dULL;    // "MPMTRACE"
+    static constexpr uint32_t VERSION = 1;
+    static const size_t DEFAULT_CAPACITY = size_t(1) << 24;     // 默认最多 16M 条记录（文件按需占用磁盘）
+
+    // 创建追踪文件并开始记录，已经在追踪或文件创建失败时返回 false
+    static bool start(const char* path, size_t capacity = DEFAULT_CAPACITY);
+    // 结束追踪：将文件截断为实际记录的长度并解除映射，返回记录数。调用时不能有其他线程正在记录
+    static size_t stop();
+    static bool isActive() {
+        return header_.load(std::memory_order_relaxed) != nullptr;
+    }
+
+    static void record(TraceOp op, const void* ptr, size_t size, size_t align = 0) {
+        TraceHeader* header = header_.load(std::memory_order_acquire);
+        if (header != nullptr) {
+            append(header, op, ptr, size, align);
+        }
+    }
+
+private:
+    static void append(TraceHeader* header, TraceOp op, const void* ptr, size_t size, size_t align);
+
+private:
+    static std::atomic<TraceHeader*> header_;
+};
+}   // namespace MemoryPoolV2
@@ -0,0 +1,77 @@
+//
+// Created by 11361 on 25-4-12.
+//
+
+#pragma once
+#include <cstddef>
+#include "Common.h"
+#include "PageCache.h"
+
+namespace MemoryPoolV2
+{
+// 区域（Arena）分配器：从 PageCache 获取的 Span 中进行指针碰撞（bump）分配，
+// 适用于“一次请求内大量分配、请求结束时整体释放”的场景。
+// 单个对象不能单独释放，只能通过 rewind/reset/release 批量回收。Arena 不是线程安全的
+class Arena {
+public:
+    static constexpr size_t DEFAULT_CHUNK_PAGES = 16;  // 默认每次向 PageCache 申请 16 页（64KB）
+
+    // 检查点：记录当前分配位置，rewind 时回退到该位置（支持嵌套）
+    struct Checkpoint {
+        void* chunk;    // 当前所在的 chunk
+        size_t offset;  // chunk 内的偏移
+    };
+
+    // page_cache 指定 Span 的来源，默认使用默认堆的 PageCache（也可以使用某个 Heap 的 PageCache）
+    explicit Arena(size_t chunk_pages = DEFAULT_CHUNK_PAGES, PageCache& page_cache = PageCache::getInstance());
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // 分配 size 字节、按 align 对齐的内存（align 必须为 2 的幂，且不超过页大小）
+    void* allocate(size_t size, size_t align = ALIGNMENT) {
+        size_t offset = (offset_ + align - 1) & ~(align - 1);
+        if (cur_ != nullptr && offset + size <= cur_->capacity) {
+            offset_ = offset + size;
+            return reinterpret_cast<char*>(cur_) + offset;
+        }
+        return allocateSlow(size, align);
+    }
+
+    // 获取当前分配位置
+    Checkpoint checkpoint() const {
+        return Checkpoint{cur_, offset_};
+    }
+    // 回退到检查点，检查点之后分配的内存全部失效（O(1)）
+    void rewind(const Checkpoint& cp);
+    // 丢弃所有分配，保留已申请的 Span 供后续复用（O(1)）
+    void reset();
+    // 丢弃所有分配，并将所有 Span 归还给 PageCache
+    void release();
+
+    // 已分配出去的字节数（包含对齐填充）
+    size_t bytesUsed() const;
+    // 从 PageCache 申请的字节总数
+    size_t bytesReserved() const { return reserved_bytes_; }
+
+private:
+    // 位于每个 Span 起始处的头部信息，chunk 按申请顺序串成单链表
+    struct Chunk {
+        Chunk* next;        // 下一个 chunk
+        size_t num_pages;   // Span 页数
+        size_t capacity;    // Span 字节数
+    };
+    static constexpr size_t CHUNK_HEADER_SIZE = (sizeof(Chunk) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+    void* allocateSlow(size_t size, size_t align);
+
+private:
+    PageCache& page_cache_; // Span 的来源
+    Chunk* head_;           // 第一个 chunk
+    Chunk* cur_;            // 当前正在分配的 chunk，cur_ 之后的 chunk 均为空闲
+    size_t offset_;         // cur_ 内下一次分配的偏移
+    size_t chunk_pages_;    // 每次申请的默认页数
+    size_t reserved_bytes_; // 从 PageCache 申请的字节总数
+};
+}   // namespace MemoryPoolV2
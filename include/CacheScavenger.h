@@ -0,0 +1,38 @@
+//
+// Created by 11361 on 25-4-28.
+//
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "Heap.h"
+
+namespace MemoryPoolV2
+{
+// 周期性地调用 Heap::scavengeIdleCaches()，直接回收停止分配的线程缓存的内存块。
+// 线程在两次扫描之间没有任何分配/释放即视为空闲。析构时停止
+class CacheScavenger {
+public:
+    CacheScavenger(Heap& heap, std::chrono::milliseconds interval);
+    ~CacheScavenger();
+    CacheScavenger(const CacheScavenger&) = delete;
+    CacheScavenger& operator=(const CacheScavenger&) = delete;
+
+    // 累计回收的线程缓存数
+    size_t getNumReclaimed();
+
+private:
+    void run();
+
+private:
+    Heap& heap_;
+    std::chrono::milliseconds interval_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    size_t num_reclaimed_ = 0;
+    std::thread thread_;
+};
+}   // namespace MemoryPoolV2
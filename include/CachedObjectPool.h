@@ -0,0 +1,168 @@
+//
+// Created by 11361 on 25-4-30.
+//
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "MemoryPool.h"
+
+namespace MemoryPoolV2
+{
+// CachedObjectPool 与对象类型无关的部分：池的注册表、每个线程的对象栈与共享仓库
+class CachedObjectPoolBase {
+public:
+    static const size_t MAX_POOLS = 256;    // 同时存在的对象池的最大数量
+
+    CachedObjectPoolBase(const CachedObjectPoolBase&) = delete;
+    CachedObjectPoolBase& operator=(const CachedObjectPoolBase&) = delete;
+
+    // 销毁共享仓库与当前线程缓存的对象，并请求其他线程在下一次 acquire/release 时销毁各自缓存的对象，
+    // 返回当前销毁的对象数
+    size_t trim();
+    // 当前缓存（未被使用）的对象数量，结果为近似值
+    size_t getNumCached();
+
+protected:
+    // 每个线程缓存的对象栈，只由所属线程访问（flush_requested 与 num_cached 除外）
+    struct ThreadStack {
+        std::vector<void*> objects;
+        std::atomic<bool> flush_requested{false};
+        std::atomic<size_t> num_cached{0};  // objects 的大小，由所属线程在每次修改后写入，供 getNumCached 读取
+
+        void updateNumCached() { num_cached.store(objects.size(), std::memory_order_relaxed); }
+    };
+
+    // 创建对象池，对象池的数量超过 MAX_POOLS 时抛出 std::runtime_error
+    explicit CachedObjectPoolBase(size_t max_cached);
+    ~CachedObjectPoolBase() = default;
+
+    // 当前线程在该对象池上的对象栈（首次调用时创建）
+    ThreadStack& localStack() {
+        ThreadStackSlot& slot = threadStackSlots()[id_];
+        if (slot.stack != nullptr && slot.generation == generation_) {
+            return *slot.stack;
+        }
+        return createThreadStack();
+    }
+
+    // 对象栈为空或收到销毁请求时：先从共享仓库取回一批对象，仓库为空时构造新对象
+    void* acquireSlow(ThreadStack& stack);
+    // 对象栈已满或收到销毁请求时：将一半对象移入共享仓库后再压栈
+    void releaseSlow(ThreadStack& stack, void* object);
+    // 销毁所有缓存的对象并注销对象池，由派生类的析构函数调用（此时不能有其他线程在使用该对象池）
+    void shutdown();
+
+    // 由派生类实现：在 MemoryPool 上分配内存并构造对象 / 析构对象并归还内存
+    virtual void* createObject() = 0;
+    virtual void destroyObject(void* object) = 0;
+
+    size_t max_cached_;     // 每个线程最多缓存的对象数
+
+private:
+    struct ThreadStackSlot {
+        ThreadStack* stack = nullptr;
+        uint64_t generation = 0;
+    };
+    using ThreadStackSlots = std::array<ThreadStackSlot, MAX_POOLS>;
+    struct ThreadSlotsHolder;
+
+    static ThreadStackSlots& threadStackSlots();
+    // 线程退出时将其对象栈中的对象（保持构造状态）移入各个对象池的共享仓库
+    static void onThreadExit(ThreadStackSlots& slots);
+
+    ThreadStack& createThreadStack();
+    // 销毁对象栈中的全部对象
+    size_t flushStack(ThreadStack& stack);
+
+    size_t id_;
+    uint64_t generation_;
+    std::mutex mutex_;                  // 保护 stacks_ 与 depot_
+    std::vector<ThreadStack*> stacks_;  // 所有线程的对象栈
+    std::vector<void*> depot_;          // 共享仓库：线程退出或对象栈溢出时移入的对象
+};
+
+// 缓存已构造对象的对象池（Bonwick slab 分配器的构造缓存）。release 的对象不析构，只调用 reset 恢复到初始状态后
+// 留在当前线程的对象栈中，下一次 acquire 直接返回，省去构造函数中的预分配、锁初始化等开销。
+// 对象只在 trim 或对象池析构时才真正析构并归还内存。对象可以在一个线程 acquire、在另一个线程 release
+template<typename T>
+class CachedObjectPool : public CachedObjectPoolBase {
+public:
+    // construct 在给定的内存上构造对象（默认调用 T 的默认构造函数），reset 在对象被放回对象池时调用
+    explicit CachedObjectPool(std::function<void(T&)> reset = {},
+                              std::function<void(void*)> construct = [](void* ptr) { new(ptr) T(); },
+                              size_t max_cached = 64)
+        : CachedObjectPoolBase(max_cached), reset_(std::move(reset)), construct_(std::move(construct)) {}
+
+    ~CachedObjectPool() {
+        shutdown();
+    }
+
+    // 获取一个处于初始状态的对象，内存不足时抛出 std::bad_alloc
+    T* acquire() {
+        ThreadStack& stack = localStack();
+        if (!stack.objects.empty() && !stack.flush_requested.load(std::memory_order_relaxed)) {
+            void* object = stack.objects.back();
+            stack.objects.pop_back();
+            stack.updateNumCached();
+            return static_cast<T*>(object);
+        }
+        return static_cast<T*>(acquireSlow(stack));
+    }
+
+    // 将对象放回对象池：调用 reset 后缓存在当前线程中，不析构
+    void release(T* object) {
+        if (object == nullptr) {
+            return;
+        }
+        if (reset_) {
+            reset_(*object);
+        }
+        ThreadStack& stack = localStack();
+        if (stack.objects.size() < max_cached_ && !stack.flush_requested.load(std::memory_order_relaxed)) {
+            stack.objects.push_back(object);
+            stack.updateNumCached();
+            return;
+        }
+        releaseSlow(stack, object);
+    }
+
+protected:
+    void* createObject() override {
+        void* ptr = alignof(T) <= ALIGNMENT ? MemoryPool::allocate(sizeof(T))
+                                            : MemoryPool::allocate_aligned(sizeof(T), alignof(T));
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        try {
+            construct_(ptr);
+        } catch (...) {
+            freeMemory(ptr);
+            throw;
+        }
+        return ptr;
+    }
+
+    void destroyObject(void* object) override {
+        static_cast<T*>(object)->~T();
+        freeMemory(object);
+    }
+
+private:
+    static void freeMemory(void* ptr) {
+        if (alignof(T) <= ALIGNMENT) {
+            MemoryPool::deallocate(ptr, sizeof(T));
+        } else {
+            MemoryPool::deallocate_aligned(ptr, sizeof(T), alignof(T));
+        }
+    }
+
+    std::function<void(T&)> reset_;
+    std::function<void(void*)> construct_;
+};
+}   // namespace MemoryPoolV2
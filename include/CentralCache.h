@@ -7,40 +7,119 @@
 #include <mutex>
 #include <atomic>
 #include "Common.h"
+#include "PageMap.h"
 
 namespace MemoryPoolV2
 {
+class PageCache;
+
+// 单个大小类别在中心缓存中的统计信息
+struct CentralClassStats {
+    size_t num_free;    // 中心缓存中的空闲块数（包括 Span 中尚未切分的块）
+    size_t num_blocks;  // 从 Span 切分出的块总数（包括已分配的和缓存在各处的）
+    size_t span_bytes;  // 为该类别从 PageCache 获取的 Span 字节数
+};
+
 class CentralCache {
 public:
-    // 获取 CentralCache 类的单例实例
-    static CentralCache& getInstance() {
-        static CentralCache instance;
-        return instance;
-    }
+    static const size_t SPAN_PAGES = 8; // 每次从PageCache获取 span 大小（以页为单位）
+
+    // 默认堆的 CentralCache
+    static CentralCache& getInstance();
+
+    // 每个 CentralCache 从对应的 PageCache 获取 Span
+    explicit CentralCache(PageCache& page_cache);
+    ~CentralCache();
+    CentralCache(const CentralCache&) = delete;
+    CentralCache& operator=(const CentralCache&) = delete;
 
     void* fetchRange(size_t index);
     void* fetchRange(size_t index, size_t num_batch);
     void returnRange(void* start, size_t size, size_t index);
+    // 与 returnRange 相同，但该类别正被占用时不等待，直接返回 false
+    bool tryReturnRange(void* start, size_t size, size_t index);
+
+    // 判断该大小类别的每个内存块是否独占一个 Span（块大小不小于 SPAN_PAGES 页）
+    static bool isPageLevel(size_t index);
+    // 块大小为 size 的类别每次获取的 Span 页数
+    static size_t spanPages(size_t size);
+    // 独占 Span 的内存块 ptr 通过 PageCache::resizeSpan 原地调整到另一个大小类别后，将其 Span 转移到新的类别
+    void moveBlock(void* ptr, size_t from_index, size_t to_index);
+    // 将各大小类别保留的空 Span 归还给 PageCache，返回归还的 Span 数量
+    size_t releaseEmptySpans();
+
+    // 读取统计信息时不加锁，得到的是近似值，可以在生产环境中周期性调用
+    CentralClassStats getClassStats(size_t index) const;
+
+    // 丢弃所有 Span（所属 PageCache 的内存即将整体释放时调用）
+    void reset();
 
 private:
-    CentralCache() {
-        // 初始时所有的空闲链表
-        for (auto& ptr : central_free_list_) {
-            ptr.store(nullptr, std::memory_order_relaxed);
-        }
-        // 初始化所有锁
-        for (auto& lock : locks_) {
-            lock.clear();
-        }
-    }
+    // 中心缓存管理的 Span。空闲块按所属 Span 分开存放，每个 Span 的空闲块数决定它所在的占用率链表
+    struct Span {
+        char* start;
+        size_t num_pages;
+        void* free_list;        // 归还到该 Span 的空闲块
+        char* unused;           // 尚未切分的块的起始位置，新 Span 按需切分，无需预先串成链表
+        uint32_t num_blocks;
+        uint32_t num_free;      // 空闲块数，包括 free_list 中的块与尚未切分的块
+        uint32_t list;          // 所在的链表
+        Span* prev;
+        Span* next;
+    };
+
+    // 每个大小类别的 Span 链表：按已使用块的比例分为 NUM_PARTIAL_LISTS 个部分使用链表（下标越大越满），
+    // 以及全部分配出去的 FULL_LIST 与全部空闲的 EMPTY_LIST
+    static const size_t NUM_PARTIAL_LISTS = 4;
+    static const size_t FULL_LIST = NUM_PARTIAL_LISTS;
+    static const size_t EMPTY_LIST = NUM_PARTIAL_LISTS + 1;
+    static const size_t NUM_LISTS = NUM_PARTIAL_LISTS + 2;
+    static const size_t MAX_EMPTY_SPANS = 1;    // 每个大小类别最多保留的空 Span 数，更多的空 Span 归还给 PageCache
+    struct SpanLists {
+        Span* heads[NUM_LISTS];
+        size_t num_empty;
+    };
 
-    // 从页缓存（PageCache）中获取指定大小 size 的内存块
-    static void* fetchFromPageCache(size_t size);
+    // 根据空闲块数计算 Span 应在的链表
+    static uint32_t listOf(const Span* span);
+    // 选择下一个用于分配的 Span：最满的部分使用 Span 优先，其次是空 Span，都没有时向 PageCache 获取新的 Span
+    Span* pickSpan(size_t index, bool allow_new);
+    // 向 PageCache 获取新的 Span 并登记到页映射中，失败返回 nullptr
+    Span* allocateSpan(size_t index);
+    // 将空 Span 归还给 PageCache
+    void releaseSpan(size_t index, Span* span);
+    // 将 Span 从当前链表中移除/插入到 list 链表头部
+    void unlinkSpan(size_t index, Span* span);
+    void linkSpan(size_t index, Span* span, uint32_t list);
+    // 空闲块数变化后将 Span 移动到对应的链表
+    void updateSpanList(size_t index, Span* span);
+    // 将内存块插入所属 Span 的空闲链表（调用者需持有该类别的锁）
+    void insertRange(void* start, size_t size, size_t index);
+
+    // 获取/释放 index 对应大小类别的自旋锁
+    void lock(size_t index);
+    void unlock(size_t index) {
+        free_lists_[index].lock.clear(std::memory_order_release);
+    }
 
 private:
-    // 中心缓存的自由链表，用于存储不同大小类别的空闲内存块链表的头指针
-    std::array<std::atomic<void*>, FREE_LIST_SIZE> central_free_list_{};
-    // 用于保护 central_free_list_ 数组中对应的空闲链表
-    std::array<std::atomic_flag, FREE_LIST_SIZE> locks_{};
+    // 单个大小类别的中心缓存状态。链表头与保护它的锁放在一起并独占一个缓存行，
+    // 避免不同线程操作相邻大小类别时产生伪共享
+    struct alignas(CACHE_LINE_SIZE) CentralFreeList {
+        std::atomic_flag lock;      // 保护该类别 Span 链表的自旋锁
+        // 统计信息只在持有锁时修改，使用原子变量以便无锁读取
+        std::atomic<size_t> num_free;
+        std::atomic<size_t> num_blocks;
+        std::atomic<size_t> span_bytes;
+    };
+    static_assert(sizeof(CentralFreeList) == CACHE_LINE_SIZE, "CentralFreeList must occupy exactly one cache line");
+
+    PageCache& page_cache_;
+    // 所有大小类别的中心缓存状态（FREE_LIST_SIZE 个缓存行）
+    CentralFreeList* free_lists_;
+    // 所有大小类别的 Span 链表，由对应的 CentralFreeList::lock 保护
+    SpanLists* span_lists_;
+    // 页到 Span 的映射，用于归还内存块时找到其所属的 Span
+    PageMap page_map_;
 };
 }
\ No newline at end of file
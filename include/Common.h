@@ -4,14 +4,26 @@
 
 #pragma once
 #include <cstddef>
+#include <cstdint>
 #include <algorithm>
 
+// 定义 MEMORYPOOL_SIZE_CLASS_HEADER 时使用 size_class_gen 生成的大小类别表（GeneratedSizeClasses::CLASS_SIZES），
+// 否则使用默认的按 ALIGNMENT 等距划分的大小类别
+#ifdef MEMORYPOOL_SIZE_CLASS_HEADER
+#include MEMORYPOOL_SIZE_CLASS_HEADER
+#endif
+
 namespace MemoryPoolV2
 {
 // 对齐数和大小定义
 constexpr size_t ALIGNMENT = 8;
 constexpr size_t MAX_BYTES = 256 * 1024; // 256KB 内存池所能管理的最大内存块大小
+#ifdef MEMORYPOOL_SIZE_CLASS_HEADER
+constexpr size_t FREE_LIST_SIZE = GeneratedSizeClasses::NUM_CLASSES;
+#else
 constexpr size_t FREE_LIST_SIZE = MAX_BYTES / ALIGNMENT; // ALIGNMENT等于指针void*的大小
+#endif
+constexpr size_t CACHE_LINE_SIZE = 64;  // 缓存行大小，用于隔离被不同线程频繁修改的数据
 
 // 内存块头部信息
 struct BlockHeader {
@@ -20,6 +32,40 @@ struct BlockHeader {
     BlockHeader* next;  // 指向下一个内存块
 };
 
+#ifdef MEMORYPOOL_SIZE_CLASS_HEADER
+namespace GeneratedSizeClasses
+{
+constexpr bool isValidTable() {
+    for (size_t i = 0; i < NUM_CLASSES; ++i) {
+        if (CLASS_SIZES[i] % ALIGNMENT != 0 || (i > 0 && CLASS_SIZES[i] <= CLASS_SIZES[i - 1])) {
+            return false;
+        }
+    }
+    return NUM_CLASSES > 0 && CLASS_SIZES[NUM_CLASSES - 1] == MAX_BYTES;
+}
+static_assert(isValidTable(), "size classes must be increasing multiples of ALIGNMENT ending at MAX_BYTES");
+
+// 以 ALIGNMENT 为粒度的字节数到大小类别索引的查找表，编译期生成
+struct IndexLookup {
+    uint16_t index[MAX_BYTES / ALIGNMENT + 1];
+};
+
+constexpr IndexLookup makeIndexLookup() {
+    IndexLookup lookup{};
+    size_t index = 0;
+    for (size_t unit = 0; unit <= MAX_BYTES / ALIGNMENT; ++unit) {
+        while (CLASS_SIZES[index] < unit * ALIGNMENT) {
+            ++index;
+        }
+        lookup.index[unit] = static_cast<uint16_t>(index);
+    }
+    return lookup;
+}
+
+inline constexpr IndexLookup INDEX_LOOKUP = makeIndexLookup();
+}   // namespace GeneratedSizeClasses
+#endif
+
 // 大小类管理
 class SizeClass {
 public:
@@ -32,8 +78,42 @@ public:
     static size_t getIndex(size_t bytes) {
         // 确保bytes至少为ALIGNMENT
         bytes = std::max(bytes, ALIGNMENT);
+#ifdef MEMORYPOOL_SIZE_CLASS_HEADER
+        return GeneratedSizeClasses::INDEX_LOOKUP.index[(bytes + ALIGNMENT - 1) / ALIGNMENT];
+#else
         // 向上取整后-1
         return (bytes + ALIGNMENT - 1) / ALIGNMENT - 1;
+#endif
+    }
+
+    // 根据索引计算该大小类别的内存块大小
+    // 内存块从页对齐的 Span 起始处按块大小等距切分，因此每个块天然按“块大小中最大的 2 的幂因子”对齐（不超过页大小），
+    // 例如 48 字节的块按 16 字节对齐，192 字节的块按 64 字节对齐
+    static size_t classSize(size_t index) {
+#ifdef MEMORYPOOL_SIZE_CLASS_HEADER
+        return GeneratedSizeClasses::CLASS_SIZES[index];
+#else
+        return (index + 1) * ALIGNMENT;
+#endif
+    }
+
+    // 计算满足 align 对齐要求时实际申请的字节数：向上取整到 align 的倍数，
+    // 其对应大小类别的块即按 align 自然对齐（align 为 2 的幂且不超过页大小）
+    static size_t alignedSize(size_t bytes, size_t align) {
+        align = std::max(align, ALIGNMENT);
+        size_t size = (std::max(bytes, size_t(1)) + align - 1) & ~(align - 1);
+#ifdef MEMORYPOOL_SIZE_CLASS_HEADER
+        // 生成的类别大小不一定是 align 的倍数，向上取第一个是 align 倍数的类别
+        // （最后一个类别 MAX_BYTES 是页大小的倍数，一定能找到）
+        if (size <= MAX_BYTES) {
+            size_t index = getIndex(size);
+            while (classSize(index) % align != 0) {
+                ++index;
+            }
+            size = classSize(index);
+        }
+#endif
+        return size;
     }
 };
 }
@@ -0,0 +1,90 @@
+//
+// Created by 11361 on 25-5-7.
+//
+
+#pragma once
+#include <cstddef>
+#include <new>
+#include "MemoryPool.h"
+
+namespace MemoryPoolV2
+{
+// 协程帧缓存：同一协程类型的帧大小固定，每个线程按帧大小缓存最近释放的帧，下一次创建同类协程时直接复用。
+// 命中时只需一次比较与一次链表弹出/压入，不经过大小类别计算与线程缓存的阈值检查。
+// 帧大小按 (size / ALIGNMENT) % NUM_SLOTS 映射到固定的槽位，槽位被其他大小占用（且仍有缓存的帧）时直接使用 MemoryPool
+class CoroutineFrameCache {
+public:
+    static const size_t NUM_SLOTS = 16;     // 每个线程同时缓存的帧大小数
+    static const size_t MAX_CACHED = 64;    // 每个帧大小最多缓存的帧数
+
+    // 分配 size 字节的协程帧，失败时抛出 std::bad_alloc
+    static void* allocate(size_t size) {
+        FrameSlot& slot = slots_[slotOf(size)];
+        if (slot.size == size && slot.head != nullptr) {
+            void* frame = slot.head;
+            slot.head = *reinterpret_cast<void**>(frame);
+            --slot.count;
+            return frame;
+        }
+        return allocateSlow(size);
+    }
+
+    static void deallocate(void* ptr, size_t size) {
+        FrameSlot& slot = slots_[slotOf(size)];
+        if (slot.size == size && slot.count < MAX_CACHED) {
+            *reinterpret_cast<void**>(ptr) = slot.head;
+            slot.head = ptr;
+            ++slot.count;
+            return;
+        }
+        deallocateSlow(ptr, size);
+    }
+
+    // 将当前线程缓存的帧全部归还给 MemoryPool（线程退出时自动调用）
+    static void flush();
+    // 当前线程缓存的帧数
+    static size_t getNumCached();
+
+private:
+    struct FrameSlot {
+        size_t size;    // 该槽位缓存的帧大小，0 表示未使用
+        void* head;
+        size_t count;
+    };
+    struct SlotsHolder;
+
+    static size_t slotOf(size_t size) { return size / ALIGNMENT % NUM_SLOTS; }
+    static void* allocateSlow(size_t size);
+    // 槽位为空时改为缓存该大小的帧，否则归还给 MemoryPool
+    static void deallocateSlow(void* ptr, size_t size);
+
+    static __thread FrameSlot slots_[NUM_SLOTS] __attribute__((tls_model("initial-exec")));
+};
+
+// 协程 promise 类型的基类：协程帧通过 MemoryPool 的按大小分配/释放的快速路径分配，
+// 编译器在释放帧时传入帧大小，无需额外记录
+struct PooledPromise {
+    static void* operator new(size_t size) {
+        void* ptr = MemoryPool::allocate(size);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+        MemoryPool::deallocate(ptr, size);
+    }
+};
+
+// 协程 promise 类型的基类：协程帧通过 CoroutineFrameCache 分配，适用于大量创建同一类型短生命周期协程的场景
+struct RecycledPromise {
+    static void* operator new(size_t size) {
+        return CoroutineFrameCache::allocate(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+        CoroutineFrameCache::deallocate(ptr, size);
+    }
+};
+}   // namespace MemoryPoolV2
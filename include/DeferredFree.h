@@ -0,0 +1,98 @@
+//
+// Created by 11361 on 25-5-1.
+//
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Common.h"
+
+namespace MemoryPoolV2
+{
+// 延迟释放：为延迟敏感的线程开启后，DeferredFree::deallocate 只将（地址，大小）压入该线程的有界环形缓冲区，
+// 由后台的 DeferredReclaimer 线程或该线程自己在空闲时调用 drain() 批量释放。
+// 压入是单生产者操作（一次写入与一次 release 存储），缓冲区满时退化为直接释放，因此最坏情况有界
+class DeferredFree {
+public:
+    static const size_t DEFAULT_CAPACITY = 1024;
+
+    // 为当前线程开启延迟释放，capacity 向上取整为 2 的幂
+    static void enable(size_t capacity = DEFAULT_CAPACITY);
+    // 释放缓冲区中剩余的内存并关闭当前线程的延迟释放
+    static void disable();
+    static bool isEnabled() { return local_ring_ != nullptr; }
+
+    // 释放大小为 size 的内存块：开启延迟释放时压入缓冲区，否则（或缓冲区已满）直接调用 MemoryPool::deallocate
+    static void deallocate(void* ptr, size_t size) {
+        Ring* ring = local_ring_;
+        if (ring != nullptr) {
+            size_t head = ring->head.load(std::memory_order_relaxed);
+            if (head - ring->cached_tail < ring->capacity || refreshTail(*ring, head)) {
+                ring->entries[head & (ring->capacity - 1)] = Entry{ptr, size};
+                ring->head.store(head + 1, std::memory_order_release);
+                return;
+            }
+        }
+        deallocateNow(ptr, size);
+    }
+
+    // 当前线程的空闲钩子：在当前线程中释放自身缓冲区中的内存，返回释放的内存块数
+    static size_t drain();
+    // 释放所有线程缓冲区中的内存（由 DeferredReclaimer 调用），返回释放的内存块数。
+    // 释放在调用线程中进行，结束时将调用线程缓存的内存块归还给中心缓存，供其他线程复用
+    static size_t drainAll();
+
+private:
+    struct Entry {
+        void* ptr;
+        size_t size;
+    };
+
+    // 单生产者（所属线程）、多消费者（所属线程的 drain 与回收线程，由 consumer_mutex 互斥）的环形缓冲区
+    struct Ring {
+        Entry* entries;
+        size_t capacity;
+        size_t cached_tail = 0;     // 生产者看到的 tail，缓冲区看起来已满时才重新读取，避免每次压入都读取消费者的缓存行
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> head{0};   // 只由生产者写入
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail{0};   // 只由持有 consumer_mutex 的消费者写入
+        std::mutex consumer_mutex;
+    };
+    struct RingHolder;
+
+    static bool refreshTail(Ring& ring, size_t head);
+    static void deallocateNow(void* ptr, size_t size);
+    // 释放 ring 中已压入的全部内存块（调用者需持有 consumer_mutex）
+    static size_t drainRing(Ring& ring);
+    static void unregisterRing(Ring* ring);
+    // 所有开启了延迟释放的线程的缓冲区
+    static std::mutex& registryMutex();
+    static std::vector<Ring*>& registry();
+
+    // 当前线程的缓冲区，未开启时为 nullptr
+    static __thread Ring* local_ring_ __attribute__((tls_model("initial-exec")));
+};
+
+// 周期性地调用 DeferredFree::drainAll() 的后台回收线程。析构时停止（并最后执行一次回收）
+class DeferredReclaimer {
+public:
+    explicit DeferredReclaimer(std::chrono::milliseconds interval);
+    ~DeferredReclaimer();
+    DeferredReclaimer(const DeferredReclaimer&) = delete;
+    DeferredReclaimer& operator=(const DeferredReclaimer&) = delete;
+
+private:
+    void run();
+
+private:
+    std::chrono::milliseconds interval_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+}   // namespace MemoryPoolV2
@@ -0,0 +1,183 @@
+//
+// Created by 11361 on 25-4-20.
+//
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "Arena.h"
+#include "PageCache.h"
+#include "CentralCache.h"
+#include "ThreadCache.h"
+
+namespace MemoryPoolV2
+{
+// 堆的内存统计信息
+struct HeapStats {
+    size_t system_bytes;        // 为 Span 向系统映射的字节数
+    size_t free_span_bytes;     // 其中处于空闲状态的 Span 字节数
+    size_t large_bytes;         // 大对象映射的字节数
+    size_t num_spans;           // Span 数量
+    size_t num_thread_caches;   // 当前绑定到该堆的线程缓存数量
+};
+
+// 单个大小类别的使用情况
+struct SizeClassReport {
+    size_t class_size;
+    size_t span_bytes;              // 为该类别获取的 Span 字节数
+    size_t num_blocks;              // 从 Span 切分出的块数
+    size_t central_free_blocks;     // 滞留在中心缓存中的空闲块数
+    size_t thread_free_blocks;      // 滞留在各线程缓存中的空闲块数
+    size_t in_use_blocks;           // 已分配给用户的块数
+    double utilization;             // 已分配块的字节数占 Span 字节数的比例
+    double internal_fragmentation;  // 按分配大小直方图估算的（块大小 - 请求大小）/ 块大小，未开启 MEMORYPOOL_SIZE_STATS 时为 -1
+};
+
+// 堆遍历的结果，用于分析驻留内存与实际使用内存之间的差距
+struct HeapReport {
+    HeapStats stats;
+    std::vector<SizeClassReport> classes;   // 只包括获取过 Span 的大小类别
+    FreeSpanReport free_spans;              // PageCache 中空闲 Span 的碎片情况
+    size_t in_use_bytes;                    // 已分配给用户的块字节数（按块大小计）
+    size_t central_free_bytes;              // 滞留在中心缓存中的字节数
+    size_t thread_free_bytes;               // 滞留在各线程缓存中的字节数
+    size_t span_tail_bytes;                 // Span 按块大小切分后剩余的字节数
+    size_t long_span_bytes;                 // Lifetime::Long 的中心缓存使用的 Span 字节数，不计入 classes
+    size_t long_in_use_bytes;               // 其中已分配给用户的字节数，与 getLifetimeStats(Lifetime::Long) 一致
+    size_t other_span_bytes;                // 已分配但不属于任何大小类别的 Span 字节数（如 Arena）
+};
+
+// 分配时提供的生命周期提示，生命周期不同的对象不共用 Span，长期存活的对象不会使大量短生命周期对象所在的 Span 无法归还
+enum class Lifetime : uint8_t {
+    Short = 0,      // 默认：经过线程缓存与中心缓存
+    Long = 1,       // 长期存活：从独立的中心缓存分配，不经过线程缓存
+    Permanent = 2,  // 直到堆销毁都不释放：在独立的 Arena 中碰撞分配，没有自由链表开销
+};
+constexpr size_t NUM_LIFETIMES = 3;
+
+// 单个生命周期提示的使用情况，用于比较不同提示的碎片程度
+struct LifetimeStats {
+    size_t num_allocs;      // 通过带提示的接口分配的次数
+    size_t num_frees;       // 通过带提示的接口释放的次数（Permanent 的释放不做任何事，不计入）
+    size_t span_bytes;      // 该提示使用的 Span 字节数（Short 包括不带提示的分配，不包括大对象）
+    size_t in_use_bytes;    // 已分配给用户的字节数（按块大小计，Permanent 按实际使用的字节数计）
+    double utilization;     // in_use_bytes / span_bytes，其余部分是滞留在缓存中或无法切分的空闲内存
+};
+
+// 相互隔离的堆：每个堆拥有独立的 PageCache、CentralCache 以及每个线程独立的 ThreadCache，
+// 不同堆之间不共享任何内存，可以通过 destroy() 一次性释放整个堆。
+// 默认堆（getDefault）即 MemoryPool 使用的堆。从某个堆分配的内存只能释放回同一个堆
+class Heap {
+public:
+    static const size_t MAX_HEAPS = 64;     // 同时存在的堆的最大数量（包括默认堆）
+
+    // 默认堆
+    static Heap& getDefault();
+
+    // 当前线程在默认堆上的线程缓存。快速路径只读取 initial-exec 模型的 __thread 变量（相对线程指针的一次寻址），
+    // 不经过函数内 thread_local 的初始化检查；首次调用或默认堆被销毁后进入慢速路径
+    static ThreadCache& defaultThreadCache() {
+        ThreadCache* cache = default_cache_;
+        if (cache != nullptr && default_cache_generation_ == default_generation_.load(std::memory_order_relaxed)) {
+            return *cache;
+        }
+        return defaultThreadCacheSlow();
+    }
+
+    // 创建新的堆，堆的数量超过 MAX_HEAPS 时抛出 std::runtime_error。
+    // 指定 source 时堆的全部页（包括大对象）都从 source 获取，source 需要比堆存活得更久
+    explicit Heap(PageSource* source = nullptr);
+    ~Heap();
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    void* allocate(size_t size) {
+        return getThreadCache().allocate(size);
+    }
+
+    void deallocate(void* ptr, size_t size) {
+        getThreadCache().deallocate(ptr, size);
+    }
+
+    // 按生命周期提示分配/释放，释放时传入与分配时相同的提示。Permanent 的内存只在 destroy 时整体回收，deallocate 不做任何事。
+    // 超过 MAX_BYTES 的大对象独占映射，Long 与 Short 相同
+    void* allocate(size_t size, Lifetime hint);
+    void deallocate(void* ptr, size_t size, Lifetime hint);
+    LifetimeStats getLifetimeStats(Lifetime hint);
+
+    // 当前线程在该堆上的线程缓存（首次调用时创建）
+    ThreadCache& getThreadCache() {
+        ThreadCacheSlot& slot = threadCacheSlots()[id_];
+        if (slot.cache != nullptr && slot.generation == generation_) {
+            return *slot.cache;
+        }
+        return createThreadCache();
+    }
+
+    PageCache& getPageCache() { return page_cache_; }
+    CentralCache& getCentralCache() { return central_cache_; }
+
+    HeapStats getStats();
+    // 遍历各大小类别、线程缓存与空闲 Span 统计碎片情况。只读取计数器并短暂持有锁，不遍历空闲链表，
+    // 可以在其他线程分配的同时调用（结果为近似值）
+    HeapReport walk();
+
+    // 回收自上一次调用以来没有任何分配/释放的线程缓存：在所有者线程不在操作中时直接将其缓存的内存块归还给中心缓存，
+    // 长时间阻塞的线程不需要被唤醒。通过 reserve/prewarm 预留的大小类别保留不动。返回回收的线程缓存数量。
+    // 系统不支持 membarrier 时退化为请求所有者线程在下一次分配/释放时裁剪
+    size_t scavengeIdleCaches();
+
+    // 设置该堆映射字节数的软/硬限制。超过软限制时自动调用 releaseMemory()
+    void setMemoryLimits(const MemoryLimits& limits) { page_cache_.setLimits(limits); }
+    // 将当前线程的缓存与其他不在操作中的线程缓存（包括长时间阻塞的线程）立即归还给中心缓存（reserve 预留的类别除外），
+    // 正在操作的线程缓存只请求裁剪，其内存在所有者线程下一次分配/释放时才归还。
+    // 然后将中心缓存保留的空 Span 归还给 PageCache，再将空闲 Span 归还给系统，返回 munmap 的字节数
+    size_t releaseMemory();
+
+    // 一次性将堆中所有内存归还给系统（时间复杂度与 Span 数量成正比），之前从该堆分配的内存全部失效。
+    // 调用时不能有其他线程正在使用该堆；之后堆可以继续使用，各线程会重新创建线程缓存
+    void destroy();
+
+private:
+    // 每个线程为每个堆保留一个槽位，generation 与堆不一致说明该槽位已失效（堆被销毁或槽位被新的堆复用）
+    struct ThreadCacheSlot {
+        ThreadCache* cache = nullptr;
+        uint64_t generation = 0;
+    };
+    using ThreadCacheSlots = std::array<ThreadCacheSlot, MAX_HEAPS>;
+    struct ThreadSlotsHolder;
+
+    static ThreadCacheSlots& threadCacheSlots();
+    static ThreadCache& defaultThreadCacheSlow();
+    // 线程退出时将其线程缓存归还给各个堆
+    static void onThreadExit(ThreadCacheSlots& slots);
+
+    ThreadCache& createThreadCache();
+    // 当前线程在该堆上的线程缓存，尚未创建时返回 nullptr
+    ThreadCache* findThreadCache();
+    void releaseThreadCache(ThreadCache* cache);
+
+private:
+    // 当前线程在默认堆上的线程缓存及其所属的代数，与 default_generation_ 不一致时失效。
+    // 以动态库形式使用时，库需要在程序启动时加载（initial-exec 模型不支持 dlopen 后分配 TLS）
+    static __thread ThreadCache* default_cache_ __attribute__((tls_model("initial-exec")));
+    static __thread uint64_t default_cache_generation_ __attribute__((tls_model("initial-exec")));
+    static std::atomic<uint64_t> default_generation_;   // 默认堆当前的代数
+
+    bool is_default_ = false;
+    size_t id_;                 // 在全局堆注册表中的槽位
+    uint64_t generation_;       // 每次创建/销毁时更新，用于使线程槽位失效
+    PageCache page_cache_;
+    CentralCache central_cache_;
+    CentralCache long_central_cache_;           // Lifetime::Long 的中心缓存，与 central_cache_ 共用 PageCache 但 Span 互不共享
+    Arena permanent_arena_;                     // Lifetime::Permanent 的碰撞分配器，由 permanent_mutex_ 保护
+    std::mutex permanent_mutex_;
+    std::array<std::atomic<size_t>, NUM_LIFETIMES> lifetime_allocs_{};
+    std::array<std::atomic<size_t>, NUM_LIFETIMES> lifetime_frees_{};
+    std::mutex mutex_;          // 保护 thread_caches_
+    std::vector<ThreadCache*> thread_caches_;   // 该堆上所有线程的线程缓存
+};
+}   // namespace MemoryPoolV2
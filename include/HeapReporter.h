@@ -0,0 +1,40 @@
+//
+// Created by 11361 on 25-4-26.
+//
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include "Heap.h"
+
+namespace MemoryPoolV2
+{
+// 周期性地遍历堆并输出碎片报告，用于在生产环境中观察驻留内存与实际使用内存的差距。
+// 每次报告只读取计数器并短暂持有锁，对正在分配的线程影响很小。析构时停止
+class HeapReporter {
+public:
+    HeapReporter(Heap& heap, std::chrono::milliseconds interval, FILE* out = stderr, size_t max_classes = 16);
+    ~HeapReporter();
+    HeapReporter(const HeapReporter&) = delete;
+    HeapReporter& operator=(const HeapReporter&) = delete;
+
+    // 输出一份报告：总览、空闲 Span 区间分布，以及浪费字节数最多的 max_classes 个大小类别
+    static void print(const HeapReport& report, FILE* out, size_t max_classes = 16);
+
+private:
+    void run();
+
+private:
+    Heap& heap_;
+    std::chrono::milliseconds interval_;
+    FILE* out_;
+    size_t max_classes_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+}   // namespace MemoryPoolV2
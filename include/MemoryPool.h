@@ -4,9 +4,15 @@
 
 #pragma once
 #include <atomic>
+#include <cstdint>
 #include <mutex>
+#include <vector>
 #include <cassert>
-#include "ThreadCache.h"
+#include "Heap.h"
+#include "SingleThreadHeap.h"
+#ifdef MEMORYPOOL_TRACE
+#include "AllocTrace.h"
+#endif
 
 namespace MemoryPoolV1
 {
@@ -18,8 +24,15 @@ struct Slot {
     std::atomic<Slot*> next;
 };
 
+// 内存块的头部：链接所有内存块，trim 时临时记录块内的空闲槽数
+struct Block {
+    Block* next;
+    size_t num_free;
+};
+
 class MemoryPool {
 public:
+    // block_size 必须为 2 的幂：内存块按 block_size 对齐，槽地址向下取整即得到所属的内存块
     explicit MemoryPool(size_t block_size = 4096);
     ~MemoryPool();
 
@@ -28,21 +41,46 @@ public:
     void* allocate();
     void deallocate(void*);
 
+    // 将所有槽都空闲的内存块的物理内存归还给系统，返回归还的内存块数。可以与 allocate/deallocate 并发调用
+    size_t trim();
+
 private:
     void allocateNewBlock();
+    // 通过 mmap 映射按 block_size_ 对齐的内存块，失败时抛出 std::bad_alloc
+    Block* mapBlock();
+    void unmapBlock(Block* block);
+    // 内存块实际映射的字节数（不足一页按一页映射）
+    size_t mappedSize() const;
     // 计算指针p对齐到slot（align）大小倍数所需填充的字节数
     static size_t padPointer(const char* p, size_t align);
+    // 内存块中第一个槽的地址，以及已经切分出的槽数
+    Slot* firstSlot(Block* block) const;
+    size_t numCarved(Block* block) const;
 
     // 使用CAS操作进行无锁入队和出队
     bool pushFreeList(Slot* slot);
     Slot* popFreeList();
+    // 将 [head, tail] 整段链表插入空闲链表
+    void pushFreeList(Slot* head, Slot* tail);
+
+    // free_list_ 的低 48 位为链表头指针，高 16 位为修改计数：每次修改都递增计数，
+    // 使 CAS 能够发现链表头被弹出后又被压回（ABA）的情况
+    static const int TAG_SHIFT = 48;
+    static Slot* headOf(uint64_t value) {
+        return reinterpret_cast<Slot*>(value & ((uint64_t(1) << TAG_SHIFT) - 1));
+    }
+    static uint64_t makeHead(Slot* slot, uint64_t old_value) {
+        return reinterpret_cast<uint64_t>(slot) | ((old_value >> TAG_SHIFT) + 1) << TAG_SHIFT;
+    }
 
 private:
     size_t block_size_;     // 内存块的大小
     size_t slot_size_;      // 内存槽的大小
-    Slot* first_block_;     // 指向第一个内存块Block的指针(第一个slot只用来链接，不用于数据存储)
+    Block* first_block_;    // 指向第一个内存块Block的指针(块的头部只用来链接，不用于数据存储)
+    Block* cur_block_;      // 当前正在切分的内存块
+    std::vector<Block*> retired_blocks_;    // trim 摘下的内存块：物理内存已归还但保持映射（其他线程可能仍在读取其中空闲槽的 next 指针），开辟新的内存块时优先复用
     Slot* cur_slot_;        // 指向当前可用内存槽的指针
-    std::atomic<Slot*> free_list_;  // 指向空闲的槽(被使用过后又被释放的槽)
+    std::atomic<uint64_t> free_list_;  // 指向空闲的槽(被使用过后又被释放的槽)，带修改计数
     Slot* last_slot_;       // 指向当前内存块最后一个可用内存槽的指针
     std::mutex mutex_for_block_;    // // 保证多线程情况下避免不必要的重复开辟内存导致的浪费行为
 };
@@ -52,6 +90,8 @@ public:
     static void initMemoryPool();
     // 单例模式
     static MemoryPool& getMemoryPool(size_t index);
+    // 对所有内存池调用 trim，返回归还的内存块总数
+    static size_t trim();
 
     // 根据所需内存的大小，选择合适的方式来分配内存
     static void* useMemory(size_t size) {
@@ -64,7 +104,7 @@ public:
         }
         // 计算合适的内存池索引，相当于 size / 8 向上取整
         // 因为内存分配只能大不能小，所以通过 (size + 7) / SLOT_BASE_SIZE - 1 来确定索引
-        return getMemoryPool((size + 7) % SLOT_BASE_SIZE - 1).allocate();
+        return getMemoryPool((size + 7) / SLOT_BASE_SIZE - 1).allocate();
     }
 
     static void freeMemory(void* ptr, size_t size) {
@@ -75,7 +115,7 @@ public:
             operator delete(ptr);
             return;
         }
-        getMemoryPool((size + 7) % SLOT_BASE_SIZE - 1).deallocate(ptr);
+        getMemoryPool((size + 7) / SLOT_BASE_SIZE - 1).deallocate(ptr);
     }
 
     // 利用自定义的内存池机制为对象分配内存，并在这块内存上构造对象
@@ -112,14 +152,128 @@ void deleteElement(T* ptr) {
 
 namespace MemoryPoolV2
 {
+// 编译时定义 MEMORYPOOL_TRACE 后，分配/释放会写入 AllocTrace 的追踪文件；
+// 定义 MEMORYPOOL_SINGLE_THREADED 后使用 SingleThreadHeap（只能用于单线程程序），带生命周期提示的接口仍使用默认堆
 class MemoryPool {
 public:
     static void* allocate(size_t size) {
-        return ThreadCache::getInstance().allocate(size);
+        void* ptr = cache().allocate(size);
+#ifdef MEMORYPOOL_TRACE
+        AllocTrace::record(TraceOp::Alloc, ptr, size);
+#endif
+        return ptr;
     }
 
     static void deallocate(void* ptr, size_t size) {
-        ThreadCache::getInstance().deallocate(ptr, size);
+#ifdef MEMORYPOOL_TRACE
+        AllocTrace::record(TraceOp::Free, ptr, size);
+#endif
+        cache().deallocate(ptr, size);
+    }
+
+    // 按生命周期提示分配，释放时需传入相同的提示。Permanent 的内存不能释放
+    static void* allocate(size_t size, Lifetime hint) {
+        void* ptr = Heap::getDefault().allocate(size, hint);
+#ifdef MEMORYPOOL_TRACE
+        AllocTrace::record(TraceOp::Alloc, ptr, size);
+#endif
+        return ptr;
+    }
+
+    static void deallocate(void* ptr, size_t size, Lifetime hint) {
+#ifdef MEMORYPOOL_TRACE
+        AllocTrace::record(TraceOp::Free, ptr, size);
+#endif
+        Heap::getDefault().deallocate(ptr, size, hint);
+    }
+
+    // 默认堆上各生命周期提示的使用情况
+    static LifetimeStats get_lifetime_stats(Lifetime hint) {
+        return Heap::getDefault().getLifetimeStats(hint);
+    }
+
+    // 批量分配 n 个大小为 size 的内存块到 out 中，返回实际分配的数量（小于 n 说明内存不足）
+    static size_t allocate_batch(size_t size, size_t n, void** out) {
+        size_t count = cache().allocateBatch(size, n, out);
+#ifdef MEMORYPOOL_TRACE
+        for (size_t i = 0; i < count; ++i) {
+            AllocTrace::record(TraceOp::Alloc, out[i], size);
+        }
+#endif
+        return count;
+    }
+
+    // 批量释放 n 个大小为 size 的内存块
+    static void deallocate_batch(void** ptrs, size_t n, size_t size) {
+#ifdef MEMORYPOOL_TRACE
+        for (size_t i = 0; i < n; ++i) {
+            AllocTrace::record(TraceOp::Free, ptrs[i], size);
+        }
+#endif
+        cache().deallocateBatch(ptrs, n, size);
     }
+
+    // 按 align 对齐分配内存（align 为 2 的幂且不超过页大小，如 SIMD 缓冲区、独占缓存行的计数器）
+    static void* allocate_aligned(size_t size, size_t align) {
+        void* ptr = cache().allocateAligned(size, align);
+#ifdef MEMORYPOOL_TRACE
+        AllocTrace::record(TraceOp::Alloc, ptr, size, align);
+#endif
+        return ptr;
+    }
+
+    static void deallocate_aligned(void* ptr, size_t size, size_t align) {
+#ifdef MEMORYPOOL_TRACE
+        AllocTrace::record(TraceOp::Free, ptr, size, align);
+#endif
+        cache().deallocateAligned(ptr, size, align);
+    }
+
+    // 在当前线程的缓存中预先准备 count 个大小为 size 的内存块，用于延迟敏感阶段之前的预热
+    static size_t reserve(size_t size, size_t count) {
+        return cache().reserve(size, count);
+    }
+
+    // 按预热配置（大小，数量）预热当前线程的缓存
+    static void prewarm(const WarmupProfile& profile) {
+        cache().prewarm(profile);
+    }
+
+    // 将当前线程缓存的内存块全部归还给中心缓存，供线程池等在线程长时间阻塞之前调用
+    static void trim_thread_cache() {
+        cache().trim();
+    }
+
+    // 设置默认堆映射字节数的软/硬限制，超过硬限制时按 limits 的设置调用处理函数、返回 nullptr 或抛出 std::bad_alloc
+    static void set_memory_limits(const MemoryLimits& limits) {
+        heap().setMemoryLimits(limits);
+    }
+
+    // 裁剪所有线程缓存并将空闲 Span 归还给系统，返回 munmap 的字节数
+    static size_t release_memory() {
+        return heap().releaseMemory();
+    }
+
+    // 将 ptr 指向的内存块从 old_size 调整为 new_size，能原地扩缩时返回原地址
+    static void* reallocate(void* ptr, size_t old_size, size_t new_size) {
+#ifdef MEMORYPOOL_TRACE
+        AllocTrace::record(TraceOp::ReallocFrom, ptr, old_size);
+        void* result = cache().reallocate(ptr, old_size, new_size);
+        AllocTrace::record(TraceOp::ReallocTo, result, new_size);
+        return result;
+#else
+        return cache().reallocate(ptr, old_size, new_size);
+#endif
+    }
+
+private:
+#ifdef MEMORYPOOL_SINGLE_THREADED
+    // 单线程版本：没有线程缓存与中心缓存，直接使用默认单线程堆的自由链表
+    static SingleThreadHeap& cache() { return SingleThreadHeap::getDefault(); }
+    static SingleThreadHeap& heap() { return SingleThreadHeap::getDefault(); }
+#else
+    static ThreadCache& cache() { return Heap::defaultThreadCache(); }
+    static Heap& heap() { return Heap::getDefault(); }
+#endif
 };
 }   // namespace MemoryPoolV2
\ No newline at end of file
@@ -0,0 +1,108 @@
+//
+// Created by 11361 on 25-4-23.
+//
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace MemoryPoolV2
+{
+// 内部元数据（Span 等）使用的定长分配器：从专用的 mmap 页中连续切分固定大小的对象，释放的对象进入空闲链表复用。
+// 元数据与用户内存分开存放且排列紧凑，分配过程不经过 malloc/new，因此可以在 PageCache 的临界区内调用，
+// 也不会在替换全局分配器（LD_PRELOAD）时产生递归
+class FixedSizeAllocator {
+public:
+    static const size_t CHUNK_BYTES = 64 * 1024;    // 每次向系统申请 64KB
+
+    FixedSizeAllocator(size_t object_size, size_t align);
+    FixedSizeAllocator(const FixedSizeAllocator&) = delete;
+    FixedSizeAllocator& operator=(const FixedSizeAllocator&) = delete;
+
+    void* allocate();
+    void deallocate(void* ptr);
+
+    // 绕过空闲链表，直接映射/解除映射 bytes 字节（用于 vector 等一次申请多个对象的元数据容器）
+    static void* allocatePages(size_t bytes);
+    static void deallocatePages(void* ptr, size_t bytes);
+
+private:
+    void lock() {
+        while (lock_.test_and_set(std::memory_order_acquire)) {
+        }
+    }
+    void unlock() {
+        lock_.clear(std::memory_order_release);
+    }
+
+private:
+    size_t object_size_;    // 对齐后的对象大小
+    void* free_list_;       // 已释放对象的空闲链表
+    char* cur_;             // 当前 chunk 中下一个未使用的位置
+    char* end_;             // 当前 chunk 的结束位置
+    std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+};
+
+// 每种元数据类型共享一个定长分配器
+template<typename T>
+class MetadataAllocator {
+public:
+    static FixedSizeAllocator& getInstance() {
+        static FixedSizeAllocator instance(sizeof(T), alignof(T));
+        return instance;
+    }
+
+    template<typename... Args>
+    static T* create(Args&&... args) {
+        void* ptr = getInstance().allocate();
+        return ptr ? new(ptr) T(std::forward<Args>(args)...) : nullptr;
+    }
+
+    static void destroy(T* ptr) {
+        if (ptr) {
+            ptr->~T();
+            getInstance().deallocate(ptr);
+        }
+    }
+};
+
+// 元数据容器（如 PageCache 中的 std::map）使用的 STL 分配器，单个节点从 MetadataAllocator 分配
+template<typename T>
+class MetadataStlAllocator {
+public:
+    using value_type = T;
+
+    MetadataStlAllocator() noexcept = default;
+    template<typename U>
+    MetadataStlAllocator(const MetadataStlAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        void* ptr = n == 1 ? MetadataAllocator<T>::getInstance().allocate()
+                           : FixedSizeAllocator::allocatePages(n * sizeof(T));
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept {
+        if (n == 1) {
+            MetadataAllocator<T>::getInstance().deallocate(ptr);
+        } else {
+            FixedSizeAllocator::deallocatePages(ptr, n * sizeof(T));
+        }
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const MetadataStlAllocator<T>&, const MetadataStlAllocator<U>&) noexcept {
+    return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const MetadataStlAllocator<T>&, const MetadataStlAllocator<U>&) noexcept {
+    return false;
+}
+}   // namespace MemoryPoolV2
@@ -2,31 +2,118 @@
 // Created by 11361 on 25-3-26.
 //
 #pragma once
+#include <atomic>
 #include <cstddef>
 #include <map>
 #include <mutex>
+#include <vector>
+#include "Common.h"
+#include "MetadataAllocator.h"
 
 namespace MemoryPoolV2
 {
+// PageCache 的内存统计信息
+struct PageCacheStats {
+    size_t system_bytes;    // 为 Span 向系统映射的字节数
+    size_t free_bytes;      // 其中处于空闲状态（未分配给 CentralCache/Arena）的字节数
+    size_t large_bytes;     // 大对象映射的字节数
+    size_t num_spans;       // Span 数量（包括空闲的）
+};
+
+// 空闲 Span 的碎片信息。地址相邻的空闲 Span 合并为一个连续空闲区间（run）统计
+struct FreeSpanReport {
+    static const size_t NUM_BUCKETS = 16;
+    size_t num_free_spans;
+    size_t num_free_runs;
+    size_t free_pages;
+    size_t largest_free_run;            // 最大连续空闲区间的页数
+    size_t run_count[NUM_BUCKETS];      // 第 i 个桶统计页数在 [2^i, 2^(i+1)) 内的区间数，最后一个桶包括更大的区间
+    size_t run_pages[NUM_BUCKETS];      // 各桶中区间的总页数
+};
+
+// 超过硬限制时调用的处理函数，参数为本次需要映射的字节数与当前已映射的字节数。
+// 返回 true 表示已经释放了内存（如丢弃缓存、拒绝请求），重新检查限制；返回 false 表示本次分配失败。
+// 处理函数可能在持有中心缓存锁时被调用，不能从同一个堆分配或释放内存
+using MemoryLimitHandler = bool (*)(size_t requested_bytes, size_t mapped_bytes);
+
+// 映射字节数（Span 与大对象）的限制，0 表示不限制
+struct MemoryLimits {
+    size_t soft_bytes = 0;      // 超过时主动释放内存：归还各线程缓存中的内存块，并将空闲 Span 归还给系统
+    size_t hard_bytes = 0;      // 超过时先释放内存，仍然超过则调用 handler，最终失败时返回 nullptr
+    MemoryLimitHandler handler = nullptr;
+    bool throw_on_failure = false;  // 超过硬限制导致分配失败时抛出 std::bad_alloc 而不是返回 nullptr
+};
+
+// PageCache 向系统获取页的后端，默认（未设置时）使用匿名 mmap。
+// 实现需要线程安全，mapPages 返回按页对齐的地址，失败返回 nullptr；unmapPages 可能只归还 mapPages 所得区域的一部分
+class PageSource {
+public:
+    virtual ~PageSource() = default;
+    virtual void* mapPages(size_t num_pages) = 0;
+    virtual void unmapPages(void* ptr, size_t num_pages) = 0;
+};
+
 class PageCache {
 public:
     static const size_t PAGE_SIZE = 4096;   // 4K页大小（操作系统分配内存的基本单位）
 
-    // 线程安全的懒汉式单例实现
-    static PageCache& getInstance() {
-        static PageCache instance;
-        return instance;
-    }
+    // 默认堆的 PageCache
+    static PageCache& getInstance();
+
+    PageCache() = default;
+    ~PageCache();
+    PageCache(const PageCache&) = delete;
+    PageCache& operator=(const PageCache&) = delete;
 
     // 分配指定页数的内存块（Span）
     void* allocateSpan(size_t num_pages);
-    // 释放指定地址和页数的 Span。释放时会尝试合并相邻的 Span，以减少内存碎片
+    // 释放指定地址和页数的 Span。调用者必须保证 ptr 由 allocateSpan 返回且 num_pages 与 Span 的实际页数一致：
+    // 不超过 SMALL_SPAN_PAGES 页的 Span 不经检查直接放入分片缓存（只在调试版本中断言），
+    // 其余的插入空闲链表，并尝试合并相邻的 Span 以减少内存碎片
     void deallocateSpan(void* ptr, size_t num_pages);
+    // 原地调整已分配 Span 的页数（扩大时占用紧邻的空闲页，缩小时归还尾部的页），失败返回 false
+    bool resizeSpan(void* ptr, size_t num_pages);
+
+    // 大对象（超过 MAX_BYTES）直接通过 mmap 向系统申请，不经过 Span 管理
+    void* allocateLarge(size_t size);
+    void deallocateLarge(void* ptr, size_t size);
+    // 使用 mremap 调整大对象大小，避免拷贝数据
+    void* reallocateLarge(void* ptr, size_t old_size, size_t new_size);
+
+    // 预先触发 [ptr, ptr + bytes) 的缺页，不改变内存内容
+    static void prefault(void* ptr, size_t bytes);
+
+    // 设置获取页的后端（如共享内存区域），只能在第一次分配之前调用。大对象同样从后端获取，调整大小时需要拷贝
+    void setPageSource(PageSource* source) { page_source_ = source; }
+
+    // 设置映射字节数的限制，可以在运行期间调整
+    void setLimits(const MemoryLimits& limits);
+    // 超过软限制时的回调（默认只调用 releaseFreeMemory），由所属的堆设置为同时裁剪线程缓存
+    void setPressureCallback(void (*callback)(void*), void* arg);
+    // 当前映射的字节数（Span 与大对象）
+    size_t getMappedBytes() const { return mapped_bytes_.load(std::memory_order_relaxed); }
+    // 将不小于 RELEASE_MIN_PAGES 页的空闲 Span 归还给系统（munmap），更小的空闲 Span 通过 madvise 释放物理内存，
+    // 返回归还给系统的字节数
+    size_t releaseFreeMemory();
+
+    // 将所有向系统映射的内存（Span 与大对象）一次性归还给系统，之前分配的内存全部失效
+    void releaseAll();
+    PageCacheStats getStats();
+    // 遍历空闲 Span，统计连续空闲区间的分布（不包括分片缓存中的 Span）
+    FreeSpanReport getFreeSpanReport();
 
 private:
-    PageCache() = default;
     // 用于向操作系统申请指定页数的内存
     void* systemAlloc(size_t num_pages);
+    // 将 systemAlloc 或 allocateLarge 得到的页（的一部分）归还给系统或后端
+    void systemFree(void* ptr, size_t num_pages);
+    // 映射 bytes 字节之前检查限制，允许时将其计入 mapped_bytes_，否则返回 false 或抛出 std::bad_alloc。
+    // 会调用压力回调与用户的处理函数，调用者不能持有 mutex_
+    bool admitMapping(size_t bytes);
+    // 超过软限制时释放内存
+    void relievePressure();
+    // 从 system_spans_ 中去掉已归还给系统的 [addr, addr + num_pages 页)
+    void removeSystemRange(char* addr, size_t num_pages);
 
 private:
     // Span 结构体表示一个连续的内存块
@@ -35,11 +122,68 @@ private:
         size_t num_pages;   // 页数
         Span* next;
     };
+
+    static const size_t RELEASE_MIN_PAGES = 8;  // 归还给系统的空闲 Span 的最小页数，避免产生过多的映射区域
+
+    // 将 Span 从空闲链表中移除，Span 不在空闲链表中时返回 false
+    bool removeFreeSpan(Span* span);
+    // 将 Span 插入空闲链表，并与紧邻其后的空闲 Span 合并
+    void insertFreeSpan(Span* span);
+
+    // 页数不超过 SMALL_SPAN_PAGES 的 Span 释放时先放入分片缓存，分配时优先从分片缓存获取，常规的 Span 补充与归还不需要获取 mutex_。
+    // 每种页数有 NUM_SPAN_SHARDS 个分片，线程优先使用自己的分片，分片繁忙时不等待而是尝试下一个分片。
+    // 分片缓存中的 Span 仍记录在 span_map_ 中（不在空闲链表中），不参与合并，releaseFreeMemory 时才插入空闲链表
+    static const size_t SMALL_SPAN_PAGES = 8;
+    static const size_t NUM_SPAN_SHARDS = 4;
+    static const size_t SHARD_CAPACITY = 16;
+    struct alignas(CACHE_LINE_SIZE) SpanShard {
+        std::atomic_flag lock = ATOMIC_FLAG_INIT;
+        std::atomic<uint32_t> count{0};     // 只在持有 lock 时修改，读取时可以不加锁作为提示
+        void* spans[SHARD_CAPACITY];
+    };
+
+    // 从分片缓存获取 num_pages 页的 Span，没有时返回 nullptr
+    void* popShard(size_t num_pages);
+    // 将 Span 放入分片缓存，所有分片都已满或繁忙时返回 false
+    bool pushShard(void* ptr, size_t num_pages);
+    // 将分片缓存中的 Span 全部插入空闲链表（调用者需持有 mutex_）
+    void drainShards();
+    // 当前线程优先使用的分片
+    static size_t shardHint();
+
+    // Span 及各容器的节点都通过 MetadataAllocator 分配，PageCache 的临界区内不会调用 malloc/new
+    template<typename K, typename V>
+    using MetadataMap = std::map<K, V, std::less<K>, MetadataStlAllocator<std::pair<const K, V>>>;
+
     // 按页数管理空闲的 Span 链表。键为页数，值为对应页数的 Span 链表头指针
-    std::map<size_t, Span*> free_spans_;
+    MetadataMap<size_t, Span*> free_spans_;
     // 存储页号(页起始地址)到 Span 的映射，用于在释放内存时快速找到对应的 Span
-    std::map<void*, Span*> span_map_;
+    MetadataMap<void*, Span*> span_map_;
+    // 向系统映射的内存区域（起始地址与页数），releaseAll 时逐个 munmap
+    std::vector<std::pair<void*, size_t>, MetadataStlAllocator<std::pair<void*, size_t>>> system_spans_;
+    // 大对象的起始地址到映射字节数
+    MetadataMap<void*, size_t> large_spans_;
+    size_t system_pages_ = 0;   // 为 Span 映射的总页数
+    size_t free_pages_ = 0;     // 空闲 Span 的总页数
+    size_t large_bytes_ = 0;    // 大对象映射的总字节数
     std::mutex mutex_;
+
+    // 小 Span 的分片缓存，shards_[页数 - 1][分片]
+    SpanShard shards_[SMALL_SPAN_PAGES][NUM_SPAN_SHARDS];
+    std::atomic<size_t> shard_pages_{0};    // 分片缓存中的总页数
+    static __thread size_t shard_hint_ __attribute__((tls_model("initial-exec")));    // 0 表示尚未分配
+
+    // 映射字节数的限制。mapped_bytes_ 在映射之前预先增加，不需要持有 mutex_
+    std::atomic<size_t> mapped_bytes_{0};
+    std::atomic<size_t> soft_limit_{0};
+    std::atomic<size_t> hard_limit_{0};
+    std::atomic<MemoryLimitHandler> limit_handler_{nullptr};
+    std::atomic<bool> throw_on_limit_{false};
+    std::atomic<size_t> pressure_mark_{0};      // 映射字节数超过该值时触发下一次释放，避免每次映射都释放
+    std::atomic_flag releasing_ = ATOMIC_FLAG_INIT;
+    void (*pressure_callback_)(void*) = nullptr;
+    void* pressure_arg_ = nullptr;
+    PageSource* page_source_ = nullptr;     // 为 nullptr 时使用匿名 mmap
 };
 
 
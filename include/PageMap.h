@@ -0,0 +1,47 @@
+//
+// Created by 11361 on 25-4-29.
+//
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace MemoryPoolV2
+{
+// 页号到元数据指针的两级基数树，用于 O(1) 地找到内存块所属的 Span。
+// 覆盖 48 位地址空间：根节点与叶子节点都通过 FixedSizeAllocator::allocatePages 映射，只有用到的部分占用物理内存。
+// 每个叶子节点覆盖 1GB 地址空间，按需创建后不再释放（直到 PageMap 析构）。
+// 不同线程可以同时读写不同页的条目；同一页的读写需要由调用者同步
+class PageMap {
+public:
+    static const size_t PAGE_SHIFT = 12;
+    static const size_t ADDRESS_BITS = 48;
+    static const size_t LEAF_BITS = 18;
+    static const size_t ROOT_BITS = ADDRESS_BITS - PAGE_SHIFT - LEAF_BITS;
+    static const size_t ROOT_LENGTH = size_t(1) << ROOT_BITS;
+    static const size_t LEAF_LENGTH = size_t(1) << LEAF_BITS;
+
+    PageMap();
+    ~PageMap();
+    PageMap(const PageMap&) = delete;
+    PageMap& operator=(const PageMap&) = delete;
+
+    // 查找 addr 所在页的条目，未设置时返回 nullptr
+    void* get(const void* addr) const {
+        uintptr_t page = reinterpret_cast<uintptr_t>(addr) >> PAGE_SHIFT;
+        Leaf* leaf = root_[(page >> LEAF_BITS) & (ROOT_LENGTH - 1)].load(std::memory_order_acquire);
+        return leaf != nullptr ? leaf->values[page & (LEAF_LENGTH - 1)].load(std::memory_order_relaxed) : nullptr;
+    }
+
+    // 将 [addr, addr + num_pages 页) 的条目设置为 value，需要时创建叶子节点，内存不足时返回 false
+    bool set(const void* addr, size_t num_pages, void* value);
+
+private:
+    struct Leaf {
+        std::atomic<void*> values[LEAF_LENGTH];
+    };
+
+    std::atomic<Leaf*>* root_;
+};
+}   // namespace MemoryPoolV2
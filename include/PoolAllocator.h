@@ -0,0 +1,66 @@
+//
+// Created by 11361 on 25-4-16.
+//
+
+#pragma once
+#include <memory_resource>
+#include <new>
+#include <limits>
+#include "MemoryPool.h"
+
+namespace MemoryPoolV2
+{
+// 基于 MemoryPoolV2 的 std::pmr::memory_resource 实现，可用于 std::pmr 容器。
+// do_deallocate 带有大小参数，可直接走线程本地缓存的快速路径
+class PoolMemoryResource : public std::pmr::memory_resource {
+public:
+    // 所有实例共享同一个内存池，通常直接使用该单例
+    static PoolMemoryResource& getInstance();
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+// 无状态的 STL 分配器，所有实例均相等，可用于 std::map/std::list/std::unordered_map 等容器
+template<typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void* ptr = alignof(T) <= ALIGNMENT ? MemoryPool::allocate(n * sizeof(T))
+                                            : MemoryPool::allocate_aligned(n * sizeof(T), alignof(T));
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept {
+        if (alignof(T) <= ALIGNMENT) {
+            MemoryPool::deallocate(ptr, n * sizeof(T));
+        } else {
+            MemoryPool::deallocate_aligned(ptr, n * sizeof(T), alignof(T));
+        }
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) noexcept {
+    return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) noexcept {
+    return false;
+}
+}   // namespace MemoryPoolV2
@@ -0,0 +1,93 @@
+//
+// Created by 11361 on 25-4-27.
+//
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+
+namespace MemoryPoolV2
+{
+// 慢速路径上的事件
+enum class ProbeEvent : uint8_t {
+    CentralFetch = 0,   // 线程缓存从中心缓存批量获取（参数：大小类别，数量）
+    CentralReturn,      // 线程缓存向中心缓存归还（参数：大小类别，数量）
+    SpanAlloc,          // 中心缓存/Arena 从 PageCache 获取 Span（参数：页数，是否向系统申请）
+    SpanSplit,          // PageCache 拆分空闲 Span（参数：原页数，剩余页数）
+    SpanCoalesce,       // PageCache 合并相邻的空闲 Span（参数：合并前页数，合并后页数）
+    SystemMap,          // 通过 mmap 向系统申请内存（参数：字节数，是否为大对象）
+    CentralLockWait,    // 中心缓存自旋锁发生竞争时的等待（参数：大小类别，让步次数）
+    Count
+};
+
+// 按 2 的幂划分的延迟直方图：第 i 个桶统计耗时在 [2^i, 2^(i+1)) 纳秒内的事件数（第 0 个桶包括 0）
+struct LatencyHistogram {
+    static const size_t NUM_BUCKETS = 40;
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[NUM_BUCKETS];
+
+    // 估算第 p 分位（0~1）的耗时上界
+    uint64_t percentile(double p) const;
+};
+
+// 慢速路径探针：编译时定义 MEMORYPOOL_PROBES 后，每个事件记录到进程内的延迟直方图；
+// 系统提供 <sys/sdt.h> 时同时生成 USDT 探针（provider 为 memorypool，参数为事件的两个参数和耗时），
+// 可以用 bpftrace/perf 在运行时挂载。未定义 MEMORYPOOL_PROBES 时所有探针都被编译掉
+class Probes {
+public:
+    static uint64_t nowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    // 记录一次事件
+    static void fire(ProbeEvent event, uint64_t arg0, uint64_t arg1, uint64_t ns);
+
+    static const char* eventName(ProbeEvent event);
+    static LatencyHistogram getHistogram(ProbeEvent event);
+    static void reset();
+    // 输出各事件的次数与延迟分布
+    static void print(FILE* out);
+};
+
+// 在作用域结束时记录耗时
+class ProbeScope {
+public:
+    ProbeScope(ProbeEvent event, uint64_t arg0, uint64_t arg1 = 0)
+        : event_(event), arg0_(arg0), arg1_(arg1), start_(Probes::nowNs()) {}
+    ~ProbeScope() {
+        Probes::fire(event_, arg0_, arg1_, Probes::nowNs() - start_);
+    }
+    ProbeScope(const ProbeScope&) = delete;
+    ProbeScope& operator=(const ProbeScope&) = delete;
+
+    // 作用域内得知的参数（如实际获取的数量）
+    void setArgs(uint64_t arg0, uint64_t arg1) {
+        arg0_ = arg0;
+        arg1_ = arg1;
+    }
+
+private:
+    ProbeEvent event_;
+    uint64_t arg0_;
+    uint64_t arg1_;
+    uint64_t start_;
+};
+}   // namespace MemoryPoolV2
+
+#ifdef MEMORYPOOL_PROBES
+#define MEMORYPOOL_PROBE_SCOPE(name, event, arg0, arg1) \
+    ::MemoryPoolV2::ProbeScope name(::MemoryPoolV2::ProbeEvent::event, (arg0), (arg1))
+#define MEMORYPOOL_PROBE_SET_ARGS(name, arg0, arg1) name.setArgs((arg0), (arg1))
+#define MEMORYPOOL_PROBE(event, arg0, arg1) \
+    ::MemoryPoolV2::Probes::fire(::MemoryPoolV2::ProbeEvent::event, (arg0), (arg1), 0)
+#else
+#define MEMORYPOOL_PROBE_SCOPE(name, event, arg0, arg1) ((void)0)
+#define MEMORYPOOL_PROBE_SET_ARGS(name, arg0, arg1) ((void)0)
+#define MEMORYPOOL_PROBE(event, arg0, arg1) ((void)0)
+#endif
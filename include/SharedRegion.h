@@ -0,0 +1,94 @@
+//
+// Created by 11361 on 25-5-3.
+//
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "PageCache.h"
+
+namespace MemoryPoolV2
+{
+// 共享区域的底层对象
+enum class SharedBacking {
+    Memfd,      // memfd_create 创建的匿名文件，通过 fork 继承或传递文件描述符共享
+    Shm,        // shm_open 创建的命名共享内存（name 形如 "/name"）
+    File,       // 普通文件，name 为路径
+};
+
+// 共享区域的头部，位于区域的第一页。区域内只记录偏移，各进程可以映射到不同的地址
+struct SharedRegionHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t num_pages;             // 区域总页数（包括头部页）
+    std::atomic<uint32_t> lock;     // 跨进程自旋锁，保护空闲区间链表
+    uint64_t free_head;             // 第一个空闲区间的偏移，0 表示没有空闲区间
+    uint64_t free_pages;
+};
+
+// 映射到多个进程的共享内存区域，按页分配，返回相对区域起始处的偏移。
+// 空闲区间链表保存在空闲页本身之中（偏移而非指针），任何进程都可以释放其他进程分配的偏移，
+// 协作的进程之间只需传递偏移即可共享数据，不需要拷贝。
+// 同时实现 PageSource：Heap(&region) 的 Span 与大对象都来自该区域，但堆的元数据属于创建堆的进程，
+// 从堆分配的内存只能在该进程中释放；跨进程转交的内存应通过 allocate/deallocate 分配
+class SharedRegion : public PageSource {
+public:
+    static constexpr uint64_t MAGIC = 0x4e4f494745524d50ULL;    // "PMREGION"
+    static constexpr uint32_t VERSION = 1;
+    static const size_t PAGE_SIZE = PageCache::PAGE_SIZE;
+
+    SharedRegion() = default;
+    ~SharedRegion() override;
+    SharedRegion(const SharedRegion&) = delete;
+    SharedRegion& operator=(const SharedRegion&) = delete;
+
+    // 创建 bytes 字节（向上取整为页）的区域并映射，已存在的同名 Shm/File 会被截断重建。失败返回 false
+    bool create(SharedBacking backing, const char* name, size_t bytes);
+    // 映射已存在的 Shm/File 区域，头部无效时返回 false
+    bool open(SharedBacking backing, const char* name);
+    // 映射由其他进程传递的文件描述符（复制一份，不接管 fd）
+    bool attach(int fd);
+    // 解除映射并关闭文件描述符，区域本身仍然存在
+    void close();
+    // 删除命名的 Shm/File 区域，已映射的进程不受影响
+    static bool remove(SharedBacking backing, const char* name);
+
+    // 分配 bytes 字节（向上取整为页），返回偏移，空间不足时返回 0
+    size_t allocate(size_t bytes);
+    // 释放 allocate 返回的偏移，bytes 与分配时相同。可以在任何映射了该区域的进程中调用
+    void deallocate(size_t offset, size_t bytes);
+
+    void* toPointer(size_t offset) const { return base_ + offset; }
+    size_t toOffset(const void* ptr) const { return static_cast<const char*>(ptr) - base_; }
+    bool isMapped() const { return header_ != nullptr; }
+    int getFd() const { return fd_; }
+    size_t getSize() const { return size_; }
+    size_t getFreeBytes() const;
+
+    void* mapPages(size_t num_pages) override;
+    void unmapPages(void* ptr, size_t num_pages) override;
+
+private:
+    // 空闲区间的头部，位于区间的第一页，链表按偏移升序排列以便合并相邻区间
+    struct FreeRun {
+        uint64_t num_pages;
+        uint64_t next;
+    };
+
+    bool map(int fd);
+    bool isValid() const;
+    size_t allocatePages(size_t num_pages);
+    void deallocatePages(size_t offset, size_t num_pages);
+    FreeRun* runAt(uint64_t offset) const { return reinterpret_cast<FreeRun*>(base_ + offset); }
+    void lock();
+    void unlock();
+
+private:
+    int fd_ = -1;
+    char* base_ = nullptr;
+    size_t size_ = 0;
+    SharedRegionHeader* header_ = nullptr;
+};
+}   // namespace MemoryPoolV2
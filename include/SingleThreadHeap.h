@@ -0,0 +1,95 @@
+//
+// Created by 11361 on 25-5-5.
+//
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include "Common.h"
+#include "PageCache.h"
+#include "ThreadCache.h"
+#ifdef MEMORYPOOL_SIZE_STATS
+#include "SizeHistogram.h"
+#endif
+
+namespace MemoryPoolV2
+{
+// 单线程堆：线程缓存与中心缓存合并为一层自由链表，分配/释放不使用原子操作、锁或线程本地变量。
+// 每个大小类别从 PageCache 获取 Span 后按需切分，释放的块留在自由链表中，不归还给 PageCache；
+// PageCache 只在获取 Span 与大对象时使用，其互斥锁始终无竞争。
+// 只能由同一个线程使用（或由调用者保证互斥）。编译时定义 MEMORYPOOL_SINGLE_THREADED 后 MemoryPool 使用默认的单线程堆
+class SingleThreadHeap {
+public:
+    // 默认的单线程堆，永不析构
+    static SingleThreadHeap& getDefault();
+
+    SingleThreadHeap() {
+        free_list_.fill(nullptr);
+        unused_.fill(nullptr);
+        unused_end_.fill(nullptr);
+    }
+    SingleThreadHeap(const SingleThreadHeap&) = delete;
+    SingleThreadHeap& operator=(const SingleThreadHeap&) = delete;
+
+    void* allocate(size_t size) {
+#ifdef MEMORYPOOL_SIZE_STATS
+        SizeHistogram::record(size);
+#endif
+        if (size <= MAX_BYTES) {
+            size_t index = SizeClass::getIndex(size);
+            if (void* ptr = free_list_[index]) {
+                free_list_[index] = *reinterpret_cast<void**>(ptr);
+                return ptr;
+            }
+            // 自由链表为空时从当前 Span 中切分
+            char* ptr = unused_[index];
+            if (ptr != unused_end_[index]) {
+                unused_[index] = ptr + SizeClass::classSize(index);
+                return ptr;
+            }
+        }
+        return allocateSlow(size);
+    }
+
+    void deallocate(void* ptr, size_t size) {
+        if (size <= MAX_BYTES) {
+            size_t index = SizeClass::getIndex(size);
+            *reinterpret_cast<void**>(ptr) = free_list_[index];
+            free_list_[index] = ptr;
+            return;
+        }
+        page_cache_.deallocateLarge(ptr, size);
+    }
+
+    // 以下接口与 ThreadCache 相同
+    void* allocateAligned(size_t size, size_t align);
+    void deallocateAligned(void* ptr, size_t size, size_t align);
+    size_t allocateBatch(size_t size, size_t n, void** out);
+    void deallocateBatch(void** ptrs, size_t n, size_t size);
+    void* reallocate(void* ptr, size_t old_size, size_t new_size);
+    size_t reserve(size_t size, size_t count);
+    void prewarm(const WarmupProfile& profile);
+    // 没有需要归还给其他线程的缓存，不做任何事
+    void trim() {}
+
+    // 以下接口与 Heap 相同
+    void setMemoryLimits(const MemoryLimits& limits) { page_cache_.setLimits(limits); }
+    // 将 PageCache 中的空闲 Span（来自已释放的大对象之间的合并）归还给系统，自由链表中的块不会归还
+    size_t releaseMemory() { return page_cache_.releaseFreeMemory(); }
+    // 一次性将所有内存归还给系统，之前分配的内存全部失效
+    void destroy();
+    PageCache& getPageCache() { return page_cache_; }
+
+private:
+    // 大对象，或当前 Span 已切分完时获取新的 Span
+    void* allocateSlow(size_t size);
+    // 为 index 获取新的 Span 作为切分区域，失败返回 false
+    bool refill(size_t index);
+
+private:
+    std::array<void*, FREE_LIST_SIZE> free_list_;   // 已释放的块
+    std::array<char*, FREE_LIST_SIZE> unused_;      // 当前 Span 中尚未切分的部分
+    std::array<char*, FREE_LIST_SIZE> unused_end_;
+    PageCache page_cache_;
+};
+}   // namespace MemoryPoolV2
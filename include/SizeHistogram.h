@@ -0,0 +1,36 @@
+//
+// Created by 11361 on 25-4-24.
+//
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "Common.h"
+
+namespace MemoryPoolV2
+{
+// 分配大小直方图。编译时定义 MEMORYPOOL_SIZE_STATS 后，ThreadCache 的每次分配都会记录到这里，
+// dump 输出的文件可直接作为 size_class_gen 的输入，用于生成适合实际负载的大小类别表
+class SizeHistogram {
+public:
+    static const size_t NUM_BUCKETS = MAX_BYTES / ALIGNMENT + 1;   // 最后一个桶记录超过 MAX_BYTES 的分配
+
+    static void record(size_t size, size_t count = 1) {
+        size_t bucket = size > MAX_BYTES ? NUM_BUCKETS - 1 : (std::max(size, size_t(1)) + ALIGNMENT - 1) / ALIGNMENT - 1;
+        counts_[bucket].fetch_add(count, std::memory_order_relaxed);
+    }
+
+    // 以“大小 次数”的文本格式逐行写出非零的桶（大小按 ALIGNMENT 向上取整，不包括超过 MAX_BYTES 的分配），失败返回 false
+    static bool dump(const char* path);
+    // 按 ALIGNMENT 向上取整后为 size 的分配次数
+    static uint64_t getCount(size_t size) {
+        return counts_[(std::max(size, size_t(1)) + ALIGNMENT - 1) / ALIGNMENT - 1].load(std::memory_order_relaxed);
+    }
+    // 超过 MAX_BYTES 的分配次数
+    static uint64_t largeCount();
+    static void reset();
+
+private:
+    static std::atomic<uint64_t> counts_[NUM_BUCKETS];
+};
+}   // namespace MemoryPoolV2
@@ -4,27 +4,128 @@
 
 #pragma once
 #include <array>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
 #include "../include/Common.h"
+#ifdef MEMORYPOOL_SIZE_STATS
+#include "../include/SizeHistogram.h"
+#endif
 
 namespace MemoryPoolV2
 {
+// 预热配置：每一项为（内存块大小，数量）
+using WarmupProfile = std::vector<std::pair<size_t, size_t>>;
+
+class CentralCache;
+class PageCache;
+
 class ThreadCache{
 public:
-    static ThreadCache& getInstance() {
-        static thread_local ThreadCache instance;
-        return instance;
+    // 当前线程在默认堆上的线程缓存
+    static ThreadCache& getInstance();
+
+    // 快速路径在头文件中内联：计算大小类别后直接弹出/压入线程本地自由链表，
+    // 大对象、链表为空、收到裁剪/回收请求等情况进入 .cpp 中的慢速路径。
+    // 每次操作前后各写一次 activity_（所有者独占的缓存行上的单字节普通写入），再读一次 control_，扫描线程据此判断线程是否空闲以及能否回收其缓存。
+    // 这比只读一次 control_ 多了两次写入：回收长期阻塞的线程时必须知道它是否正处于操作中，只读取无法提供这一信息
+    void* allocate(size_t size) {
+#ifdef MEMORYPOOL_SIZE_STATS
+        SizeHistogram::record(size);
+#endif
+        beginOperation();
+        void* ptr = nullptr;
+        if (size <= MAX_BYTES && control_.load(std::memory_order_acquire) == CONTROL_NONE) {
+            size_t index = SizeClass::getIndex(size);
+            if ((ptr = free_list_[index]) != nullptr) {
+                // 将链表头指针后移一位，并更新自由链表大小
+                void* next = *reinterpret_cast<void**>(ptr);
+                free_list_[index] = next;
+                free_list_size_[index]--;
+                // 预取新的链表头，下一次分配读取其 next 指针时不会发生缓存未命中
+                __builtin_prefetch(next);
+            }
+        }
+        if (ptr == nullptr) {
+            ptr = allocateSlow(size);
+        }
+        endOperation();
+        return ptr;
     }
 
-    void* allocate(size_t size);
-    void deallocate(void* ptr, size_t size);
+    void deallocate(void* ptr, size_t size) {
+        beginOperation();
+        if (size <= MAX_BYTES && control_.load(std::memory_order_acquire) == CONTROL_NONE) {
+            size_t index = SizeClass::getIndex(size);
+            *reinterpret_cast<void**>(ptr) = free_list_[index];
+            free_list_[index] = ptr;
+            if (++free_list_size_[index] > threshold_) {
+                returnExcess(index);
+            }
+        } else {
+            deallocateSlow(ptr, size);
+        }
+        endOperation();
+    }
+
+    // 按 align 对齐分配（align 为 2 的幂且不超过页大小），释放时需传入相同的 size 与 align
+    void* allocateAligned(size_t size, size_t align);
+    void deallocateAligned(void* ptr, size_t size, size_t align);
+    // 批量分配/释放同一大小的内存块，返回实际分配的数量
+    size_t allocateBatch(size_t size, size_t n, void** out);
+    void deallocateBatch(void** ptrs, size_t n, size_t size);
+    // 调整内存块大小，尽可能原地完成
+    void* reallocate(void* ptr, size_t old_size, size_t new_size);
+
+    // 预先在线程本地缓存中准备 count 个大小为 size 的内存块（已触发缺页），之后的 count 次分配不会离开线程本地缓存。
+    // 同时将该大小类别的缓存上限提高到 count，返回线程本地缓存中该大小类别的内存块数量
+    size_t reserve(size_t size, size_t count);
+    // 按预热配置对多个大小类别调用 reserve
+    void prewarm(const WarmupProfile& profile);
+
+    // 将各大小类别缓存的内存块数累加到 counts（FREE_LIST_SIZE 个元素）中。可以由其他线程调用，结果为近似值
+    void collectCachedBlocks(size_t* counts) const;
+
+    // 将缓存的内存块全部归还给中心缓存，只能由所有者线程调用（如线程即将长时间阻塞之前）
+    void trim();
+    // 请求所有者线程在下一次分配/释放时调用 trim()，可以由任意线程调用
+    void requestTrim();
 
 private:
-    explicit ThreadCache(size_t threshold = 64) : threshold_(threshold){
+    friend class Heap;
+
+    // control_ 的取值，由其他线程设置，所有者线程在快速路径上读取
+    static const uint8_t CONTROL_NONE = 0;
+    static const uint8_t CONTROL_TRIM = 1;      // 请求所有者线程裁剪
+    static const uint8_t CONTROL_RECLAIM = 2;   // 其他线程正在回收该线程缓存，所有者线程在慢速路径上等待
+    // activity_ 的取值，只由所有者线程写入（扫描线程将 TOUCHED 改为 IDLE）
+    static const uint8_t ACTIVITY_IDLE = 0;     // 自上一次扫描以来没有操作
+    static const uint8_t ACTIVITY_BUSY = 1;     // 正在操作自由链表
+    static const uint8_t ACTIVITY_TOUCHED = 2;  // 自上一次扫描以来有过操作，当前不在操作中
+
+    // 操作自由链表之前标记为 BUSY，之后才读取 control_。与 tryReclaim 构成非对称的 Dekker 同步：
+    // 这里只阻止编译器重排，硬件层面的顺序由回收方的 membarrier 保证
+    void beginOperation() {
+        activity_.store(ACTIVITY_BUSY, std::memory_order_relaxed);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    void endOperation() { activity_.store(ACTIVITY_TOUCHED, std::memory_order_release); }
+    struct SlowOperation;
+
+    ThreadCache(CentralCache& central_cache, PageCache& page_cache, size_t threshold = 64)
+        : central_cache_(central_cache), page_cache_(page_cache), threshold_(threshold){
         // 初始化自由链表和大小统计
         free_list_.fill(nullptr);
         free_list_size_.fill(0);
+        free_list_limit_.fill(0);
     }
 
+    // 分配/释放的慢速路径（释放时内存块尚未插入自由链表）
+    void* allocateSlow(size_t size);
+    void deallocateSlow(void* ptr, size_t size);
+    // 自由链表超过上限时将部分内存块归还给中心缓存
+    void returnExcess(size_t index);
     // 从中心缓存获取内存
     void* fetchFromCentralCache(size_t index);
     // 归还内存到中心缓存
@@ -33,9 +134,26 @@ private:
     bool shouldReturnToCentralCache(size_t index);
     // 计算批量获取内存块的数量
     size_t getBatchNum(size_t size);
+    // 将所有缓存的内存块归还给中心缓存（线程退出时调用）
+    void flush();
+    // 将缓存的内存块归还给中心缓存。keep_reserved 时跳过通过 reserve 提高过上限的大小类别；
+    // try_lock 时跳过中心缓存中正被占用的类别（调用者可能持有某个类别的锁），此时返回是否没有跳过任何类别
+    bool releaseCached(bool keep_reserved, bool try_lock);
+    // 慢速路径的公共入口：等待其他线程的回收结束，返回是否有挂起的裁剪请求（同时清除该请求）
+    bool onSlowPath();
+    // 由其他线程调用（调用者需持有所属堆的锁）：所有者线程不在操作中时，直接将其缓存（reserve 的类别除外）归还给中心缓存，
+    // 中心缓存中正被占用的类别跳过。only_if_idle 时只回收自上一次扫描以来没有操作过的线程缓存。
+    // 所有者线程正在操作或有类别被跳过时返回 false；系统不支持 membarrier 时改为请求所有者线程裁剪，同样返回 false
+    bool tryReclaim(bool only_if_idle);
 
 private:
+    CentralCache& central_cache_;   // 所属堆的中心缓存
+    PageCache& page_cache_;         // 所属堆的页缓存（用于大对象）
     size_t threshold_;
+    std::atomic<uint8_t> control_{CONTROL_NONE};        // 由其他线程设置，与 threshold_ 位于同一缓存行
+    std::atomic<uint8_t> activity_{ACTIVITY_TOUCHED};   // 由所有者线程在每次操作前后写入
+    bool reclaimed_ = false;    // 上一次扫描后已回收且之后没有操作，由 Heap 在持有锁时读写
+    std::array<uint32_t, FREE_LIST_SIZE> free_list_limit_{};   // 通过 reserve 提高的缓存上限，0 表示使用 threshold_
     std::array<void*, FREE_LIST_SIZE> free_list_{};   // 存储单个线程的自由链表
     std::array<size_t, FREE_LIST_SIZE> free_list_size_{}; // 用于统计每个自由链表的大小。每个元素表示对应自由链表中内存块的数量
 };
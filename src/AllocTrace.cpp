@@ -0,0 +1,126 @@
+//
+// Created by 11361 on 25-4-25.
+//
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include "../include/AllocTrace.h"
+
+namespace MemoryPoolV2
+{
+namespace
+{
+std::mutex g_trace_mutex;       // 保护 start/stop
+int g_trace_fd = -1;
+size_t g_trace_bytes = 0;       // 映射的字节数
+uint64_t g_start_ns = 0;
+std::atomic<uint16_t> g_next_thread{0};
+__thread int32_t t_thread_id = -1;
+
+uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+#ifdef MEMORYPOOL_TRACE
+// 设置了环境变量 MEMORYPOOL_TRACE_FILE 时在程序启动时开始追踪，文件头中的记录数实时更新，无需显式 stop
+struct TraceFromEnv {
+    TraceFromEnv() {
+        if (const char* path = getenv("MEMORYPOOL_TRACE_FILE")) {
+            AllocTrace::start(path);
+        }
+    }
+} g_trace_from_env;
+#endif
+}   // namespace
+
+std::atomic<TraceHeader*> AllocTrace::header_{nullptr};
+
+/**
+ * 创建追踪文件并映射到内存。文件按容量预留大小，只有写入记录的页才会实际占用磁盘
+ * @param path     追踪文件路径
+ * @param capacity 最多记录的条数
+ * @return 成功返回 true
+ */
+bool AllocTrace::start(const char* path, size_t capacity) {
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    if (header_.load(std::memory_order_relaxed) != nullptr || capacity == 0) {
+        return false;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t bytes = sizeof(TraceHeader) + capacity * sizeof(TraceRecord);
+    if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+        close(fd);
+        return false;
+    }
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    auto header = static_cast<TraceHeader*>(ptr);
+    header->magic = MAGIC;
+    header->version = VERSION;
+    header->record_size = sizeof(TraceRecord);
+    header->count.store(0, std::memory_order_relaxed);
+    header->capacity = capacity;
+
+    g_trace_fd = fd;
+    g_trace_bytes = bytes;
+    g_start_ns = nowNs();
+    header_.store(header, std::memory_order_release);
+    return true;
+}
+
+size_t AllocTrace::stop() {
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    TraceHeader* header = header_.exchange(nullptr, std::memory_order_acq_rel);
+    if (header == nullptr) {
+        return 0;
+    }
+    size_t count = std::min<uint64_t>(header->count.load(std::memory_order_relaxed), header->capacity);
+    header->count.store(count, std::memory_order_relaxed);
+    header->capacity = count;
+    munmap(header, g_trace_bytes);
+    // 截断掉未使用的记录槽
+    if (ftruncate(g_trace_fd, static_cast<off_t>(sizeof(TraceHeader) + count * sizeof(TraceRecord))) != 0) {
+        count = 0;
+    }
+    close(g_trace_fd);
+    g_trace_fd = -1;
+    return count;
+}
+
+/**
+ * 追加一条记录：通过原子递增记录数取得记录槽，记录的先后顺序即全局的操作顺序
+ */
+void AllocTrace::append(TraceHeader* header, TraceOp op, const void* ptr, size_t size, size_t align) {
+    uint64_t index = header->count.fetch_add(1, std::memory_order_relaxed);
+    if (index >= header->capacity) {
+        return;     // 文件已满，丢弃
+    }
+    if (t_thread_id < 0) {
+        t_thread_id = g_next_thread.fetch_add(1, std::memory_order_relaxed);
+    }
+    uint8_t align_log2 = 0;
+    while (align > 1 && (size_t(1) << align_log2) < align) {
+        ++align_log2;
+    }
+    TraceRecord& record = reinterpret_cast<TraceRecord*>(header + 1)[index];
+    record.timestamp = nowNs() - g_start_ns;
+    record.ptr = reinterpret_cast<uintptr_t>(ptr);
+    record.size = static_cast<uint32_t>(std::min<size_t>(size, UINT32_MAX));
+    record.thread = static_cast<uint16_t>(t_thread_id);
+    record.op = static_cast<uint8_t>(op);
+    record.align_log2 = align_log2;
+}
+
+}   // namespace MemoryPoolV2
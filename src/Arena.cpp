@@ -0,0 +1,102 @@
+//
+// Created by 11361 on 25-4-12.
+//
+#include <cassert>
+#include "../include/Arena.h"
+#include "../include/PageCache.h"
+
+namespace MemoryPoolV2
+{
+
+Arena::Arena(size_t chunk_pages, PageCache& page_cache)
+    : page_cache_(page_cache), head_(nullptr), cur_(nullptr), offset_(0), chunk_pages_(std::max(chunk_pages, size_t(1))), reserved_bytes_(0)
+{}
+
+Arena::~Arena() {
+    release();
+}
+
+/**
+ * 当前 chunk 空间不足时的慢路径：优先复用 cur_ 之后已申请的空闲 chunk，否则向 PageCache 申请新的 Span
+ * @param size  需要分配的字节数
+ * @param align 对齐要求
+ * @return 内存地址，失败返回 nullptr
+ */
+void* Arena::allocateSlow(size_t size, size_t align) {
+    assert((align & (align - 1)) == 0 && align <= PageCache::PAGE_SIZE);
+    // chunk 头部之后第一个满足对齐要求的偏移
+    size_t offset = (CHUNK_HEADER_SIZE + align - 1) & ~(align - 1);
+
+    // 1. 复用 cur_ 之后的空闲 chunk（reset/rewind 后保留下来的 Span），容量不足的 chunk 直接跳过
+    Chunk* prev = cur_;
+    Chunk* chunk = cur_ ? cur_->next : head_;
+    while (chunk != nullptr && offset + size > chunk->capacity) {
+        prev = chunk;
+        chunk = chunk->next;
+    }
+
+    // 2. 没有可复用的 chunk，向 PageCache 申请新的 Span，并插入到 prev 之后
+    if (chunk == nullptr) {
+        size_t num_pages = (offset + size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+        num_pages = std::max(num_pages, chunk_pages_);
+        void* span = page_cache_.allocateSpan(num_pages);
+        if (span == nullptr) {
+            return nullptr;
+        }
+        chunk = static_cast<Chunk*>(span);
+        chunk->num_pages = num_pages;
+        chunk->capacity = num_pages * PageCache::PAGE_SIZE;
+        if (prev) {
+            chunk->next = prev->next;
+            prev->next = chunk;
+        } else {
+            chunk->next = head_;
+            head_ = chunk;
+        }
+        reserved_bytes_ += chunk->capacity;
+    }
+
+    cur_ = chunk;
+    offset_ = offset + size;
+    return reinterpret_cast<char*>(chunk) + offset;
+}
+
+/**
+ * 回退到检查点。检查点之后申请的 chunk 仍保留在链表中，供后续分配复用
+ * @param cp 通过 checkpoint() 获取的检查点
+ */
+void Arena::rewind(const Checkpoint& cp) {
+    cur_ = static_cast<Chunk*>(cp.chunk);
+    offset_ = cp.offset;
+}
+
+void Arena::reset() {
+    cur_ = nullptr;
+    offset_ = 0;
+}
+
+void Arena::release() {
+    Chunk* chunk = head_;
+    while (chunk) {
+        Chunk* next = chunk->next;
+        page_cache_.deallocateSpan(chunk, chunk->num_pages);
+        chunk = next;
+    }
+    head_ = nullptr;
+    cur_ = nullptr;
+    offset_ = 0;
+    reserved_bytes_ = 0;
+}
+
+size_t Arena::bytesUsed() const {
+    if (cur_ == nullptr) {
+        return 0;
+    }
+    size_t used = 0;
+    for (Chunk* chunk = head_; chunk != cur_; chunk = chunk->next) {
+        used += chunk->capacity;
+    }
+    return used + offset_;
+}
+
+}   // namespace MemoryPoolV2
@@ -0,0 +1,36 @@
+//
+// Created by 11361 on 25-4-28.
+//
+#include "../include/CacheScavenger.h"
+
+namespace MemoryPoolV2
+{
+CacheScavenger::CacheScavenger(Heap& heap, std::chrono::milliseconds interval)
+    : heap_(heap), interval_(interval) {
+    thread_ = std::thread([this]() { run(); });
+}
+
+CacheScavenger::~CacheScavenger() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+size_t CacheScavenger::getNumReclaimed() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_reclaimed_;
+}
+
+void CacheScavenger::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!cv_.wait_for(lock, interval_, [this]() { return stop_; })) {
+        lock.unlock();
+        size_t num_reclaimed = heap_.scavengeIdleCaches();
+        lock.lock();
+        num_reclaimed_ += num_reclaimed;
+    }
+}
+}   // namespace MemoryPoolV2
@@ -0,0 +1,183 @@
+//
+// Created by 11361 on 25-4-30.
+//
+#include <algorithm>
+#include <stdexcept>
+#include "../include/CachedObjectPool.h"
+
+namespace MemoryPoolV2
+{
+namespace
+{
+// 全局对象池注册表，保护对象池的创建/销毁与线程退出之间的并发
+std::mutex& registryMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::array<CachedObjectPoolBase*, CachedObjectPoolBase::MAX_POOLS>& registry() {
+    static std::array<CachedObjectPoolBase*, CachedObjectPoolBase::MAX_POOLS> pools{};
+    return pools;
+}
+
+// 全局单调递增的代数，保证槽位被复用后旧的线程槽位不会误判为有效
+std::atomic<uint64_t> g_next_generation{1};
+}   // namespace
+
+struct CachedObjectPoolBase::ThreadSlotsHolder {
+    ThreadStackSlots slots{};
+    ~ThreadSlotsHolder() {
+        CachedObjectPoolBase::onThreadExit(slots);
+    }
+};
+
+CachedObjectPoolBase::CachedObjectPoolBase(size_t max_cached)
+    : max_cached_(std::max(max_cached, size_t(1))), generation_(g_next_generation++) {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    auto& pools = registry();
+    auto iter = std::find(pools.begin(), pools.end(), nullptr);
+    if (iter == pools.end()) {
+        throw std::runtime_error("MemoryPoolV2::CachedObjectPool: too many pools");
+    }
+    *iter = this;
+    id_ = iter - pools.begin();
+}
+
+CachedObjectPoolBase::ThreadStackSlots& CachedObjectPoolBase::threadStackSlots() {
+    static thread_local ThreadSlotsHolder holder;
+    return holder.slots;
+}
+
+/**
+ * 为当前线程创建该对象池的对象栈。预留 max_cached_ 个位置，acquire/release 的快速路径不会再分配内存
+ * @return 对象栈
+ */
+CachedObjectPoolBase::ThreadStack& CachedObjectPoolBase::createThreadStack() {
+    auto stack = new ThreadStack();
+    stack->objects.reserve(max_cached_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stacks_.push_back(stack);
+    }
+    threadStackSlots()[id_] = ThreadStackSlot{stack, generation_};
+    return *stack;
+}
+
+size_t CachedObjectPoolBase::flushStack(ThreadStack& stack) {
+    stack.flush_requested.store(false, std::memory_order_relaxed);
+    size_t num_destroyed = stack.objects.size();
+    for (void* object : stack.objects) {
+        destroyObject(object);
+    }
+    stack.objects.clear();
+    stack.updateNumCached();
+    return num_destroyed;
+}
+
+/**
+ * 获取对象的慢速路径。收到销毁请求时先销毁当前缓存的对象；然后从共享仓库取回最多一半容量的对象，
+ * 仓库为空时构造新对象
+ * @param stack 当前线程的对象栈
+ * @return 处于初始状态的对象
+ */
+void* CachedObjectPoolBase::acquireSlow(ThreadStack& stack) {
+    if (stack.flush_requested.load(std::memory_order_relaxed)) {
+        flushStack(stack);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!depot_.empty()) {
+            size_t num_move = std::min(depot_.size(), std::max(max_cached_ / 2, size_t(1)));
+            stack.objects.insert(stack.objects.end(), depot_.end() - num_move, depot_.end());
+            depot_.resize(depot_.size() - num_move);
+        }
+    }
+    if (!stack.objects.empty()) {
+        void* object = stack.objects.back();
+        stack.objects.pop_back();
+        stack.updateNumCached();
+        return object;
+    }
+    return createObject();
+}
+
+/**
+ * 放回对象的慢速路径。收到销毁请求时先销毁当前缓存的对象；对象栈已满时将一半对象（保持构造状态）移入共享仓库
+ * @param stack  当前线程的对象栈
+ * @param object 已经调用过 reset 的对象
+ */
+void CachedObjectPoolBase::releaseSlow(ThreadStack& stack, void* object) {
+    if (stack.flush_requested.load(std::memory_order_relaxed)) {
+        flushStack(stack);
+    }
+    if (stack.objects.size() >= max_cached_) {
+        size_t num_move = std::max(max_cached_ / 2, size_t(1));
+        std::lock_guard<std::mutex> lock(mutex_);
+        depot_.insert(depot_.end(), stack.objects.end() - num_move, stack.objects.end());
+        stack.objects.resize(stack.objects.size() - num_move);
+    }
+    stack.objects.push_back(object);
+    stack.updateNumCached();
+}
+
+size_t CachedObjectPoolBase::trim() {
+    size_t num_destroyed = flushStack(localStack());
+    std::vector<void*> depot;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        depot.swap(depot_);
+        // 其他线程的对象栈只能由其所属线程修改
+        for (ThreadStack* stack : stacks_) {
+            stack->flush_requested.store(true, std::memory_order_relaxed);
+        }
+    }
+    for (void* object : depot) {
+        destroyObject(object);
+    }
+    return num_destroyed + depot.size();
+}
+
+size_t CachedObjectPoolBase::getNumCached() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t num_cached = depot_.size();
+    // 其他线程的对象栈可能正在被修改，只读取其所属线程写入的计数
+    for (ThreadStack* stack : stacks_) {
+        num_cached += stack->num_cached.load(std::memory_order_relaxed);
+    }
+    return num_cached;
+}
+
+void CachedObjectPoolBase::shutdown() {
+    std::lock_guard<std::mutex> registry_lock(registryMutex());
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (ThreadStack* stack : stacks_) {
+        for (void* object : stack->objects) {
+            destroyObject(object);
+        }
+        delete stack;
+    }
+    stacks_.clear();
+    for (void* object : depot_) {
+        destroyObject(object);
+    }
+    depot_.clear();
+    registry()[id_] = nullptr;
+}
+
+void CachedObjectPoolBase::onThreadExit(ThreadStackSlots& slots) {
+    std::lock_guard<std::mutex> registry_lock(registryMutex());
+    auto& pools = registry();
+    for (size_t id = 0; id < MAX_POOLS; ++id) {
+        ThreadStackSlot& slot = slots[id];
+        CachedObjectPoolBase* pool = pools[id];
+        // 只有对象池仍然存在且槽位未被复用时，槽位中的对象栈才有效
+        if (slot.stack != nullptr && pool != nullptr && pool->generation_ == slot.generation) {
+            std::lock_guard<std::mutex> lock(pool->mutex_);
+            pool->depot_.insert(pool->depot_.end(), slot.stack->objects.begin(), slot.stack->objects.end());
+            pool->stacks_.erase(std::remove(pool->stacks_.begin(), pool->stacks_.end(), slot.stack), pool->stacks_.end());
+            delete slot.stack;
+        }
+        slot = ThreadStackSlot{};
+    }
+}
+}   // namespace MemoryPoolV2
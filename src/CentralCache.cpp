@@ -1,187 +1,315 @@
 //
 // Created by 11361 on 25-3-26.
 //
+#include <sys/mman.h>
 #include <thread>
 #include "../include/CentralCache.h"
 #include "../include/PageCache.h"
+#include "../include/Heap.h"
+#include "../include/MetadataAllocator.h"
+#include "../include/Probes.h"
 #include "CentralCache.h"
 
 namespace MemoryPoolV2
 {
-static const size_t SPAN_PAGES = 8; // 每次从PageCache获取 span 大小（以页为单位）
+CentralCache& CentralCache::getInstance() {
+    return Heap::getDefault().getCentralCache();
+}
 
-/**
- * 从 PageCache 获取 size 大小的内存块，并根据不同的大小情况采取不同的分配策略
- * @param size  需要分配的内存块的大小
- * @return 内存块的地址
- */
-void* CentralCache::fetchFromPageCache(size_t size) {
+CentralCache::CentralCache(PageCache& page_cache) : page_cache_(page_cache) {
+    // 匿名映射的内存全为 0，即所有链表为空、所有锁处于未加锁状态，无需逐个初始化；
+    // 只有实际使用到的大小类别所在的页才会占用物理内存
+    free_lists_ = static_cast<CentralFreeList*>(
+        FixedSizeAllocator::allocatePages(sizeof(CentralFreeList) * FREE_LIST_SIZE));
+    span_lists_ = static_cast<SpanLists*>(FixedSizeAllocator::allocatePages(sizeof(SpanLists) * FREE_LIST_SIZE));
+    if (free_lists_ == nullptr || span_lists_ == nullptr) {
+        throw std::bad_alloc();
+    }
+}
+
+CentralCache::~CentralCache() {
+    FixedSizeAllocator::deallocatePages(free_lists_, sizeof(CentralFreeList) * FREE_LIST_SIZE);
+    FixedSizeAllocator::deallocatePages(span_lists_, sizeof(SpanLists) * FREE_LIST_SIZE);
+}
+
+void CentralCache::reset() {
+    // 释放所有 Span 的元数据（Span 的内存随后由 PageCache 整体释放）。页映射中残留的条目在对应的页
+    // 被新的 Span 使用时会被覆盖，而归还内存块时只会查找仍然有效的 Span 的页，因此无需清除
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        if (free_lists_[index].span_bytes.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        for (Span* head : span_lists_[index].heads) {
+            while (head != nullptr) {
+                Span* next = head->next;
+                MetadataAllocator<Span>::destroy(head);
+                head = next;
+            }
+        }
+    }
+    // 丢弃这些页后再次访问时得到全 0 的新页，即恢复到初始状态，同时释放其占用的物理内存
+    madvise(free_lists_, sizeof(CentralFreeList) * FREE_LIST_SIZE, MADV_DONTNEED);
+    madvise(span_lists_, sizeof(SpanLists) * FREE_LIST_SIZE, MADV_DONTNEED);
+}
+
+void CentralCache::lock(size_t index) {
+    if (!free_lists_[index].lock.test_and_set(std::memory_order_acquire)) {
+        return;     // 无竞争
+    }
+    // 只有发生竞争时才记录等待时间
+    MEMORYPOOL_PROBE_SCOPE(probe, CentralLockWait, index, 0);
+    size_t num_yields = 0;
+    do {
+        std::this_thread::yield();  // 添加线程让步，避免忙等待，避免过度消耗CPU
+        ++num_yields;
+    } while (free_lists_[index].lock.test_and_set(std::memory_order_acquire));
+    MEMORYPOOL_PROBE_SET_ARGS(probe, index, num_yields);
+    (void)num_yields;
+}
+
+size_t CentralCache::spanPages(size_t size) {
     // 1. 计算实际需要的页数（向上取整）
     size_t num_pages = (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
-    // 2. 根据大小决定分配策略
-    if (num_pages < SPAN_PAGES) {
-        // 小于等于32KB的请求，使用固定8页
-        return PageCache::getInstance().allocateSpan(SPAN_PAGES);
+    // 2. 小于等于32KB的请求，使用固定8页；大于32KB的请求，按实际需求分配
+    return std::max(num_pages, size_t(SPAN_PAGES));
+}
+
+uint32_t CentralCache::listOf(const Span* span) {
+    if (span->num_free == 0) {
+        return FULL_LIST;
+    }
+    if (span->num_free == span->num_blocks) {
+        return EMPTY_LIST;
+    }
+    size_t num_used = span->num_blocks - span->num_free;
+    return static_cast<uint32_t>(num_used * NUM_PARTIAL_LISTS / span->num_blocks);
+}
+
+void CentralCache::unlinkSpan(size_t index, Span* span) {
+    SpanLists& lists = span_lists_[index];
+    if (span->prev != nullptr) {
+        span->prev->next = span->next;
     } else {
-        // 大于32KB的请求，按实际需求分配
-        return PageCache::getInstance().allocateSpan(num_pages);
+        lists.heads[span->list] = span->next;
+    }
+    if (span->next != nullptr) {
+        span->next->prev = span->prev;
+    }
+    if (span->list == EMPTY_LIST) {
+        --lists.num_empty;
+    }
+}
+
+void CentralCache::linkSpan(size_t index, Span* span, uint32_t list) {
+    SpanLists& lists = span_lists_[index];
+    span->list = list;
+    span->prev = nullptr;
+    span->next = lists.heads[list];
+    if (span->next != nullptr) {
+        span->next->prev = span;
+    }
+    lists.heads[list] = span;
+    if (list == EMPTY_LIST) {
+        ++lists.num_empty;
+    }
+}
+
+void CentralCache::updateSpanList(size_t index, Span* span) {
+    uint32_t list = listOf(span);
+    if (list != span->list) {
+        unlinkSpan(index, span);
+        linkSpan(index, span, list);
     }
 }
 
 /**
- * 从中心缓存中获取该大小类别的内存块，如果中心缓存为空，则从页缓存中获取新的内存块并将其切分成合适大小的小块，然后返回一个可用的内存块指针
- * @param index 所需内存块的大小类别索引
- * @return 内存块的地址
+ * 从 PageCache 获取一个新的 Span，登记到页映射与该类别的空 Span 链表中。块在分配时才按地址顺序切分
+ * @param index 大小类别索引
+ * @return 新的 Span，PageCache 或元数据内存不足时返回 nullptr
  */
-void* CentralCache::fetchRange(size_t index) {
-    // 索引检查，当索引大于等于FREE_LIST_SIZE时，说明申请内存过大应直接向系统申请
-    if (index >= FREE_LIST_SIZE) {
+CentralCache::Span* CentralCache::allocateSpan(size_t index) {
+    size_t size = SizeClass::classSize(index);
+    size_t num_pages = spanPages(size);
+    auto start = static_cast<char*>(page_cache_.allocateSpan(num_pages));
+    if (start == nullptr) {
         return nullptr;
     }
-    // 获取自旋锁
-    while (locks_[index].test_and_set(std::memory_order_acquire)) {
-        std::this_thread::yield();  // 添加线程让步，避免忙等待，避免过度消耗CPU
+    Span* span = MetadataAllocator<Span>::create();
+    if (span == nullptr || !page_map_.set(start, num_pages, span)) {
+        MetadataAllocator<Span>::destroy(span);
+        page_cache_.deallocateSpan(start, num_pages);
+        return nullptr;
     }
-    //
-    void* result = nullptr;
-    try {
-        // 尝试从中心缓存获取内存块
-        result = central_free_list_[index].load(std::memory_order_relaxed);
-        if (result) {   // 中心缓存不为空
-            // 保存 result 的下一个节点
-            // TODO: 每个内存块的开头部分被用作指向下一个内存块的指针，从而形成一个链表结构
-            // void** 类型的强制转换是为了操作内存块链表中的指针，实现链表节点的取出和链表头指针的更新
-            void* next = *reinterpret_cast<void**>(result);
-            // 将 result 与链表断开
-            *reinterpret_cast<void**>(result) = nullptr;
-            // 更新中心缓存
-            central_free_list_[index].store(next, std::memory_order_release);
-        } else {    // 中心缓存为空，则从页缓存中获取新的内存块，并切分
-            // 1. 从页缓存获取新的内存块
-            size_t size = (index + 1) * ALIGNMENT;
-            result = fetchFromPageCache(size);
-            if (result == nullptr) {    // 从页缓存中获取失败，释放自旋锁并返回
-                locks_[index].clear(std::memory_order_release);
-                return nullptr;
-            }
+    span->start = start;
+    span->num_pages = num_pages;
+    span->free_list = nullptr;
+    span->unused = start;
+    // 大于 SPAN_PAGES 页的块按实际页数分配 Span，每个 Span 恰好容纳一个块
+    span->num_blocks = static_cast<uint32_t>(std::max(size_t(1), num_pages * PageCache::PAGE_SIZE / size));
+    span->num_free = span->num_blocks;
+    linkSpan(index, span, EMPTY_LIST);
 
-            // 2. 将获取的内存块切分成小块，并用链表管理
-            char* start = reinterpret_cast<char*>(result);
-            size_t num_block = (SPAN_PAGES * PageCache::PAGE_SIZE) / size;
-            if (num_block > 1) {
-                for (size_t i = 1; i < num_block; ++i) {
-                    void* cur = start + (i - 1) * size;
-                    void* nxt = start + i * size;
-                    *reinterpret_cast<void**>(cur) = nxt;
-                }
-                *reinterpret_cast<void**>(start + (num_block - 1) * size) = nullptr;    // 最后一个block
-
-                // 保存result的下一个节点
-                void* next = *reinterpret_cast<void**>(result);
-                // 将 result 与链表断开
-                *reinterpret_cast<void**>(result) = nullptr;
-                // 更新中心缓存
-                central_free_list_[index].store(next, std::memory_order_release);
-            }
+    CentralFreeList& list = free_lists_[index];
+    list.num_blocks.fetch_add(span->num_blocks, std::memory_order_relaxed);
+    list.num_free.fetch_add(span->num_blocks, std::memory_order_relaxed);
+    list.span_bytes.fetch_add(num_pages * PageCache::PAGE_SIZE, std::memory_order_relaxed);
+    return span;
+}
+
+/**
+ * 将空 Span 从链表中移除并归还给 PageCache（会与相邻的空闲页合并）
+ * @param index 大小类别索引
+ * @param span  所有块都已归还的 Span
+ */
+void CentralCache::releaseSpan(size_t index, Span* span) {
+    unlinkSpan(index, span);
+    CentralFreeList& list = free_lists_[index];
+    list.num_blocks.fetch_sub(span->num_blocks, std::memory_order_relaxed);
+    list.num_free.fetch_sub(span->num_blocks, std::memory_order_relaxed);
+    list.span_bytes.fetch_sub(span->num_pages * PageCache::PAGE_SIZE, std::memory_order_relaxed);
+    page_cache_.deallocateSpan(span->start, span->num_pages);
+    MetadataAllocator<Span>::destroy(span);
+}
+
+/**
+ * 选择下一个用于分配的 Span：从最满的部分使用链表开始查找，使存活的块集中在少数 Span 中，
+ * 较空的 Span 有机会变为全空并归还给 PageCache；没有部分使用的 Span 时使用空 Span
+ * @param index     大小类别索引
+ * @param allow_new 没有可用的 Span 时是否向 PageCache 获取新的 Span
+ * @return Span，没有可用的 Span 时返回 nullptr
+ */
+CentralCache::Span* CentralCache::pickSpan(size_t index, bool allow_new) {
+    SpanLists& lists = span_lists_[index];
+    for (size_t list = NUM_PARTIAL_LISTS; list-- > 0;) {
+        if (lists.heads[list] != nullptr) {
+            return lists.heads[list];
         }
-    } catch (...) {
-        locks_[index].clear(std::memory_order_release);
-        throw;
     }
+    if (lists.heads[EMPTY_LIST] != nullptr) {
+        return lists.heads[EMPTY_LIST];
+    }
+    return allow_new ? allocateSpan(index) : nullptr;
+}
 
-    // 释放锁
-    locks_[index].clear(std::memory_order_release);
-    return result;
+void CentralCache::moveBlock(void* ptr, size_t from_index, size_t to_index) {
+    // 独占 Span 的块从 Span 的起始地址开始，只需查找起始页；缩小后归还的尾部页在被新的 Span 使用时覆盖
+    lock(from_index);
+    auto span = static_cast<Span*>(page_map_.get(ptr));
+    unlinkSpan(from_index, span);
+    free_lists_[from_index].num_blocks.fetch_sub(1, std::memory_order_relaxed);
+    free_lists_[from_index].span_bytes.fetch_sub(span->num_pages * PageCache::PAGE_SIZE, std::memory_order_relaxed);
+    unlock(from_index);
+
+    span->num_pages = spanPages(SizeClass::classSize(to_index));
+    lock(to_index);
+    linkSpan(to_index, span, FULL_LIST);
+    free_lists_[to_index].num_blocks.fetch_add(1, std::memory_order_relaxed);
+    free_lists_[to_index].span_bytes.fetch_add(span->num_pages * PageCache::PAGE_SIZE, std::memory_order_relaxed);
+    unlock(to_index);
 }
 
 /**
- * 从中心缓存中获取该大小类别的内存块，如果中心缓存为空，则从页缓存中获取新的内存块并将其切分成合适大小的小块，然后返回一个可用的内存块指针
+ * 将各大小类别保留的空 Span 归还给 PageCache（内存压力较大时调用），正被其他线程占用的类别跳过
+ * @return 归还的 Span 数量
+ */
+size_t CentralCache::releaseEmptySpans() {
+    size_t num_released = 0;
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        if (free_lists_[index].span_bytes.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+        // 可能在持有某个类别的锁时（分配 Span 触发软限制）被调用，跳过正被占用的类别
+        if (free_lists_[index].lock.test_and_set(std::memory_order_acquire)) {
+            continue;
+        }
+        while (Span* span = span_lists_[index].heads[EMPTY_LIST]) {
+            releaseSpan(index, span);
+            ++num_released;
+        }
+        unlock(index);
+    }
+    return num_released;
+}
+
+CentralClassStats CentralCache::getClassStats(size_t index) const {
+    const CentralFreeList& list = free_lists_[index];
+    return CentralClassStats{list.num_free.load(std::memory_order_relaxed),
+                             list.num_blocks.load(std::memory_order_relaxed),
+                             list.span_bytes.load(std::memory_order_relaxed)};
+}
+
+bool CentralCache::isPageLevel(size_t index) {
+    return SizeClass::classSize(index) >= SPAN_PAGES * PageCache::PAGE_SIZE;
+}
+
+/**
+ * 从中心缓存中获取一个该大小类别的内存块
  * @param index 所需内存块的大小类别索引
- * @param num_batch 需要获取的内存块数量
  * @return 内存块的地址
  */
+void* CentralCache::fetchRange(size_t index) {
+    return fetchRange(index, 1);
+}
+
+/**
+ * 从中心缓存中获取该大小类别的一批内存块。依次从最满的 Span 中取出空闲块（先取归还的块，再按地址顺序切分新块），
+ * 所有 Span 都没有空闲块时才从页缓存获取新的 Span。已经取到部分块时不再获取新的 Span，返回的块数可能少于 num_batch
+ * @param index 所需内存块的大小类别索引
+ * @param num_batch 需要获取的内存块数量
+ * @return 以 nullptr 结尾的内存块链表
+ */
 void *CentralCache::fetchRange(size_t index, size_t num_batch)
 {
     // 索引检查，当索引大于等于FREE_LIST_SIZE时，说明申请内存过大应直接向系统申请
     if (index >= FREE_LIST_SIZE || num_batch == 0) {
         return nullptr;
     }
+    MEMORYPOOL_PROBE_SCOPE(probe, CentralFetch, index, num_batch);
+    size_t size = SizeClass::classSize(index);
     // 获取自旋锁
-    while (locks_[index].test_and_set(std::memory_order_acquire)) {
-        std::this_thread::yield();  // 添加线程让步，避免忙等待，避免过度消耗CPU
-    }
-    //
+    lock(index);
     void* result = nullptr;
+    void** tail = &result;
+    size_t cnt = 0;
     try {
-        // 尝试从中心缓存获取内存块
-        result = central_free_list_[index].load(std::memory_order_relaxed);
-        if (result) {   // 中心缓存不为空，则从现有链表中获取指定数量的块
-            // 保存 result 的下一个节点
-            // TODO: 每个内存块的开头部分被用作指向下一个内存块的指针，从而形成一个链表结构
-            // void** 类型的强制转换是为了操作内存块链表中的指针，实现链表节点的取出和链表头指针的更新
-            void* cur = result;
-            void* pre = nullptr;
-            size_t cnt = 0;
-            
-            while (cur && cnt < num_batch) {
-                pre = cur;
-                cur = *reinterpret_cast<void**>(cur);
-                cnt++;
-            }
-            if (pre) {
-                *reinterpret_cast<void**>(pre) = nullptr;
+        while (cnt < num_batch) {
+            Span* span = pickSpan(index, cnt == 0);
+            if (span == nullptr) {
+                break;
             }
-            // 更新中心缓存
-            central_free_list_[index].store(cur, std::memory_order_release);
-        } else {    // 中心缓存为空，则从页缓存中获取新的内存块，并切分
-            // 1. 从页缓存获取新的内存块
-            size_t size = (index + 1) * ALIGNMENT;
-            result = fetchFromPageCache(size);
-            if (result == nullptr) {    // 从页缓存中获取失败，释放自旋锁并返回
-                locks_[index].clear(std::memory_order_release);
-                return nullptr;
-            }
-
-            // 2. 将获取的内存块切分成小块，并用链表管理
-            char* start = reinterpret_cast<char*>(result);
-            size_t num_block = (SPAN_PAGES * PageCache::PAGE_SIZE) / size;
-            size_t num_alloc = std::min(num_batch, num_block);
-
-            // 构建返回给 ThreadCache 的内存块链表
-            if (num_alloc > 1) {
-                for (size_t i = 1; i < num_alloc; ++i) {
-                    void* cur = start + (i - 1) * size;
-                    void* nxt = start + i * size;
-                    *reinterpret_cast<void**>(cur) = nxt;
-                }
-                *reinterpret_cast<void**>(start + (num_alloc - 1) * size) = nullptr;    // 最后一个block
-            }
-            // 构建保留在 CentralCache 的链表
-            if (num_block > num_alloc) {
-                void* remain_start = start + num_alloc * size;
-                for (size_t i = num_alloc + 1; i < num_block; ++i) {
-                    void* cur = start + (i - 1) * size;
-                    void* nxt = start + i * size;
-                    *reinterpret_cast<void**>(cur) = nxt;
+            while (cnt < num_batch && span->num_free > 0) {
+                void* block;
+                if (span->free_list != nullptr) {
+                    block = span->free_list;
+                    span->free_list = *reinterpret_cast<void**>(block);
+                } else {
+                    block = span->unused;
+                    span->unused += size;
                 }
-                *reinterpret_cast<void**>(start + (num_block - 1) * size) = nullptr;
-                central_free_list_[index].store(remain_start, std::memory_order_release);
+                *tail = block;
+                tail = reinterpret_cast<void**>(block);
+                --span->num_free;
+                ++cnt;
             }
+            updateSpanList(index, span);
         }
+        *tail = nullptr;
+        free_lists_[index].num_free.fetch_sub(cnt, std::memory_order_relaxed);
     } catch (...) {
-        locks_[index].clear(std::memory_order_release);
+        unlock(index);
         throw;
     }
 
     // 释放锁
-    locks_[index].clear(std::memory_order_release);
+    unlock(index);
     return result;
 }
 /**
- * 将一批内存块归还给中心缓存，并将其合并到对应的空闲链表中
+ * 将一批内存块归还给中心缓存：每个内存块通过页映射找到所属的 Span 并插入该 Span 的空闲链表。
+ * Span 变为全空时，如果该类别已经保留了 MAX_EMPTY_SPANS 个空 Span，则将其归还给 PageCache
  * @param start 指向要归还的内存块链表的起始地址
  * @param size  要归还的内存块的数量
- * @param index 表示这些内存块所属的大小类别索引，用于定位中心缓存中对应的空闲链表
+ * @param index 表示这些内存块所属的大小类别索引
  */
 void CentralCache::returnRange(void* start, size_t size, size_t index) {
     // 当索引大于等于FREE_LIST_SIZE时，说明内存过大应直接向系统归还
@@ -189,26 +317,53 @@ void CentralCache::returnRange(void* start, size_t size, size_t index) {
         return;
     }
     // 获取自旋锁
-    while (locks_[index].test_and_set(std::memory_order_acquire)) {
-        std::this_thread::yield();
+    lock(index);
+    insertRange(start, size, index);
+    unlock(index);
+}
+
+bool CentralCache::tryReturnRange(void* start, size_t size, size_t index) {
+    if (start == nullptr || index >= FREE_LIST_SIZE) {
+        return true;
+    }
+    if (free_lists_[index].lock.test_and_set(std::memory_order_acquire)) {
+        return false;
     }
+    insertRange(start, size, index);
+    unlock(index);
+    return true;
+}
+
+void CentralCache::insertRange(void* start, size_t size, size_t index) {
+    MEMORYPOOL_PROBE_SCOPE(probe, CentralReturn, index, size);
+    CentralFreeList& list = free_lists_[index];
     try {
-        // 寻找归还内存块链表的最后一个节点
-        void* end = start;
-        size_t cnt = 1;
-        while (*reinterpret_cast<void**>(end) != nullptr && cnt < size) {
-            end = *reinterpret_cast<void**>(end);
+        void* cur = start;
+        size_t cnt = 0;
+        size_t num_pending = 0;     // 尚未计入 num_free 的块数
+        while (cur != nullptr && cnt < size) {
+            void* next = *reinterpret_cast<void**>(cur);
+            auto span = static_cast<Span*>(page_map_.get(cur));
+            *reinterpret_cast<void**>(cur) = span->free_list;
+            span->free_list = cur;
+            ++span->num_free;
+            ++num_pending;
             ++cnt;
+            if (span->num_free == span->num_blocks && span_lists_[index].num_empty >= MAX_EMPTY_SPANS) {
+                list.num_free.fetch_add(num_pending, std::memory_order_relaxed);
+                num_pending = 0;
+                releaseSpan(index, span);
+            } else {
+                updateSpanList(index, span);
+            }
+            cur = next;
         }
-        // 合并链表，将归还的链表连接到中心缓存的链表头部（头插）
-        void* head = central_free_list_[index].load(std::memory_order_relaxed); // 中心缓存中对应索引的空闲链表的头指针
-        *reinterpret_cast<void**>(end) = head;  // 将原链表头接到归还链表的尾部
-        central_free_list_[index].store(end, std::memory_order_release);
+        list.num_free.fetch_add(num_pending, std::memory_order_relaxed);
+        MEMORYPOOL_PROBE_SET_ARGS(probe, index, cnt);
     } catch (...) {
-        locks_[index].clear(std::memory_order_release);
+        unlock(index);
         throw;
     }
-    locks_[index].clear(std::memory_order_release);
 }
 
-}   // namespace MemoryPoolV2
\ No newline at end of file
+}   // namespace MemoryPoolV2
@@ -0,0 +1,65 @@
+//
+// Created by 11361 on 25-5-7.
+//
+#include "../include/CoroutineFrame.h"
+
+namespace MemoryPoolV2
+{
+__thread CoroutineFrameCache::FrameSlot CoroutineFrameCache::slots_[NUM_SLOTS] = {};
+
+// 线程退出时将缓存的帧归还给 MemoryPool
+struct CoroutineFrameCache::SlotsHolder {
+    ~SlotsHolder() {
+        CoroutineFrameCache::flush();
+    }
+};
+
+void* CoroutineFrameCache::allocateSlow(size_t size) {
+    void* ptr = MemoryPool::allocate(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+/**
+ * 释放的慢速路径：槽位中没有缓存的帧时改为缓存 size 大小的帧（首次使用时登记线程退出时的清理），
+ * 槽位已满或正在缓存其他大小的帧时直接归还给 MemoryPool
+ * @param ptr
+ * @param size
+ */
+void CoroutineFrameCache::deallocateSlow(void* ptr, size_t size) {
+    FrameSlot& slot = slots_[slotOf(size)];
+    if (slot.head != nullptr) {
+        MemoryPool::deallocate(ptr, size);
+        return;
+    }
+    // 先创建当前线程的线程缓存，保证其 thread_local 对象晚于 SlotsHolder 析构，线程退出时 flush 仍可释放内存
+    Heap::defaultThreadCache();
+    static thread_local SlotsHolder holder;
+    (void)holder;
+    slot.size = size;
+    slot.head = ptr;
+    slot.count = 1;
+    *reinterpret_cast<void**>(ptr) = nullptr;
+}
+
+void CoroutineFrameCache::flush() {
+    for (FrameSlot& slot : slots_) {
+        while (slot.head != nullptr) {
+            void* frame = slot.head;
+            slot.head = *reinterpret_cast<void**>(frame);
+            MemoryPool::deallocate(frame, slot.size);
+        }
+        slot = FrameSlot{};
+    }
+}
+
+size_t CoroutineFrameCache::getNumCached() {
+    size_t num_cached = 0;
+    for (const FrameSlot& slot : slots_) {
+        num_cached += slot.count;
+    }
+    return num_cached;
+}
+}   // namespace MemoryPoolV2
@@ -0,0 +1,157 @@
+//
+// Created by 11361 on 25-5-1.
+//
+#include <algorithm>
+#include <vector>
+#include "../include/DeferredFree.h"
+#include "../include/MemoryPool.h"
+#include "../include/MetadataAllocator.h"
+
+namespace MemoryPoolV2
+{
+std::mutex& DeferredFree::registryMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::vector<DeferredFree::Ring*>& DeferredFree::registry() {
+    static std::vector<Ring*> rings;
+    return rings;
+}
+
+__thread DeferredFree::Ring* DeferredFree::local_ring_ = nullptr;
+
+// 线程退出时释放缓冲区中剩余的内存并注销
+struct DeferredFree::RingHolder {
+    ~RingHolder() {
+        DeferredFree::disable();
+    }
+};
+
+void DeferredFree::enable(size_t capacity) {
+    if (local_ring_ != nullptr) {
+        return;
+    }
+    // 先创建当前线程的线程缓存，保证其 thread_local 对象晚于 RingHolder 析构，线程退出时 disable 仍可释放内存
+    Heap::defaultThreadCache();
+    static thread_local RingHolder holder;
+    (void)holder;
+
+    size_t rounded = 1;
+    while (rounded < std::max(capacity, size_t(1))) {
+        rounded <<= 1;
+    }
+    auto ring = new Ring();
+    ring->entries = static_cast<Entry*>(FixedSizeAllocator::allocatePages(rounded * sizeof(Entry)));
+    if (ring->entries == nullptr) {
+        delete ring;
+        throw std::bad_alloc();
+    }
+    ring->capacity = rounded;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        registry().push_back(ring);
+    }
+    local_ring_ = ring;
+}
+
+void DeferredFree::disable() {
+    Ring* ring = local_ring_;
+    if (ring == nullptr) {
+        return;
+    }
+    local_ring_ = nullptr;
+    unregisterRing(ring);
+    // 注销后回收线程不会再访问该缓冲区，但可能仍在处理它，通过 consumer_mutex 等待其结束
+    {
+        std::lock_guard<std::mutex> lock(ring->consumer_mutex);
+        drainRing(*ring);
+    }
+    FixedSizeAllocator::deallocatePages(ring->entries, ring->capacity * sizeof(Entry));
+    delete ring;
+}
+
+/**
+ * 缓冲区看起来已满时重新读取消费者的 tail
+ * @param ring
+ * @param head 生产者当前的 head
+ * @return 重新读取后仍有空位时返回 true
+ */
+bool DeferredFree::refreshTail(Ring& ring, size_t head) {
+    ring.cached_tail = ring.tail.load(std::memory_order_acquire);
+    return head - ring.cached_tail < ring.capacity;
+}
+
+void DeferredFree::deallocateNow(void* ptr, size_t size) {
+    MemoryPool::deallocate(ptr, size);
+}
+
+size_t DeferredFree::drainRing(Ring& ring) {
+    size_t tail = ring.tail.load(std::memory_order_relaxed);
+    size_t head = ring.head.load(std::memory_order_acquire);
+    for (size_t i = tail; i != head; ++i) {
+        const Entry& entry = ring.entries[i & (ring.capacity - 1)];
+        MemoryPool::deallocate(entry.ptr, entry.size);
+    }
+    ring.tail.store(head, std::memory_order_release);
+    return head - tail;
+}
+
+void DeferredFree::unregisterRing(Ring* ring) {
+    std::lock_guard<std::mutex> lock(registryMutex());
+    auto& rings = registry();
+    rings.erase(std::remove(rings.begin(), rings.end(), ring), rings.end());
+}
+
+size_t DeferredFree::drain() {
+    Ring* ring = local_ring_;
+    if (ring == nullptr) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(ring->consumer_mutex);
+    return drainRing(*ring);
+}
+
+/**
+ * 依次释放所有线程缓冲区中的内存。持有注册表锁期间，缓冲区不会被所属线程注销删除
+ * @return 释放的内存块数
+ */
+size_t DeferredFree::drainAll() {
+    size_t num_freed = 0;
+    {
+        std::lock_guard<std::mutex> registry_lock(registryMutex());
+        for (Ring* ring : registry()) {
+            std::lock_guard<std::mutex> lock(ring->consumer_mutex);
+            num_freed += drainRing(*ring);
+        }
+    }
+    if (num_freed > 0) {
+        MemoryPool::trim_thread_cache();
+    }
+    return num_freed;
+}
+
+DeferredReclaimer::DeferredReclaimer(std::chrono::milliseconds interval) : interval_(interval) {
+    thread_ = std::thread([this]() { run(); });
+}
+
+DeferredReclaimer::~DeferredReclaimer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+void DeferredReclaimer::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!cv_.wait_for(lock, interval_, [this]() { return stop_; })) {
+        lock.unlock();
+        DeferredFree::drainAll();
+        lock.lock();
+    }
+    lock.unlock();
+    DeferredFree::drainAll();
+}
+}   // namespace MemoryPoolV2
@@ -0,0 +1,363 @@
+//
+// Created by 11361 on 25-4-20.
+//
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include "../include/Heap.h"
+#ifdef MEMORYPOOL_SIZE_STATS
+#include "../include/SizeHistogram.h"
+#endif
+
+namespace MemoryPoolV2
+{
+namespace
+{
+// 全局堆注册表，保护堆的创建/销毁与线程退出之间的并发
+std::mutex& registryMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::array<Heap*, Heap::MAX_HEAPS>& registry() {
+    static std::array<Heap*, Heap::MAX_HEAPS> heaps{};
+    return heaps;
+}
+
+// 全局单调递增的代数，保证槽位被复用后旧的线程槽位不会误判为有效
+std::atomic<uint64_t> g_next_generation{1};
+}   // namespace
+
+__thread ThreadCache* Heap::default_cache_ = nullptr;
+__thread uint64_t Heap::default_cache_generation_ = 0;
+std::atomic<uint64_t> Heap::default_generation_{0};
+
+struct Heap::ThreadSlotsHolder {
+    ThreadCacheSlots slots{};
+    ~ThreadSlotsHolder() {
+        Heap::onThreadExit(slots);
+    }
+};
+
+Heap& Heap::getDefault() {
+    // 默认堆永不析构：进程退出时其他静态对象或仍在运行的线程可能还在使用它
+    static Heap* instance = [] {
+        auto heap = new Heap();
+        heap->is_default_ = true;
+        default_generation_.store(heap->generation_, std::memory_order_relaxed);
+        return heap;
+    }();
+    return *instance;
+}
+
+ThreadCache& Heap::defaultThreadCacheSlow() {
+    Heap& heap = getDefault();
+    ThreadCache& cache = heap.getThreadCache();
+    default_cache_ = &cache;
+    default_cache_generation_ = heap.generation_;
+    return cache;
+}
+
+Heap::Heap(PageSource* source)
+    : generation_(g_next_generation++), central_cache_(page_cache_), long_central_cache_(page_cache_),
+      permanent_arena_(Arena::DEFAULT_CHUNK_PAGES, page_cache_) {
+    page_cache_.setPageSource(source);
+    std::lock_guard<std::mutex> lock(registryMutex());
+    auto& heaps = registry();
+    auto iter = std::find(heaps.begin(), heaps.end(), nullptr);
+    if (iter == heaps.end()) {
+        throw std::runtime_error("MemoryPoolV2::Heap: too many heaps");
+    }
+    *iter = this;
+    id_ = iter - heaps.begin();
+    page_cache_.setPressureCallback([](void* heap) { static_cast<Heap*>(heap)->releaseMemory(); }, this);
+}
+
+Heap::~Heap() {
+    destroy();
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry()[id_] = nullptr;
+}
+
+Heap::ThreadCacheSlots& Heap::threadCacheSlots() {
+    static thread_local ThreadSlotsHolder holder;
+    return holder.slots;
+}
+
+/**
+ * 为当前线程创建该堆上的线程缓存并登记到堆中
+ * @return 线程缓存
+ */
+ThreadCache& Heap::createThreadCache() {
+    auto cache = new ThreadCache(central_cache_, page_cache_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        thread_caches_.push_back(cache);
+    }
+    threadCacheSlots()[id_] = ThreadCacheSlot{cache, generation_};
+    return *cache;
+}
+
+ThreadCache* Heap::findThreadCache() {
+    ThreadCacheSlot& slot = threadCacheSlots()[id_];
+    return slot.cache != nullptr && slot.generation == generation_ ? slot.cache : nullptr;
+}
+
+/**
+ * 将线程缓存中的内存块归还给中心缓存，并从堆中注销（调用者需持有注册表锁）
+ * @param cache
+ */
+void Heap::releaseThreadCache(ThreadCache* cache) {
+    {
+        // 先注销，之后扫描线程不会再回收该线程缓存，flush 不会与回收同时进行
+        std::lock_guard<std::mutex> lock(mutex_);
+        thread_caches_.erase(std::remove(thread_caches_.begin(), thread_caches_.end(), cache), thread_caches_.end());
+    }
+    cache->flush();
+    delete cache;
+}
+
+void Heap::onThreadExit(ThreadCacheSlots& slots) {
+    default_cache_ = nullptr;
+    std::lock_guard<std::mutex> lock(registryMutex());
+    auto& heaps = registry();
+    for (size_t id = 0; id < MAX_HEAPS; ++id) {
+        ThreadCacheSlot& slot = slots[id];
+        // 只有堆仍然存在且未被销毁过时，槽位中的线程缓存才有效
+        if (slot.cache != nullptr && heaps[id] != nullptr && heaps[id]->generation_ == slot.generation) {
+            heaps[id]->releaseThreadCache(slot.cache);
+        }
+        slot = ThreadCacheSlot{};
+    }
+}
+
+HeapStats Heap::getStats() {
+    PageCacheStats page_stats = page_cache_.getStats();
+    std::lock_guard<std::mutex> lock(mutex_);
+    return HeapStats{page_stats.system_bytes, page_stats.free_bytes, page_stats.large_bytes,
+                     page_stats.num_spans, thread_caches_.size()};
+}
+
+HeapReport Heap::walk() {
+    HeapReport report{};
+    report.stats = getStats();
+    report.free_spans = page_cache_.getFreeSpanReport();
+
+    // 1. 各线程缓存中的空闲块
+    std::vector<size_t> thread_free(FREE_LIST_SIZE, 0);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (ThreadCache* cache : thread_caches_) {
+            cache->collectCachedBlocks(thread_free.data());
+        }
+    }
+
+    // 2. 按分配大小直方图估算各类别的内部碎片（直方图以 ALIGNMENT 为粒度，低于该粒度的取整不计入）
+    std::vector<double> requested_bytes, class_bytes;
+#ifdef MEMORYPOOL_SIZE_STATS
+    requested_bytes.assign(FREE_LIST_SIZE, 0);
+    class_bytes.assign(FREE_LIST_SIZE, 0);
+    for (size_t size = ALIGNMENT; size <= MAX_BYTES; size += ALIGNMENT) {
+        if (uint64_t count = SizeHistogram::getCount(size)) {
+            size_t index = SizeClass::getIndex(size);
+            requested_bytes[index] += static_cast<double>(size) * count;
+            class_bytes[index] += static_cast<double>(SizeClass::classSize(index)) * count;
+        }
+    }
+#endif
+
+    // 3. 各大小类别
+    size_t class_span_bytes = 0;
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        CentralClassStats central = central_cache_.getClassStats(index);
+        if (central.span_bytes == 0) {
+            continue;
+        }
+        SizeClassReport item{};
+        item.class_size = SizeClass::classSize(index);
+        item.span_bytes = central.span_bytes;
+        item.num_blocks = central.num_blocks;
+        item.central_free_blocks = central.num_free;
+        item.thread_free_blocks = thread_free[index];
+        size_t free_blocks = item.central_free_blocks + item.thread_free_blocks;
+        item.in_use_blocks = item.num_blocks > free_blocks ? item.num_blocks - free_blocks : 0;
+        item.utilization = static_cast<double>(item.in_use_blocks * item.class_size) / item.span_bytes;
+        item.internal_fragmentation = class_bytes.empty() || class_bytes[index] == 0
+                                    ? -1.0 : 1.0 - requested_bytes[index] / class_bytes[index];
+        report.classes.push_back(item);
+
+        class_span_bytes += item.span_bytes;
+        report.in_use_bytes += item.in_use_blocks * item.class_size;
+        report.central_free_bytes += item.central_free_blocks * item.class_size;
+        report.thread_free_bytes += item.thread_free_blocks * item.class_size;
+        report.span_tail_bytes += item.span_bytes - std::min(item.span_bytes, item.num_blocks * item.class_size);
+    }
+    // 4. Lifetime::Long 的中心缓存
+    LifetimeStats long_stats = getLifetimeStats(Lifetime::Long);
+    report.long_span_bytes = long_stats.span_bytes;
+    report.long_in_use_bytes = long_stats.in_use_bytes;
+    class_span_bytes += report.long_span_bytes;
+
+    size_t allocated_span_bytes = report.stats.system_bytes - report.stats.free_span_bytes;
+    report.other_span_bytes = allocated_span_bytes > class_span_bytes ? allocated_span_bytes - class_span_bytes : 0;
+    return report;
+}
+
+/**
+ * 扫描各线程缓存：自上一次扫描以来有过操作的标记为 IDLE；仍为 IDLE 的说明整个扫描周期内没有操作，
+ * 直接将其缓存归还给中心缓存（reserve 的类别除外），已回收且之后没有操作的线程缓存不再重复回收；
+ * 因类别锁被占用而未能完整回收的线程缓存留到下一次扫描
+ * @return 回收的线程缓存数量
+ */
+size_t Heap::scavengeIdleCaches() {
+    size_t num_reclaimed = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (ThreadCache* cache : thread_caches_) {
+        uint8_t activity = ThreadCache::ACTIVITY_TOUCHED;
+        if (cache->activity_.compare_exchange_strong(activity, ThreadCache::ACTIVITY_IDLE, std::memory_order_relaxed)) {
+            cache->reclaimed_ = false;
+            continue;
+        }
+        if (activity != ThreadCache::ACTIVITY_IDLE || cache->reclaimed_) {
+            continue;
+        }
+        // 回收时不等待中心缓存的锁：持有类别锁的线程可能正因软限制在 releaseMemory 中等待 mutex_。
+        // 有类别被跳过时下一次扫描再回收
+        cache->reclaimed_ = cache->tryReclaim(true);
+        if (cache->reclaimed_) {
+            ++num_reclaimed;
+        }
+    }
+    return num_reclaimed;
+}
+
+/**
+ * 释放内存（超过软限制时由 PageCache 调用）：当前线程的缓存直接归还，其他线程的缓存在所有者不在操作中时直接回收，
+ * 正在操作的线程缓存改为请求裁剪。可能在持有中心缓存某个类别的锁时被调用，归还时跳过正被占用的类别。
+ * 通过 reserve/prewarm 预留的大小类别保留不动
+ * @return munmap 的字节数
+ */
+size_t Heap::releaseMemory() {
+    ThreadCache* current = findThreadCache();
+    if (current != nullptr) {
+        current->releaseCached(true, true);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (ThreadCache* cache : thread_caches_) {
+            if (cache != current && !cache->tryReclaim(false)) {
+                cache->requestTrim();
+            }
+        }
+    }
+    central_cache_.releaseEmptySpans();
+    long_central_cache_.releaseEmptySpans();
+    return page_cache_.releaseFreeMemory();
+}
+
+void Heap::destroy() {
+    std::lock_guard<std::mutex> registry_lock(registryMutex());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 线程缓存中的内存块随 PageCache 一起释放，无需归还
+        for (ThreadCache* cache : thread_caches_) {
+            delete cache;
+        }
+        thread_caches_.clear();
+        // 使所有线程中该堆的槽位失效
+        generation_ = g_next_generation++;
+        if (is_default_) {
+            default_generation_.store(generation_, std::memory_order_relaxed);
+        }
+    }
+    central_cache_.reset();
+    long_central_cache_.reset();
+    {
+        // Arena 的 chunk 头部位于 Span 中，必须在 PageCache 解除映射之前释放
+        std::lock_guard<std::mutex> lock(permanent_mutex_);
+        permanent_arena_.release();
+    }
+    page_cache_.releaseAll();
+}
+
+void* Heap::allocate(size_t size, Lifetime hint) {
+    void* ptr;
+    switch (hint) {
+        case Lifetime::Short:
+            ptr = allocate(size);
+            break;
+        case Lifetime::Long:
+            // 长期存活的对象分配频率低，直接从中心缓存获取单个块，线程缓存中不会混入这些块
+            ptr = size > MAX_BYTES ? page_cache_.allocateLarge(size)
+                                   : long_central_cache_.fetchRange(SizeClass::getIndex(size));
+            break;
+        default: {
+            std::lock_guard<std::mutex> lock(permanent_mutex_);
+            ptr = permanent_arena_.allocate(size);
+            break;
+        }
+    }
+    if (ptr != nullptr) {
+        lifetime_allocs_[static_cast<size_t>(hint)].fetch_add(1, std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+void Heap::deallocate(void* ptr, size_t size, Lifetime hint) {
+    if (ptr == nullptr || hint == Lifetime::Permanent) {
+        return;
+    }
+    lifetime_frees_[static_cast<size_t>(hint)].fetch_add(1, std::memory_order_relaxed);
+    switch (hint) {
+        case Lifetime::Short:
+            deallocate(ptr, size);
+            break;
+        case Lifetime::Long:
+            if (size > MAX_BYTES) {
+                page_cache_.deallocateLarge(ptr, size);
+            } else {
+                *reinterpret_cast<void**>(ptr) = nullptr;
+                long_central_cache_.returnRange(ptr, 1, SizeClass::getIndex(size));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * 统计某个生命周期提示的 Span 使用情况。Short 与 walk() 相同，需要扣除各线程缓存中的空闲块；
+ * Long 不经过线程缓存，中心缓存之外的块都已分配给用户
+ * @param hint
+ * @return 统计信息（近似值）
+ */
+LifetimeStats Heap::getLifetimeStats(Lifetime hint) {
+    LifetimeStats stats{};
+    stats.num_allocs = lifetime_allocs_[static_cast<size_t>(hint)].load(std::memory_order_relaxed);
+    stats.num_frees = lifetime_frees_[static_cast<size_t>(hint)].load(std::memory_order_relaxed);
+    if (hint == Lifetime::Permanent) {
+        std::lock_guard<std::mutex> lock(permanent_mutex_);
+        stats.span_bytes = permanent_arena_.bytesReserved();
+        stats.in_use_bytes = permanent_arena_.bytesUsed();
+    } else {
+        std::vector<size_t> thread_free(FREE_LIST_SIZE, 0);
+        if (hint == Lifetime::Short) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (ThreadCache* cache : thread_caches_) {
+                cache->collectCachedBlocks(thread_free.data());
+            }
+        }
+        CentralCache& central = hint == Lifetime::Short ? central_cache_ : long_central_cache_;
+        for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+            CentralClassStats central_stats = central.getClassStats(index);
+            size_t free_blocks = central_stats.num_free + thread_free[index];
+            size_t in_use_blocks = central_stats.num_blocks > free_blocks ? central_stats.num_blocks - free_blocks : 0;
+            stats.span_bytes += central_stats.span_bytes;
+            stats.in_use_bytes += in_use_blocks * SizeClass::classSize(index);
+        }
+    }
+    stats.utilization = stats.span_bytes == 0 ? 0.0 : static_cast<double>(stats.in_use_bytes) / stats.span_bytes;
+    return stats;
+}
+
+}   // namespace MemoryPoolV2
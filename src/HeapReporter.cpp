@@ -0,0 +1,86 @@
+//
+// Created by 11361 on 25-4-26.
+//
+#include <algorithm>
+#include <vector>
+#include "../include/HeapReporter.h"
+
+namespace MemoryPoolV2
+{
+HeapReporter::HeapReporter(Heap& heap, std::chrono::milliseconds interval, FILE* out, size_t max_classes)
+    : heap_(heap), interval_(interval), out_(out), max_classes_(max_classes) {
+    thread_ = std::thread([this]() { run(); });
+}
+
+HeapReporter::~HeapReporter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+void HeapReporter::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!cv_.wait_for(lock, interval_, [this]() { return stop_; })) {
+        lock.unlock();
+        print(heap_.walk(), out_, max_classes_);
+        lock.lock();
+    }
+}
+
+/**
+ * 以文本形式输出堆报告。大小类别按浪费的字节数（Span 字节数 - 已分配字节数）从大到小排列
+ * @param report
+ * @param out
+ * @param max_classes 最多输出的大小类别数
+ */
+void HeapReporter::print(const HeapReport& report, FILE* out, size_t max_classes) {
+    constexpr double KB = 1024.0;
+    const HeapStats& stats = report.stats;
+    const FreeSpanReport& free_spans = report.free_spans;
+    fprintf(out, "[MemoryPool] mapped %.1f KB (spans %.1f KB, large %.1f KB), in use %.1f KB, thread caches %zu\n",
+            (stats.system_bytes + stats.large_bytes) / KB, stats.system_bytes / KB, stats.large_bytes / KB,
+            report.in_use_bytes / KB, stats.num_thread_caches);
+    fprintf(out, "  free: central %.1f KB, thread %.1f KB, span tail %.1f KB, free spans %.1f KB, other spans %.1f KB\n",
+            report.central_free_bytes / KB, report.thread_free_bytes / KB, report.span_tail_bytes / KB,
+            stats.free_span_bytes / KB, report.other_span_bytes / KB);
+    if (report.long_span_bytes != 0) {
+        fprintf(out, "  long-lived spans %.1f KB, in use %.1f KB\n",
+                report.long_span_bytes / KB, report.long_in_use_bytes / KB);
+    }
+    fprintf(out, "  free spans: %zu spans in %zu runs, largest run %zu pages\n",
+            free_spans.num_free_spans, free_spans.num_free_runs, free_spans.largest_free_run);
+    for (size_t bucket = 0; bucket < FreeSpanReport::NUM_BUCKETS; ++bucket) {
+        if (free_spans.run_count[bucket] != 0) {
+            fprintf(out, "    run >= %6zu pages: %6zu runs, %8zu pages\n",
+                    size_t(1) << bucket, free_spans.run_count[bucket], free_spans.run_pages[bucket]);
+        }
+    }
+
+    std::vector<const SizeClassReport*> classes;
+    for (const SizeClassReport& item : report.classes) {
+        classes.push_back(&item);
+    }
+    auto wasted = [](const SizeClassReport* item) {
+        return item->span_bytes - std::min(item->span_bytes, item->in_use_blocks * item->class_size);
+    };
+    std::sort(classes.begin(), classes.end(), [&wasted](const SizeClassReport* a, const SizeClassReport* b) {
+        return wasted(a) > wasted(b);
+    });
+    classes.resize(std::min(classes.size(), max_classes));
+    fprintf(out, "  %8s %10s %10s %10s %10s %10s %7s %7s\n",
+            "class", "span_KB", "blocks", "in_use", "central", "thread", "util%", "frag%");
+    for (const SizeClassReport* item : classes) {
+        char frag[16] = "-";
+        if (item->internal_fragmentation >= 0) {
+            snprintf(frag, sizeof(frag), "%.1f", item->internal_fragmentation * 100);
+        }
+        fprintf(out, "  %8zu %10.1f %10zu %10zu %10zu %10zu %7.1f %7s\n",
+                item->class_size, item->span_bytes / KB, item->num_blocks, item->in_use_blocks,
+                item->central_free_blocks, item->thread_free_blocks, item->utilization * 100, frag);
+    }
+    fflush(out);
+}
+}   // namespace MemoryPoolV2
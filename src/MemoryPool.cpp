@@ -1,32 +1,41 @@
 //
 // Created by 11361 on 25-3-26.
 //
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "../include/MemoryPool.h"
 
 namespace MemoryPoolV1
 {
 
     MemoryPool::MemoryPool(size_t block_size)
-        : block_size_(block_size), slot_size_(0), first_block_(nullptr), cur_slot_(nullptr), free_list_(nullptr), last_slot_(nullptr)
-    {}
+        : block_size_(block_size), slot_size_(0), first_block_(nullptr), cur_block_(nullptr),
+          cur_slot_(nullptr), free_list_(0), last_slot_(nullptr)
+    {
+        assert((block_size & (block_size - 1)) == 0);
+    }
 
     MemoryPool::~MemoryPool() {
         auto cur = first_block_;
         while (cur) {
-            Slot* nxt = cur->next;
-            // 等同于 free(reinterpret_cast<void*>(firstBlock_));
-            // 转化为 void 指针，因为 void 类型不需要调用析构函数，只释放空间
-            operator delete(reinterpret_cast<void*>(cur));
+            Block* nxt = cur->next;
+            unmapBlock(cur);
             cur = nxt;
         }
+        for (Block* block : retired_blocks_) {
+            unmapBlock(block);
+        }
     }
 
     void MemoryPool::init(size_t slot_size) {
         assert(slot_size > 0);
         slot_size_ = slot_size;
         first_block_ = nullptr;
+        cur_block_ = nullptr;
+        retired_blocks_.clear();
         cur_slot_ = nullptr;
-        free_list_ = nullptr;
+        free_list_ = 0;
         last_slot_ = nullptr;
     }
 
@@ -61,22 +70,64 @@ namespace MemoryPoolV1
     }
 
     void MemoryPool::allocateNewBlock() {
-        // operator new 是 C++ 中用于分配原始内存的函数，它不会调用对象的构造函数
-        void* new_block = operator new(block_size_);
+        // 优先复用 trim 摘下的内存块（访问时重新分配物理页），否则映射新的内存块。
+        // 内存块按 block_size_ 对齐，trim 时可以由槽地址直接算出所属的内存块
+        Block* new_block;
+        if (!retired_blocks_.empty()) {
+            new_block = retired_blocks_.back();
+            retired_blocks_.pop_back();
+        } else {
+            new_block = mapBlock();
+        }
         // 头插法将新分配的内存块插入到内存块链表的头部
-        reinterpret_cast<Slot*>(new_block)->next = first_block_;
-        first_block_ = reinterpret_cast<Slot*>(new_block);
+        reinterpret_cast<Block*>(new_block)->next = first_block_;
+        first_block_ = reinterpret_cast<Block*>(new_block);
+        cur_block_ = first_block_;
 
-        // 跳过Slot中存储next指针的空间
-        char* body = reinterpret_cast<char*>(new_block) + sizeof(Slot*);
-        // 计算对齐slot大小所需的字节数
-        size_t padding = padPointer(body, slot_size_);
-        // 第一个可用的内存槽的地址
-        cur_slot_ = reinterpret_cast<Slot*>(body + padding);
+        // 第一个可用的内存槽的地址（跳过块头部并对齐slot大小）
+        cur_slot_ = firstSlot(cur_block_);
 
-        // 超过该标记位置，则说明该内存块已无内存槽可用，需向系统申请新的内存块
+        // 超过该标记位置，则说明该内存块已无内存槽可用，需向系统申请新的内存块。
+        // 空闲链表中可能有其他线程刚刚释放的槽，不能清空
         last_slot_ = reinterpret_cast<Slot*>(reinterpret_cast<size_t>(new_block) + block_size_ - slot_size_ + 1);
-        free_list_ = nullptr;
+    }
+
+    static size_t pageSize() {
+        static const size_t page_size = sysconf(_SC_PAGESIZE);
+        return page_size;
+    }
+
+    size_t MemoryPool::mappedSize() const {
+        return (block_size_ + pageSize() - 1) / pageSize() * pageSize();
+    }
+
+    /**
+     * 映射一个内存块。block_size_ 不超过页大小时 mmap 返回的地址天然满足对齐，
+     * 否则多映射 block_size_ 字节，对齐后解除首尾多余的部分
+     * @return 按 block_size_ 对齐的内存块
+     */
+    Block* MemoryPool::mapBlock() {
+        size_t size = mappedSize();
+        size_t extra = block_size_ > pageSize() ? block_size_ : 0;
+        void* ptr = mmap(nullptr, size + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        char* start = static_cast<char*>(ptr);
+        char* aligned = reinterpret_cast<char*>((reinterpret_cast<size_t>(start) + block_size_ - 1) & ~(block_size_ - 1));
+        if (extra != 0) {
+            if (aligned > start) {
+                munmap(start, aligned - start);
+            }
+            if (start + extra > aligned) {
+                munmap(aligned + size, start + extra - aligned);
+            }
+        }
+        return reinterpret_cast<Block*>(aligned);
+    }
+
+    void MemoryPool::unmapBlock(Block* block) {
+        munmap(block, mappedSize());
     }
 
     size_t MemoryPool::padPointer(const char* p, size_t align) {
@@ -84,15 +135,26 @@ namespace MemoryPoolV1
         return (align - reinterpret_cast<size_t>(p)) % align;
     }
 
+    Slot* MemoryPool::firstSlot(Block* block) const {
+        char* body = reinterpret_cast<char*>(block) + sizeof(Block);
+        return reinterpret_cast<Slot*>(body + padPointer(body, slot_size_));
+    }
+
+    size_t MemoryPool::numCarved(Block* block) const {
+        char* first = reinterpret_cast<char*>(firstSlot(block));
+        char* end = block == cur_block_ ? reinterpret_cast<char*>(cur_slot_) : reinterpret_cast<char*>(block) + block_size_;
+        return (end - first) / slot_size_;
+    }
+
     // TODO: 无锁队列
     bool MemoryPool::pushFreeList(Slot* slot) {
         while (true) {
             // 获取当前头节点
             auto old_head = free_list_.load(std::memory_order_relaxed);
             // 将新节点的 next 指向当前头节点（头插法）
-            slot->next.store(old_head, std::memory_order_relaxed);
+            slot->next.store(headOf(old_head), std::memory_order_relaxed);
             // 尝试将新节点设置为头节点
-            if (free_list_.compare_exchange_weak(old_head, slot,
+            if (free_list_.compare_exchange_weak(old_head, makeHead(slot, old_head),
                                                  std::memory_order_release, std::memory_order_relaxed)) {
                 return true;
             }
@@ -101,33 +163,115 @@ namespace MemoryPoolV1
         }
     }
 
+    void MemoryPool::pushFreeList(Slot* head, Slot* tail) {
+        auto old_head = free_list_.load(std::memory_order_relaxed);
+        do {
+            tail->next.store(headOf(old_head), std::memory_order_relaxed);
+        } while (!free_list_.compare_exchange_weak(old_head, makeHead(head, old_head),
+                                                   std::memory_order_release, std::memory_order_relaxed));
+    }
+
     Slot* MemoryPool::popFreeList() {
         while (true) {
             auto old_head = free_list_.load(std::memory_order_acquire);
             // 队列为空
-            if (old_head == nullptr) {
+            if (headOf(old_head) == nullptr) {
                 return nullptr;
             }
 
             // 在访问 newHead 之前再次验证 oldHead 的有效性
             Slot* new_head = nullptr;
             try {
-                new_head = old_head->next.load(std::memory_order_relaxed);
+                new_head = headOf(old_head)->next.load(std::memory_order_relaxed);
             } catch (...) {
                 // 如果返回失败，则continue重新尝试申请内存
                 continue;
             }
 
             // 尝试更新头结点
-            if (free_list_.compare_exchange_weak(old_head, new_head,
+            if (free_list_.compare_exchange_weak(old_head, makeHead(new_head, old_head),
                                                  std::memory_order_acquire, std::memory_order_relaxed)) {
-                return old_head;
+                return headOf(old_head);
             }
             // 失败：说明另一个线程可能已经修改了 freeList_
             // CAS 失败则重试
         }
     }
 
+    /**
+     * 归还所有槽都空闲的内存块。摘下整个空闲链表，统计每个内存块中的空闲槽数（内存块的存活槽数 = 已切分槽数 - 空闲槽数），
+     * 存活槽数为 0 的内存块从块链表中移除，其余空闲槽重新压回空闲链表。
+     * 摘下期间其他线程的分配会从新的内存块切分，释放的槽压入新的空闲链表，都不受影响。
+     * 被移除的内存块通过 madvise(MADV_DONTNEED) 归还物理内存，但不解除映射：其他线程可能刚刚读到旧的链表头，
+     * 被抢占任意长的时间后还会读取一次其中槽的 next 指针（读到 0 或复用后的内容，之后的 CAS 会因修改计数变化而失败）。
+     * 这些内存块挂到 retired_blocks_，开辟新的内存块时优先复用，映射的地址空间不会无限增长
+     * @return 移除的内存块数
+     */
+    size_t MemoryPool::trim() {
+        std::lock_guard<std::mutex> lock(mutex_for_block_);
+        // 1. 摘下整个空闲链表，按所属内存块统计空闲槽数
+        uint64_t old_head = free_list_.load(std::memory_order_relaxed);
+        while (!free_list_.compare_exchange_weak(old_head, makeHead(nullptr, old_head),
+                                                 std::memory_order_acquire, std::memory_order_relaxed)) {
+        }
+        Slot* list = headOf(old_head);
+        for (Block* block = first_block_; block != nullptr; block = block->next) {
+            block->num_free = 0;
+        }
+        auto blockOf = [this](Slot* slot) {
+            return reinterpret_cast<Block*>(reinterpret_cast<size_t>(slot) & ~(block_size_ - 1));
+        };
+        for (Slot* slot = list; slot != nullptr; slot = slot->next.load(std::memory_order_relaxed)) {
+            ++blockOf(slot)->num_free;
+        }
+
+        // 2. 移除存活槽数为 0 的内存块，用 num_free = 0 标记保留的内存块。移除的内存块在步骤 3 之后才归还物理内存
+        size_t num_released = 0;
+        size_t num_retired = retired_blocks_.size();
+        Block** link = &first_block_;
+        while (Block* block = *link) {
+            if (block->num_free == numCarved(block)) {
+                retired_blocks_.push_back(block);
+                *link = block->next;
+                block->num_free = 1;
+                if (block == cur_block_) {
+                    // 下一次从空闲链表以外分配时开辟新的内存块
+                    cur_block_ = nullptr;
+                    cur_slot_ = nullptr;
+                    last_slot_ = nullptr;
+                }
+                ++num_released;
+            } else {
+                block->num_free = 0;
+                link = &block->next;
+            }
+        }
+
+        // 3. 将保留的内存块中的空闲槽重新压回空闲链表
+        Slot* head = nullptr;
+        Slot* tail = nullptr;
+        for (Slot* slot = list; slot != nullptr;) {
+            Slot* next = slot->next.load(std::memory_order_relaxed);
+            if (blockOf(slot)->num_free == 0) {
+                slot->next.store(head, std::memory_order_relaxed);
+                head = slot;
+                if (tail == nullptr) {
+                    tail = slot;
+                }
+            }
+            slot = next;
+        }
+        if (head != nullptr) {
+            pushFreeList(head, tail);
+        }
+
+        // 4. 归还移除的内存块的物理内存
+        for (size_t i = num_retired; i < retired_blocks_.size(); ++i) {
+            madvise(retired_blocks_[i], mappedSize(), MADV_DONTNEED);
+        }
+        return num_released;
+    }
+
     void HashBucket::initMemoryPool() {
         for (size_t i = 0; i < MEMORY_POOL_NUM; i++) {
             getMemoryPool(i).init((i+1) * SLOT_BASE_SIZE);
@@ -139,4 +283,12 @@ namespace MemoryPoolV1
         static MemoryPool memory_pool[MEMORY_POOL_NUM];
         return memory_pool[index];
     }
-}
\ No newline at end of file
+
+    size_t HashBucket::trim() {
+        size_t num_released = 0;
+        for (size_t i = 0; i < MEMORY_POOL_NUM; i++) {
+            num_released += getMemoryPool(i).trim();
+        }
+        return num_released;
+    }
+}
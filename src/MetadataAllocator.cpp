@@ -0,0 +1,64 @@
+//
+// Created by 11361 on 25-4-23.
+//
+#include <sys/mman.h>
+#include <algorithm>
+#include "../include/MetadataAllocator.h"
+
+namespace MemoryPoolV2
+{
+
+FixedSizeAllocator::FixedSizeAllocator(size_t object_size, size_t align)
+    : free_list_(nullptr), cur_(nullptr), end_(nullptr) {
+    // 对象至少能容纳空闲链表的 next 指针，并按 align 向上取整，保证连续切分后每个对象都满足对齐要求
+    align = std::max(align, alignof(void*));
+    object_size_ = (std::max(object_size, sizeof(void*)) + align - 1) & ~(align - 1);
+}
+
+/**
+ * 分配一个对象：优先复用空闲链表，否则从当前 chunk 切分，chunk 用尽时向系统申请新的 chunk
+ * @return 对象地址，系统内存不足时返回 nullptr
+ */
+void* FixedSizeAllocator::allocate() {
+    lock();
+    void* result = free_list_;
+    if (result != nullptr) {
+        free_list_ = *reinterpret_cast<void**>(result);
+    } else {
+        if (cur_ + object_size_ > end_) {
+            // 当前 chunk 的剩余部分不足一个对象，直接丢弃
+            void* chunk = allocatePages(CHUNK_BYTES);
+            if (chunk == nullptr) {
+                unlock();
+                return nullptr;
+            }
+            cur_ = static_cast<char*>(chunk);
+            end_ = cur_ + CHUNK_BYTES;
+        }
+        result = cur_;
+        cur_ += object_size_;
+    }
+    unlock();
+    return result;
+}
+
+void FixedSizeAllocator::deallocate(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    lock();
+    *reinterpret_cast<void**>(ptr) = free_list_;
+    free_list_ = ptr;
+    unlock();
+}
+
+void* FixedSizeAllocator::allocatePages(size_t bytes) {
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+void FixedSizeAllocator::deallocatePages(void* ptr, size_t bytes) {
+    munmap(ptr, bytes);
+}
+
+}   // namespace MemoryPoolV2
@@ -2,29 +2,159 @@
 // Created by 11361 on 25-3-26.
 //
 #include <sys/mman.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <cstring>
+#include <new>
+#include <thread>
 #include "PageCache.h"
+#include "Heap.h"
+#include "Probes.h"
 
 namespace MemoryPoolV2
 {
+    PageCache& PageCache::getInstance() {
+        return Heap::getDefault().getPageCache();
+    }
+
+    __thread size_t PageCache::shard_hint_ = 0;
+
+    PageCache::~PageCache() {
+        releaseAll();
+    }
+
     void* PageCache::systemAlloc(size_t num_pages) {
         size_t total_size = num_pages * PAGE_SIZE;
-        // TODO: 使用mmap分配内存
-        void* ptr = mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        MEMORYPOOL_PROBE_SCOPE(probe, SystemMap, total_size, 0);
+        if (page_source_ != nullptr) {
+            return page_source_->mapPages(num_pages);
+        }
+        // 匿名映射的内存由内核清零；MAP_POPULATE 在映射时一次性建立页表，Span 切分和首次使用时不再触发缺页，
+        // 效果等同于映射后 memset，但无需在用户态逐字节写入
+        void* ptr = mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
         if (ptr == MAP_FAILED) {
             return nullptr;
         }
-        // 清零内存
-        memset(ptr, 0, total_size);
         return ptr;
     }
 
+    void PageCache::systemFree(void* ptr, size_t num_pages) {
+        if (page_source_ != nullptr) {
+            page_source_->unmapPages(ptr, num_pages);
+        } else {
+            munmap(ptr, num_pages * PAGE_SIZE);
+        }
+    }
+
+    /**
+     * 对一段内存预先触发缺页，使其在之后的访问中不再发生缺页。只会读写 [ptr, ptr + bytes) 范围内的字节（写回原值），
+     * 因此可以用于与其他线程的内存块共享页面的小块
+     * @param ptr
+     * @param bytes
+     */
+    void PageCache::prefault(void* ptr, size_t bytes) {
+        char* cur = static_cast<char*>(ptr);
+        char* end = cur + bytes;
+        while (cur < end) {
+            volatile char* p = cur;
+            *p = *p;
+            // 跳到下一页的起始处
+            cur = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(cur) + PAGE_SIZE) & ~(PAGE_SIZE - 1));
+        }
+    }
+
+    /**
+     * 设置映射字节数的限制。降低限制不会立即释放内存，下一次向系统映射时生效
+     * @param limits
+     */
+    void PageCache::setLimits(const MemoryLimits& limits) {
+        soft_limit_.store(limits.soft_bytes, std::memory_order_relaxed);
+        hard_limit_.store(limits.hard_bytes, std::memory_order_relaxed);
+        limit_handler_.store(limits.handler, std::memory_order_relaxed);
+        throw_on_limit_.store(limits.throw_on_failure, std::memory_order_relaxed);
+        pressure_mark_.store(limits.soft_bytes, std::memory_order_relaxed);
+    }
+
+    void PageCache::setPressureCallback(void (*callback)(void*), void* arg) {
+        pressure_callback_ = callback;
+        pressure_arg_ = arg;
+    }
+
+    /**
+     * 释放内存以缓解压力。同一时间只有一个线程执行释放，其他线程直接返回。
+     * 释放后，映射字节数需要再增长软限制的 1/16 才会触发下一次释放
+     */
+    void PageCache::relievePressure() {
+        if (releasing_.test_and_set(std::memory_order_acquire)) {
+            return;
+        }
+        if (pressure_callback_ != nullptr) {
+            pressure_callback_(pressure_arg_);
+        } else {
+            releaseFreeMemory();
+        }
+        size_t soft = soft_limit_.load(std::memory_order_relaxed);
+        pressure_mark_.store(std::max(soft, getMappedBytes() + soft / 16), std::memory_order_relaxed);
+        releasing_.clear(std::memory_order_release);
+    }
+
+    /**
+     * 向系统映射 bytes 字节之前检查限制：超过软限制时释放内存；超过硬限制时先释放内存，
+     * 仍然超过则调用用户的处理函数，处理函数返回 false（或未设置）时分配失败
+     * @param bytes 需要映射的字节数
+     * @return 允许映射时返回 true，且 bytes 已计入 mapped_bytes_，映射失败时调用者需要减去
+     */
+    bool PageCache::admitMapping(size_t bytes) {
+        size_t soft = soft_limit_.load(std::memory_order_relaxed);
+        if (soft != 0 && getMappedBytes() + bytes > pressure_mark_.load(std::memory_order_relaxed)) {
+            relievePressure();
+        }
+        bool relieved = false;
+        size_t mapped = getMappedBytes();
+        while (true) {
+            size_t hard = hard_limit_.load(std::memory_order_relaxed);
+            if (hard == 0 || mapped + bytes <= hard) {
+                if (mapped_bytes_.compare_exchange_weak(mapped, mapped + bytes, std::memory_order_relaxed)) {
+                    return true;
+                }
+                continue;
+            }
+            if (!relieved) {
+                relievePressure();
+                relieved = true;
+            } else {
+                MemoryLimitHandler handler = limit_handler_.load(std::memory_order_relaxed);
+                if (handler == nullptr || !handler(bytes, mapped)) {
+                    break;
+                }
+            }
+            mapped = getMappedBytes();
+        }
+        if (throw_on_limit_.load(std::memory_order_relaxed)) {
+            throw std::bad_alloc();
+        }
+        return false;
+    }
+
     void* PageCache::allocateSpan(size_t num_pages) {
-        std::lock_guard<std::mutex> lock(mutex_);
+        // 在加锁之前开始计时，耗时包括等待 PageCache 锁的时间
+        MEMORYPOOL_PROBE_SCOPE(probe, SpanAlloc, num_pages, 0);
+        if (num_pages - 1 < SMALL_SPAN_PAGES) {
+            if (void* ptr = popShard(num_pages)) {
+                return ptr;
+            }
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
         // 1. 从freeSpans_ 中查找合适的空闲span
         auto iter = free_spans_.lower_bound(num_pages);
         if (iter != free_spans_.end()) {
             auto span = iter->second;
+            // 需要分割时先分配剩余部分的元数据，分配失败则保持空闲链表不变
+            Span* new_span = nullptr;
+            if (span->num_pages > num_pages && (new_span = MetadataAllocator<Span>::create()) == nullptr) {
+                return nullptr;
+            }
             // 2. 从空闲链表中移除选中的 Span
             if (span->next) {
                 // 如果该 Span 后面还有其他 Span，则将链表头指针指向 span->next
@@ -33,9 +163,10 @@ namespace MemoryPoolV2
                 // 从 freeSpans_ 中移除该页数对应的链表（无后继）
                 free_spans_.erase(iter);
             }
+            free_pages_ -= num_pages;
             // 3. 分割 Span（如果必要）
-            if (span->num_pages > num_pages) {
-                auto new_span = new Span;
+            if (new_span != nullptr) {
+                MEMORYPOOL_PROBE(SpanSplit, span->num_pages, span->num_pages - num_pages);
                 new_span->num_pages = span->num_pages - num_pages;
                 new_span->page_addr = static_cast<char*>(span->page_addr) + num_pages * PAGE_SIZE;
                 new_span->next = nullptr;
@@ -45,19 +176,35 @@ namespace MemoryPoolV2
                 auto list = free_spans_[new_span->num_pages];
                 new_span->next = list;
                 free_spans_[new_span->num_pages] = new_span;
+                // 剩余部分也需要记录在 span_map_ 中，否则释放前一个 Span 时无法与其合并
+                span_map_[new_span->page_addr] = new_span;
             }
             // 4. 记录span信息用于回收
             span_map_[span->page_addr] = span;
             return span->page_addr;
         }
 
-        // 没有合适的span，向系统申请
+        // 没有合适的span，向系统申请。检查限制时可能需要释放内存，不能持有锁
+        MEMORYPOOL_PROBE_SET_ARGS(probe, num_pages, 1);
+        lock.unlock();
+        if (!admitMapping(num_pages * PAGE_SIZE)) {
+            return nullptr;
+        }
         void* ptr = systemAlloc(num_pages);
         if (ptr == nullptr) {
+            mapped_bytes_.fetch_sub(num_pages * PAGE_SIZE, std::memory_order_relaxed);
+            return nullptr;
+        }
+        // 创建新的span，元数据分配失败时撤销映射
+        auto span = MetadataAllocator<Span>::create();
+        if (span == nullptr) {
+            systemFree(ptr, num_pages);
+            mapped_bytes_.fetch_sub(num_pages * PAGE_SIZE, std::memory_order_relaxed);
             return nullptr;
         }
-        // 创建新的span
-        auto span = new Span;
+        lock.lock();
+        system_spans_.emplace_back(ptr, num_pages);
+        system_pages_ += num_pages;
         span->page_addr = ptr;
         span->num_pages = num_pages;
         span->next = nullptr;
@@ -67,47 +214,463 @@ namespace MemoryPoolV2
         return span->page_addr;
     }
 
+    /**
+     * 释放 Span。小 Span 直接放入分片缓存，不查找 span_map_，之后会按 num_pages 原样分配出去，
+     * 因此调用者必须保证 ptr 是 allocateSpan 返回的地址且 num_pages 与其实际页数一致
+     * （定义 MEMORYPOOL_DEBUG_SPANS 时加锁查找 span_map_ 检查）
+     * @param ptr
+     * @param num_pages
+     */
     void PageCache::deallocateSpan(void* ptr, size_t num_pages) {
+        if (num_pages - 1 < SMALL_SPAN_PAGES) {
+#ifdef MEMORYPOOL_DEBUG_SPANS
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto iter = span_map_.find(ptr);
+                assert(iter != span_map_.end() && iter->second->num_pages == num_pages);
+            }
+#endif
+            if (pushShard(ptr, num_pages)) {
+                return;
+            }
+        }
         std::lock_guard<std::mutex> lock(mutex_);
-        // 查找对应的span，没找到代表不是PageCache分配的内存，直接返回
+        // 查找对应的span，没找到代表不是PageCache分配的内存，直接返回（只有大 Span 与分片缓存已满时才会检查）
         auto iter = span_map_.find(ptr);
         if (iter == span_map_.end()) {
             return;
         }
+        insertFreeSpan(iter->second);
+    }
+
+    /**
+     * 原地调整已分配 Span 的页数：扩大时占用紧邻其后的空闲 Span，缩小时将尾部多余的页归还为空闲 Span
+     * @param ptr       Span 起始地址
+     * @param num_pages 调整后的页数
+     * @return 调整成功返回 true；紧邻的页不空闲或不足时返回 false，Span 保持不变
+     */
+    bool PageCache::resizeSpan(void* ptr, size_t num_pages) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = span_map_.find(ptr);
+        if (iter == span_map_.end() || num_pages == 0) {
+            return false;
+        }
         auto span = iter->second;
+        if (num_pages == span->num_pages) {
+            return true;
+        }
 
-        // 尝试合并相邻的 Span
+        // 1. 缩小：将尾部拆分为新的 Span 并作为空闲 Span 回收（会与其后的空闲 Span 合并）
+        if (num_pages < span->num_pages) {
+            auto tail = MetadataAllocator<Span>::create();
+            if (tail == nullptr) {
+                return false;
+            }
+            tail->page_addr = static_cast<char*>(span->page_addr) + num_pages * PAGE_SIZE;
+            tail->num_pages = span->num_pages - num_pages;
+            tail->next = nullptr;
+            span->num_pages = num_pages;
+            span_map_[tail->page_addr] = tail;
+            insertFreeSpan(tail);
+            return true;
+        }
+
+        // 2. 扩大：紧邻的 Span 必须空闲且页数足够
+        size_t extra_pages = num_pages - span->num_pages;
         void* next_addr = static_cast<char*>(span->page_addr) + span->num_pages * PAGE_SIZE;
         auto next_it = span_map_.find(next_addr);
-        // 1. 相邻span是PageCache所分配的
-        if (next_it != span_map_.end()) {
-            auto next_span = next_it->second;
-            // 2. 检查 next_span 是否在空闲链表中（如果在则移除）
-            bool found = false;
-            auto& next_list = free_spans_[next_span->num_pages];
-            if (next_list == next_span) {   // 检查是否是头节点
-                next_list = next_span->next;
-                found = true;
-            } else if (next_list) {     // 链表不为空
-                auto pre = next_list;
-                while (pre->next) {
-                    if (pre->next == next_span) {   // 将nextSpan从空闲链表中移除
-                        pre->next = next_span->next;
-                        found = true;
-                        break;
-                    }
-                    pre = pre->next;
+        if (next_it == span_map_.end() || next_it->second->num_pages < extra_pages) {
+            return false;
+        }
+        auto next_span = next_it->second;
+        if (!removeFreeSpan(next_span)) {
+            return false;
+        }
+        span_map_.erase(next_it);
+        span->num_pages = num_pages;
+        if (next_span->num_pages > extra_pages) {
+            // 剩余部分重新作为空闲 Span
+            next_span->page_addr = static_cast<char*>(next_addr) + extra_pages * PAGE_SIZE;
+            next_span->num_pages -= extra_pages;
+            span_map_[next_span->page_addr] = next_span;
+            next_span->next = free_spans_[next_span->num_pages];
+            free_spans_[next_span->num_pages] = next_span;
+            free_pages_ += next_span->num_pages;
+        } else {
+            MetadataAllocator<Span>::destroy(next_span);
+        }
+        return true;
+    }
+
+    void* PageCache::allocateLarge(size_t size) {
+        size_t total_size = (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+        if (!admitMapping(total_size)) {
+            return nullptr;
+        }
+        void* ptr;
+        {
+            MEMORYPOOL_PROBE_SCOPE(probe, SystemMap, total_size, 1);
+            if (page_source_ != nullptr) {
+                ptr = page_source_->mapPages(total_size / PAGE_SIZE);
+            } else {
+                // 匿名映射的内存由内核清零，无需 memset
+                ptr = mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            }
+        }
+        if (ptr == nullptr || ptr == MAP_FAILED) {
+            mapped_bytes_.fetch_sub(total_size, std::memory_order_relaxed);
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        large_spans_[ptr] = total_size;
+        large_bytes_ += total_size;
+        return ptr;
+    }
+
+    void PageCache::deallocateLarge(void* ptr, size_t size) {
+        if (ptr == nullptr) {
+            return;
+        }
+        size_t total_size = (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (large_spans_.erase(ptr) == 0) {
+                return;
+            }
+            large_bytes_ -= total_size;
+        }
+        systemFree(ptr, total_size / PAGE_SIZE);
+        mapped_bytes_.fetch_sub(total_size, std::memory_order_relaxed);
+    }
+
+    /**
+     * 调整大对象的大小。页数不变时直接返回原地址，否则使用 mremap 由内核重新映射页表，避免拷贝数据
+     * @param ptr      allocateLarge 返回的地址
+     * @param old_size 原大小
+     * @param new_size 新大小
+     * @return 新地址（可能与原地址不同），失败返回 nullptr 且原内存保持不变
+     */
+    void* PageCache::reallocateLarge(void* ptr, size_t old_size, size_t new_size) {
+        size_t old_pages = (old_size + PAGE_SIZE - 1) / PAGE_SIZE;
+        size_t new_pages = (new_size + PAGE_SIZE - 1) / PAGE_SIZE;
+        if (old_pages == new_pages) {
+            return ptr;
+        }
+        // 后端的页不能 mremap，分配新的大对象并拷贝
+        if (page_source_ != nullptr) {
+            void* result = allocateLarge(new_size);
+            if (result != nullptr) {
+                memcpy(result, ptr, std::min(old_pages, new_pages) * PAGE_SIZE);
+                deallocateLarge(ptr, old_size);
+            }
+            return result;
+        }
+        // 扩大时增加的部分同样受限制
+        if (new_pages > old_pages && !admitMapping((new_pages - old_pages) * PAGE_SIZE)) {
+            return nullptr;
+        }
+        void* result = mremap(ptr, old_pages * PAGE_SIZE, new_pages * PAGE_SIZE, MREMAP_MAYMOVE);
+        if (result == MAP_FAILED) {
+            if (new_pages > old_pages) {
+                mapped_bytes_.fetch_sub((new_pages - old_pages) * PAGE_SIZE, std::memory_order_relaxed);
+            }
+            return nullptr;
+        }
+        if (new_pages < old_pages) {
+            mapped_bytes_.fetch_sub((old_pages - new_pages) * PAGE_SIZE, std::memory_order_relaxed);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        large_spans_.erase(ptr);
+        large_spans_[result] = new_pages * PAGE_SIZE;
+        large_bytes_ = large_bytes_ - old_pages * PAGE_SIZE + new_pages * PAGE_SIZE;
+        return result;
+    }
+
+    /**
+     * 一次性释放该 PageCache 映射的全部内存，时间复杂度与 Span 数量成正比。调用期间及之后不能再访问之前分配的任何内存
+     */
+    void PageCache::releaseAll() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 分片缓存中的 Span 随 span_map_ 一起销毁
+        for (auto& shards : shards_) {
+            for (SpanShard& shard : shards) {
+                shard.count.store(0, std::memory_order_relaxed);
+            }
+        }
+        shard_pages_.store(0, std::memory_order_relaxed);
+        for (auto& [addr, span] : span_map_) {
+            MetadataAllocator<Span>::destroy(span);
+        }
+        for (auto& [addr, num_pages] : system_spans_) {
+            systemFree(addr, num_pages);
+        }
+        for (auto& [addr, bytes] : large_spans_) {
+            systemFree(addr, bytes / PAGE_SIZE);
+        }
+        free_spans_.clear();
+        span_map_.clear();
+        system_spans_.clear();
+        large_spans_.clear();
+        system_pages_ = 0;
+        free_pages_ = 0;
+        large_bytes_ = 0;
+        mapped_bytes_.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * 将空闲 Span 归还给系统。不小于 RELEASE_MIN_PAGES 页的空闲 Span 直接 munmap，映射字节数随之减少；
+     * 更小的空闲 Span 保留映射，只通过 madvise(MADV_DONTNEED) 释放其物理内存，避免产生过多的映射区域
+     * @return munmap 归还给系统的字节数
+     */
+    size_t PageCache::releaseFreeMemory() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 分片缓存中的 Span 先插入空闲链表，与相邻的空闲 Span 合并后再归还
+        drainShards();
+        std::vector<Span*, MetadataStlAllocator<Span*>> spans;
+        for (auto& [num_pages, head] : free_spans_) {
+            for (Span* span = head; span != nullptr; span = span->next) {
+                spans.push_back(span);
+            }
+        }
+        size_t released_pages = 0;
+        for (Span* span : spans) {
+            if (span->num_pages < RELEASE_MIN_PAGES) {
+                // 后端的共享映射 madvise 后内容仍然保留，不会释放物理内存
+                if (page_source_ == nullptr) {
+                    madvise(span->page_addr, span->num_pages * PAGE_SIZE, MADV_DONTNEED);
+                }
+                continue;
+            }
+            removeFreeSpan(span);
+            span_map_.erase(span->page_addr);
+            systemFree(span->page_addr, span->num_pages);
+            // 空闲 Span 可能由相邻的两次映射合并而来，按地址区间更新映射记录
+            removeSystemRange(static_cast<char*>(span->page_addr), span->num_pages);
+            released_pages += span->num_pages;
+            MetadataAllocator<Span>::destroy(span);
+        }
+        system_pages_ -= released_pages;
+        mapped_bytes_.fetch_sub(released_pages * PAGE_SIZE, std::memory_order_relaxed);
+        return released_pages * PAGE_SIZE;
+    }
+
+    /**
+     * 从 system_spans_ 中去掉 [addr, addr + num_pages 页)，与之重叠的映射记录被截短或拆分，
+     * 保证 releaseAll 不会 munmap 已经归还（可能已被系统重新分配给其他用途）的地址
+     * @param addr
+     * @param num_pages
+     */
+    void PageCache::removeSystemRange(char* addr, size_t num_pages) {
+        char* end = addr + num_pages * PAGE_SIZE;
+        for (size_t i = 0; i < system_spans_.size();) {
+            char* start = static_cast<char*>(system_spans_[i].first);
+            char* stop = start + system_spans_[i].second * PAGE_SIZE;
+            if (stop <= addr || start >= end) {
+                ++i;
+                continue;
+            }
+            if (start < addr) {
+                // 保留前半部分，后半部分（如果有）作为新的记录追加到末尾
+                system_spans_[i].second = (addr - start) / PAGE_SIZE;
+                if (stop > end) {
+                    system_spans_.emplace_back(end, (stop - end) / PAGE_SIZE);
                 }
+                ++i;
+            } else if (stop > end) {
+                system_spans_[i] = std::make_pair(static_cast<void*>(end), static_cast<size_t>((stop - end) / PAGE_SIZE));
+                ++i;
+            } else {
+                system_spans_[i] = system_spans_.back();
+                system_spans_.pop_back();
+            }
+        }
+    }
+
+    PageCacheStats PageCache::getStats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t free_pages = free_pages_ + shard_pages_.load(std::memory_order_relaxed);
+        return PageCacheStats{system_pages_ * PAGE_SIZE, free_pages * PAGE_SIZE, large_bytes_, span_map_.size()};
+    }
+
+    /**
+     * 遍历所有空闲 Span，按地址排序后将首尾相接的 Span 合并为连续空闲区间，统计区间长度的分布。
+     * 持有锁期间只复制 Span 的地址与页数，排序与统计在锁外进行
+     * @return
+     */
+    FreeSpanReport PageCache::getFreeSpanReport() {
+        std::vector<std::pair<char*, size_t>, MetadataStlAllocator<std::pair<char*, size_t>>> spans;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& [num_pages, head] : free_spans_) {
+                for (Span* span = head; span != nullptr; span = span->next) {
+                    spans.emplace_back(static_cast<char*>(span->page_addr), span->num_pages);
+                }
+            }
+        }
+        std::sort(spans.begin(), spans.end());
+
+        FreeSpanReport report{};
+        report.num_free_spans = spans.size();
+        auto add_run = [&report](size_t num_pages) {
+            size_t bucket = 0;
+            while (bucket + 1 < FreeSpanReport::NUM_BUCKETS && (size_t(2) << bucket) <= num_pages) {
+                ++bucket;
+            }
+            ++report.num_free_runs;
+            report.free_pages += num_pages;
+            report.largest_free_run = std::max(report.largest_free_run, num_pages);
+            ++report.run_count[bucket];
+            report.run_pages[bucket] += num_pages;
+        };
+        size_t i = 0;
+        while (i < spans.size()) {
+            char* end = spans[i].first + spans[i].second * PAGE_SIZE;
+            size_t num_pages = spans[i].second;
+            for (++i; i < spans.size() && spans[i].first == end; ++i) {
+                end += spans[i].second * PAGE_SIZE;
+                num_pages += spans[i].second;
+            }
+            add_run(num_pages);
+        }
+        return report;
+    }
+
+    /**
+     * 将 Span 从空闲链表中移除
+     * @param span
+     * @return Span 在空闲链表中（即处于空闲状态）时返回 true
+     */
+    bool PageCache::removeFreeSpan(Span* span) {
+        // 注意不能使用 operator[]，否则会插入值为 nullptr 的空链表，导致 allocateSpan 取到空指针
+        auto list_it = free_spans_.find(span->num_pages);
+        if (list_it == free_spans_.end()) {
+            // 没有该页数的空闲链表，说明 span 正在使用中
+            return false;
+        }
+        if (list_it->second == span) {   // 检查是否是头节点
+            list_it->second = span->next;
+            if (list_it->second == nullptr) {
+                free_spans_.erase(list_it);
             }
-            // 3. 只有在空闲链表中找到 next_span 的情况下才进行合并
-            if (found) {
-                span->num_pages += next_span->num_pages;
-                span_map_.erase(next_addr);
-                delete next_span;
+            free_pages_ -= span->num_pages;
+            return true;
+        }
+        auto pre = list_it->second;
+        while (pre->next) {
+            if (pre->next == span) {   // 将 span 从空闲链表中移除
+                pre->next = span->next;
+                free_pages_ -= span->num_pages;
+                return true;
             }
+            pre = pre->next;
+        }
+        return false;
+    }
+
+    /**
+     * 将 Span 插入空闲链表，插入前尝试与紧邻其后的空闲 Span 合并
+     * @param span
+     */
+    void PageCache::insertFreeSpan(Span* span) {
+        // 尝试合并相邻的 Span
+        void* next_addr = static_cast<char*>(span->page_addr) + span->num_pages * PAGE_SIZE;
+        auto next_it = span_map_.find(next_addr);
+        // 相邻span是PageCache所分配的，且只有在空闲链表中找到 next_span 的情况下才进行合并
+        if (next_it != span_map_.end() && removeFreeSpan(next_it->second)) {
+            auto next_span = next_it->second;
+            MEMORYPOOL_PROBE(SpanCoalesce, span->num_pages, span->num_pages + next_span->num_pages);
+            span->num_pages += next_span->num_pages;
+            span_map_.erase(next_it);
+            MetadataAllocator<Span>::destroy(next_span);
         }
         // 将合并后的span通过头插法插入空闲列表
         span->next = free_spans_[span->num_pages];
         free_spans_[span->num_pages] = span;
+        free_pages_ += span->num_pages;
+    }
+
+    size_t PageCache::shardHint() {
+        if (shard_hint_ == 0) {
+            // 线程按首次使用的顺序轮流分配到各个分片
+            static std::atomic<size_t> next_hint{0};
+            shard_hint_ = next_hint.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+        return shard_hint_;
+    }
+
+    /**
+     * 从分片缓存获取 Span：从当前线程的分片开始依次尝试，跳过为空或正被其他线程持有的分片
+     * @param num_pages 不超过 SMALL_SPAN_PAGES
+     * @return Span 起始地址，没有时返回 nullptr
+     */
+    void* PageCache::popShard(size_t num_pages) {
+        size_t hint = shardHint();
+        for (size_t i = 0; i < NUM_SPAN_SHARDS; ++i) {
+            SpanShard& shard = shards_[num_pages - 1][(hint + i) % NUM_SPAN_SHARDS];
+            if (shard.count.load(std::memory_order_relaxed) == 0 || shard.lock.test_and_set(std::memory_order_acquire)) {
+                continue;
+            }
+            void* ptr = nullptr;
+            uint32_t count = shard.count.load(std::memory_order_relaxed);
+            if (count > 0) {
+                ptr = shard.spans[count - 1];
+                shard.count.store(count - 1, std::memory_order_relaxed);
+            }
+            shard.lock.clear(std::memory_order_release);
+            if (ptr != nullptr) {
+                shard_pages_.fetch_sub(num_pages, std::memory_order_relaxed);
+                return ptr;
+            }
+        }
+        return nullptr;
+    }
+
+    bool PageCache::pushShard(void* ptr, size_t num_pages) {
+        size_t hint = shardHint();
+        for (size_t i = 0; i < NUM_SPAN_SHARDS; ++i) {
+            SpanShard& shard = shards_[num_pages - 1][(hint + i) % NUM_SPAN_SHARDS];
+            if (shard.count.load(std::memory_order_relaxed) == SHARD_CAPACITY ||
+                shard.lock.test_and_set(std::memory_order_acquire)) {
+                continue;
+            }
+            uint32_t count = shard.count.load(std::memory_order_relaxed);
+            bool pushed = count < SHARD_CAPACITY;
+            if (pushed) {
+                shard.spans[count] = ptr;
+                shard.count.store(count + 1, std::memory_order_relaxed);
+            }
+            shard.lock.clear(std::memory_order_release);
+            if (pushed) {
+                shard_pages_.fetch_add(num_pages, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * 将分片缓存中的 Span 全部插入空闲链表。分片锁只在短暂的弹出/压入期间持有，这里等待其释放
+     */
+    void PageCache::drainShards() {
+        for (size_t pages = 1; pages <= SMALL_SPAN_PAGES; ++pages) {
+            for (SpanShard& shard : shards_[pages - 1]) {
+                if (shard.count.load(std::memory_order_relaxed) == 0) {
+                    continue;
+                }
+                while (shard.lock.test_and_set(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                uint32_t count = shard.count.load(std::memory_order_relaxed);
+                for (uint32_t i = 0; i < count; ++i) {
+                    auto iter = span_map_.find(shard.spans[i]);
+                    if (iter != span_map_.end()) {
+                        insertFreeSpan(iter->second);
+                    }
+                }
+                shard.count.store(0, std::memory_order_relaxed);
+                shard.lock.clear(std::memory_order_release);
+                shard_pages_.fetch_sub(count * pages, std::memory_order_relaxed);
+            }
+        }
     }
 }  // namespace MemoryPoolV2
\ No newline at end of file
@@ -0,0 +1,55 @@
+//
+// Created by 11361 on 25-4-29.
+//
+#include <new>
+#include "../include/PageMap.h"
+#include "../include/MetadataAllocator.h"
+
+namespace MemoryPoolV2
+{
+PageMap::PageMap() {
+    // 匿名映射的内存全为 0，即所有叶子节点都不存在
+    root_ = static_cast<std::atomic<Leaf*>*>(FixedSizeAllocator::allocatePages(sizeof(std::atomic<Leaf*>) * ROOT_LENGTH));
+    if (root_ == nullptr) {
+        throw std::bad_alloc();
+    }
+}
+
+PageMap::~PageMap() {
+    for (size_t i = 0; i < ROOT_LENGTH; ++i) {
+        if (Leaf* leaf = root_[i].load(std::memory_order_relaxed)) {
+            FixedSizeAllocator::deallocatePages(leaf, sizeof(Leaf));
+        }
+    }
+    FixedSizeAllocator::deallocatePages(root_, sizeof(std::atomic<Leaf*>) * ROOT_LENGTH);
+}
+
+/**
+ * 设置一段连续页的条目。叶子节点不存在时映射新的叶子节点并通过 CAS 安装，
+ * 其他线程抢先安装时释放自己映射的节点
+ * @param addr      起始地址（按页向下取整）
+ * @param num_pages 页数
+ * @param value     条目的值
+ * @return 叶子节点映射失败时返回 false
+ */
+bool PageMap::set(const void* addr, size_t num_pages, void* value) {
+    uintptr_t page = reinterpret_cast<uintptr_t>(addr) >> PAGE_SHIFT;
+    for (uintptr_t end = page + num_pages; page < end; ++page) {
+        std::atomic<Leaf*>& slot = root_[(page >> LEAF_BITS) & (ROOT_LENGTH - 1)];
+        Leaf* leaf = slot.load(std::memory_order_acquire);
+        if (leaf == nullptr) {
+            auto created = static_cast<Leaf*>(FixedSizeAllocator::allocatePages(sizeof(Leaf)));
+            if (created == nullptr) {
+                return false;
+            }
+            if (slot.compare_exchange_strong(leaf, created, std::memory_order_acq_rel)) {
+                leaf = created;
+            } else {
+                FixedSizeAllocator::deallocatePages(created, sizeof(Leaf));
+            }
+        }
+        leaf->values[page & (LEAF_LENGTH - 1)].store(value, std::memory_order_relaxed);
+    }
+    return true;
+}
+}   // namespace MemoryPoolV2
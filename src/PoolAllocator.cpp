@@ -0,0 +1,42 @@
+//
+// Created by 11361 on 25-4-16.
+//
+#include "../include/PoolAllocator.h"
+
+namespace MemoryPoolV2
+{
+
+PoolMemoryResource& PoolMemoryResource::getInstance() {
+    static PoolMemoryResource instance;
+    return instance;
+}
+
+/**
+ * 按 alignment 对齐分配 bytes 字节，失败时按 memory_resource 的约定抛出 std::bad_alloc
+ * @param bytes
+ * @param alignment 对齐要求，不能超过页大小
+ * @return
+ */
+void* PoolMemoryResource::do_allocate(size_t bytes, size_t alignment) {
+    void* ptr = alignment <= ALIGNMENT ? MemoryPool::allocate(bytes)
+                                       : MemoryPool::allocate_aligned(bytes, alignment);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void PoolMemoryResource::do_deallocate(void* ptr, size_t bytes, size_t alignment) {
+    if (alignment <= ALIGNMENT) {
+        MemoryPool::deallocate(ptr, bytes);
+    } else {
+        MemoryPool::deallocate_aligned(ptr, bytes, alignment);
+    }
+}
+
+bool PoolMemoryResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    // 所有 PoolMemoryResource 共享同一个内存池，任意一个实例分配的内存都可以由另一个实例释放
+    return dynamic_cast<const PoolMemoryResource*>(&other) != nullptr;
+}
+
+}   // namespace MemoryPoolV2
@@ -0,0 +1,130 @@
+//
+// Created by 11361 on 25-4-27.
+//
+#include <algorithm>
+#include <atomic>
+#include "../include/Probes.h"
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MEMORYPOOL_HAS_USDT 1
+#endif
+#endif
+
+namespace MemoryPoolV2
+{
+namespace
+{
+constexpr size_t NUM_EVENTS = static_cast<size_t>(ProbeEvent::Count);
+
+struct AtomicHistogram {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> total_ns;
+    std::atomic<uint64_t> max_ns;
+    std::atomic<uint64_t> buckets[LatencyHistogram::NUM_BUCKETS];
+};
+
+AtomicHistogram g_histograms[NUM_EVENTS];
+
+const char* const EVENT_NAMES[NUM_EVENTS] = {
+    "central_fetch", "central_return", "span_alloc", "span_split", "span_coalesce", "system_map", "central_lock_wait",
+};
+
+size_t bucketOf(uint64_t ns) {
+    size_t bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+    return std::min(bucket, LatencyHistogram::NUM_BUCKETS - 1);
+}
+}   // namespace
+
+/**
+ * 记录一次事件：更新直方图并触发对应的 USDT 探针。USDT 探针的名字必须是编译期常量，因此按事件分别展开
+ * @param event
+ * @param arg0  事件参数
+ * @param arg1  事件参数
+ * @param ns    耗时（瞬时事件为 0）
+ */
+void Probes::fire(ProbeEvent event, uint64_t arg0, uint64_t arg1, uint64_t ns) {
+#ifdef MEMORYPOOL_HAS_USDT
+    switch (event) {
+    case ProbeEvent::CentralFetch: DTRACE_PROBE3(memorypool, central_fetch, arg0, arg1, ns); break;
+    case ProbeEvent::CentralReturn: DTRACE_PROBE3(memorypool, central_return, arg0, arg1, ns); break;
+    case ProbeEvent::SpanAlloc: DTRACE_PROBE3(memorypool, span_alloc, arg0, arg1, ns); break;
+    case ProbeEvent::SpanSplit: DTRACE_PROBE3(memorypool, span_split, arg0, arg1, ns); break;
+    case ProbeEvent::SpanCoalesce: DTRACE_PROBE3(memorypool, span_coalesce, arg0, arg1, ns); break;
+    case ProbeEvent::SystemMap: DTRACE_PROBE3(memorypool, system_map, arg0, arg1, ns); break;
+    case ProbeEvent::CentralLockWait: DTRACE_PROBE3(memorypool, central_lock_wait, arg0, arg1, ns); break;
+    default: break;
+    }
+#else
+    (void)arg0;
+    (void)arg1;
+#endif
+    AtomicHistogram& histogram = g_histograms[static_cast<size_t>(event)];
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.total_ns.fetch_add(ns, std::memory_order_relaxed);
+    histogram.buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t max_ns = histogram.max_ns.load(std::memory_order_relaxed);
+    while (ns > max_ns && !histogram.max_ns.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed)) {
+    }
+}
+
+const char* Probes::eventName(ProbeEvent event) {
+    return static_cast<size_t>(event) < NUM_EVENTS ? EVENT_NAMES[static_cast<size_t>(event)] : "unknown";
+}
+
+LatencyHistogram Probes::getHistogram(ProbeEvent event) {
+    const AtomicHistogram& source = g_histograms[static_cast<size_t>(event)];
+    LatencyHistogram histogram{};
+    histogram.count = source.count.load(std::memory_order_relaxed);
+    histogram.total_ns = source.total_ns.load(std::memory_order_relaxed);
+    histogram.max_ns = source.max_ns.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i) {
+        histogram.buckets[i] = source.buckets[i].load(std::memory_order_relaxed);
+    }
+    return histogram;
+}
+
+void Probes::reset() {
+    for (AtomicHistogram& histogram : g_histograms) {
+        histogram.count.store(0, std::memory_order_relaxed);
+        histogram.total_ns.store(0, std::memory_order_relaxed);
+        histogram.max_ns.store(0, std::memory_order_relaxed);
+        for (auto& bucket : histogram.buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(p * count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen > target) {
+            return std::min(max_ns, (uint64_t(2) << i) - 1);
+        }
+    }
+    return max_ns;
+}
+
+void Probes::print(FILE* out) {
+    fprintf(out, "  %-18s %10s %10s %10s %10s %10s\n", "event", "count", "avg_ns", "p50_ns", "p99_ns", "max_ns");
+    for (size_t i = 0; i < NUM_EVENTS; ++i) {
+        LatencyHistogram histogram = getHistogram(static_cast<ProbeEvent>(i));
+        if (histogram.count == 0) {
+            continue;
+        }
+        fprintf(out, "  %-18s %10llu %10llu %10llu %10llu %10llu\n", EVENT_NAMES[i],
+                static_cast<unsigned long long>(histogram.count),
+                static_cast<unsigned long long>(histogram.total_ns / histogram.count),
+                static_cast<unsigned long long>(histogram.percentile(0.5)),
+                static_cast<unsigned long long>(histogram.percentile(0.99)),
+                static_cast<unsigned long long>(histogram.max_ns));
+    }
+    fflush(out);
+}
+}   // namespace MemoryPoolV2
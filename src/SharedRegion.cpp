@@ -0,0 +1,262 @@
+//
+// Created by 11361 on 25-5-3.
+//
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <thread>
+#include "../include/SharedRegion.h"
+
+namespace MemoryPoolV2
+{
+SharedRegion::~SharedRegion() {
+    close();
+}
+
+/**
+ * 创建并映射新的共享区域，初始化头部，头部页之后的所有页组成一个空闲区间
+ * @param backing
+ * @param name    memfd 的名称（只用于调试）、共享内存名称或文件路径
+ * @param bytes   区域大小（包括头部页），至少两页
+ * @return 成功返回 true
+ */
+bool SharedRegion::create(SharedBacking backing, const char* name, size_t bytes) {
+    if (header_ != nullptr) {
+        return false;
+    }
+    size_t num_pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (num_pages < 2) {
+        return false;
+    }
+    int fd;
+    switch (backing) {
+        case SharedBacking::Memfd:
+            fd = memfd_create(name, 0);
+            break;
+        case SharedBacking::Shm:
+            fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+            break;
+        default:
+            fd = ::open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            break;
+    }
+    if (fd < 0) {
+        return false;
+    }
+    // ftruncate 扩展的部分读取为 0，头部的锁与各字段都从 0 开始
+    if (ftruncate(fd, static_cast<off_t>(num_pages * PAGE_SIZE)) != 0 || !map(fd)) {
+        ::close(fd);
+        return false;
+    }
+    header_->version = VERSION;
+    header_->page_size = PAGE_SIZE;
+    header_->num_pages = num_pages;
+    header_->free_head = PAGE_SIZE;
+    header_->free_pages = num_pages - 1;
+    FreeRun* run = runAt(PAGE_SIZE);
+    run->num_pages = num_pages - 1;
+    run->next = 0;
+    // 最后写入 magic，其他进程 open 时据此判断区域已经初始化完成
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = MAGIC;
+    return true;
+}
+
+bool SharedRegion::open(SharedBacking backing, const char* name) {
+    if (header_ != nullptr || backing == SharedBacking::Memfd) {
+        return false;
+    }
+    int fd = backing == SharedBacking::Shm ? shm_open(name, O_RDWR, 0) : ::open(name, O_RDWR);
+    if (fd < 0) {
+        return false;
+    }
+    if (!map(fd)) {
+        ::close(fd);
+        return false;
+    }
+    if (!isValid()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool SharedRegion::attach(int fd) {
+    if (header_ != nullptr) {
+        return false;
+    }
+    int dup_fd = dup(fd);
+    if (dup_fd < 0) {
+        return false;
+    }
+    if (!map(dup_fd)) {
+        ::close(dup_fd);
+        return false;
+    }
+    if (!isValid()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * 按文件大小映射整个区域，不检查头部
+ * @param fd 映射成功后由 SharedRegion 持有
+ * @return 成功返回 true
+ */
+bool SharedRegion::map(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < 2 * PAGE_SIZE) {
+        return false;
+    }
+    void* ptr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    fd_ = fd;
+    base_ = static_cast<char*>(ptr);
+    size_ = st.st_size;
+    header_ = static_cast<SharedRegionHeader*>(ptr);
+    return true;
+}
+
+/**
+ * 校验已存在区域的头部，区域尚未初始化完成（magic 未写入）时同样视为无效
+ * @return 头部有效返回 true
+ */
+bool SharedRegion::isValid() const {
+    if (header_->magic != MAGIC) {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header_->version == VERSION && header_->page_size == PAGE_SIZE && header_->num_pages * PAGE_SIZE == size_;
+}
+
+void SharedRegion::close() {
+    if (header_ == nullptr) {
+        return;
+    }
+    munmap(base_, size_);
+    ::close(fd_);
+    fd_ = -1;
+    base_ = nullptr;
+    size_ = 0;
+    header_ = nullptr;
+}
+
+bool SharedRegion::remove(SharedBacking backing, const char* name) {
+    switch (backing) {
+        case SharedBacking::Shm:
+            return shm_unlink(name) == 0;
+        case SharedBacking::File:
+            return unlink(name) == 0;
+        default:
+            return false;
+    }
+}
+
+size_t SharedRegion::allocate(size_t bytes) {
+    if (bytes == 0) {
+        return 0;
+    }
+    return allocatePages((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+void SharedRegion::deallocate(size_t offset, size_t bytes) {
+    if (offset == 0) {
+        return;
+    }
+    deallocatePages(offset, (bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+size_t SharedRegion::getFreeBytes() const {
+    return header_->free_pages * PAGE_SIZE;
+}
+
+void* SharedRegion::mapPages(size_t num_pages) {
+    size_t offset = allocatePages(num_pages);
+    return offset == 0 ? nullptr : toPointer(offset);
+}
+
+void SharedRegion::unmapPages(void* ptr, size_t num_pages) {
+    deallocatePages(toOffset(ptr), num_pages);
+}
+
+/**
+ * 首次适配：从第一个足够大的空闲区间头部切下 num_pages 页，剩余部分留在原位置
+ * @param num_pages
+ * @return 偏移，空间不足时返回 0
+ */
+size_t SharedRegion::allocatePages(size_t num_pages) {
+    lock();
+    uint64_t* link = &header_->free_head;
+    while (*link != 0) {
+        uint64_t offset = *link;
+        FreeRun* run = runAt(offset);
+        if (run->num_pages >= num_pages) {
+            if (run->num_pages == num_pages) {
+                *link = run->next;
+            } else {
+                uint64_t rest = offset + num_pages * PAGE_SIZE;
+                FreeRun* rest_run = runAt(rest);
+                rest_run->num_pages = run->num_pages - num_pages;
+                rest_run->next = run->next;
+                *link = rest;
+            }
+            header_->free_pages -= num_pages;
+            unlock();
+            return offset;
+        }
+        link = &run->next;
+    }
+    unlock();
+    return 0;
+}
+
+/**
+ * 将 [offset, offset + num_pages 页) 按偏移顺序插入空闲区间链表，并与首尾相接的前后区间合并
+ * @param offset
+ * @param num_pages
+ */
+void SharedRegion::deallocatePages(size_t offset, size_t num_pages) {
+    lock();
+    uint64_t prev = 0;
+    uint64_t next = header_->free_head;
+    while (next != 0 && next < offset) {
+        prev = next;
+        next = runAt(next)->next;
+    }
+    FreeRun* run = runAt(offset);
+    run->num_pages = num_pages;
+    run->next = next;
+    // 1. 与后一个区间合并
+    if (next != 0 && offset + num_pages * PAGE_SIZE == next) {
+        run->num_pages += runAt(next)->num_pages;
+        run->next = runAt(next)->next;
+    }
+    // 2. 与前一个区间合并，否则链接到前一个区间之后
+    if (prev != 0 && prev + runAt(prev)->num_pages * PAGE_SIZE == offset) {
+        runAt(prev)->num_pages += run->num_pages;
+        runAt(prev)->next = run->next;
+    } else if (prev != 0) {
+        runAt(prev)->next = offset;
+    } else {
+        header_->free_head = offset;
+    }
+    header_->free_pages += num_pages;
+    unlock();
+}
+
+// 持有锁的进程异常退出会使其他进程一直等待，临界区内只修改链表，不调用任何可能失败的函数
+void SharedRegion::lock() {
+    while (header_->lock.exchange(1, std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+}
+
+void SharedRegion::unlock() {
+    header_->lock.store(0, std::memory_order_release);
+}
+}   // namespace MemoryPoolV2
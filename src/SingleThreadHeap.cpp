@@ -0,0 +1,171 @@
+//
+// Created by 11361 on 25-5-5.
+//
+#include <algorithm>
+#include <cstring>
+#include "../include/SingleThreadHeap.h"
+#include "../include/CentralCache.h"
+
+namespace MemoryPoolV2
+{
+SingleThreadHeap& SingleThreadHeap::getDefault() {
+    // 与默认堆相同，永不析构
+    static SingleThreadHeap* instance = new SingleThreadHeap();
+    return *instance;
+}
+
+void* SingleThreadHeap::allocateSlow(size_t size) {
+    if (size > MAX_BYTES) {
+        return page_cache_.allocateLarge(size);
+    }
+    size_t index = SizeClass::getIndex(size);
+    if (!refill(index)) {
+        return nullptr;
+    }
+    char* ptr = unused_[index];
+    unused_[index] = ptr + SizeClass::classSize(index);
+    return ptr;
+}
+
+/**
+ * 获取与中心缓存相同页数的 Span 作为新的切分区域。旧 Span 中不足一个块的尾部被丢弃
+ * @param index 大小类别
+ * @return 成功返回 true
+ */
+bool SingleThreadHeap::refill(size_t index) {
+    size_t size = SizeClass::classSize(index);
+    size_t num_pages = CentralCache::spanPages(size);
+    auto span = static_cast<char*>(page_cache_.allocateSpan(num_pages));
+    if (span == nullptr) {
+        return false;
+    }
+    unused_[index] = span;
+    unused_end_[index] = span + num_pages * PageCache::PAGE_SIZE / size * size;
+    return true;
+}
+
+/**
+ * 按 align 对齐分配内存。与 ThreadCache 相同，Span 按页对齐且块等距切分，
+ * 将 size 向上取整到 align 的倍数后分配即可保证对齐
+ * @param size
+ * @param align 必须为 2 的幂且不超过页大小
+ * @return 内存地址，对齐要求非法时返回 nullptr
+ */
+void* SingleThreadHeap::allocateAligned(size_t size, size_t align) {
+    if (align == 0 || (align & (align - 1)) != 0 || align > PageCache::PAGE_SIZE) {
+        return nullptr;
+    }
+    return allocate(SizeClass::alignedSize(size, align));
+}
+
+void SingleThreadHeap::deallocateAligned(void* ptr, size_t size, size_t align) {
+    if (ptr == nullptr) {
+        return;
+    }
+    deallocate(ptr, SizeClass::alignedSize(size, align));
+}
+
+size_t SingleThreadHeap::allocateBatch(size_t size, size_t n, void** out) {
+    if (size == 0) {
+        size = ALIGNMENT;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if ((out[i] = allocate(size)) == nullptr) {
+            return i;
+        }
+    }
+    return n;
+}
+
+void SingleThreadHeap::deallocateBatch(void** ptrs, size_t n, size_t size) {
+    for (size_t i = 0; i < n; ++i) {
+        deallocate(ptrs[i], size);
+    }
+}
+
+/**
+ * 调整内存块大小。同一大小类别直接返回原地址；独占 Span 的块（每个 Span 只切分出一个块，块地址即 Span 地址）
+ * 通过 PageCache 原地扩缩页数，之后按新大小释放到新类别的自由链表；大对象之间通过 PageCache 重新映射，其余情况分配新块并拷贝
+ * @param ptr      为 nullptr 时等价于 allocate(new_size)
+ * @param old_size
+ * @param new_size
+ * @return 新地址，失败返回 nullptr 且原内存块保持不变
+ */
+void* SingleThreadHeap::reallocate(void* ptr, size_t old_size, size_t new_size) {
+    if (ptr == nullptr) {
+        return allocate(new_size);
+    }
+    old_size = std::max(old_size, ALIGNMENT);
+    new_size = std::max(new_size, ALIGNMENT);
+    if (old_size <= MAX_BYTES && new_size <= MAX_BYTES) {
+        size_t old_index = SizeClass::getIndex(old_size);
+        size_t new_index = SizeClass::getIndex(new_size);
+        if (old_index == new_index) {
+            return ptr;
+        }
+        if (CentralCache::isPageLevel(old_index) && CentralCache::isPageLevel(new_index)) {
+            size_t num_pages = (SizeClass::classSize(new_index) + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+            if (page_cache_.resizeSpan(ptr, num_pages)) {
+                return ptr;
+            }
+        }
+    } else if (old_size > MAX_BYTES && new_size > MAX_BYTES) {
+        return page_cache_.reallocateLarge(ptr, old_size, new_size);
+    }
+    void* result = allocate(new_size);
+    if (result == nullptr) {
+        return nullptr;
+    }
+    memcpy(result, ptr, std::min(old_size, new_size));
+    deallocate(ptr, old_size);
+    return result;
+}
+
+/**
+ * 保证该大小类别至少有 count 个可以直接分配的块（自由链表中的块与当前 Span 中未切分的块），
+ * 不足时预先切分新的 Span 并触发缺页
+ * @param size
+ * @param count
+ * @return 可以直接分配的块数；大对象返回 0
+ */
+size_t SingleThreadHeap::reserve(size_t size, size_t count) {
+    if (size == 0) {
+        size = ALIGNMENT;
+    }
+    if (size > MAX_BYTES) {
+        return 0;
+    }
+    size_t index = SizeClass::getIndex(size);
+    size_t block_size = SizeClass::classSize(index);
+    size_t num_free = 0;
+    for (void* cur = free_list_[index]; cur != nullptr && num_free < count; cur = *reinterpret_cast<void**>(cur)) {
+        ++num_free;
+    }
+    // 未切分的部分逐个压入自由链表，新 Span 同样如此，保证预留的块都已触发缺页
+    while (num_free < count) {
+        if (unused_[index] == unused_end_[index] && !refill(index)) {
+            break;
+        }
+        char* block = unused_[index];
+        unused_[index] = block + block_size;
+        PageCache::prefault(block, block_size);
+        *reinterpret_cast<void**>(block) = free_list_[index];
+        free_list_[index] = block;
+        ++num_free;
+    }
+    return num_free;
+}
+
+void SingleThreadHeap::prewarm(const WarmupProfile& profile) {
+    for (const auto& [size, count] : profile) {
+        reserve(size, count);
+    }
+}
+
+void SingleThreadHeap::destroy() {
+    free_list_.fill(nullptr);
+    unused_.fill(nullptr);
+    unused_end_.fill(nullptr);
+    page_cache_.releaseAll();
+}
+}   // namespace MemoryPoolV2
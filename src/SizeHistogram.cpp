@@ -0,0 +1,40 @@
+//
+// Created by 11361 on 25-4-24.
+//
+#include <cstdio>
+#include "../include/SizeHistogram.h"
+
+namespace MemoryPoolV2
+{
+std::atomic<uint64_t> SizeHistogram::counts_[SizeHistogram::NUM_BUCKETS];
+
+/**
+ * 将直方图写入文件，每行为“大小 次数”，可作为 size_class_gen 的输入
+ * @param path 输出文件路径
+ * @return 写入成功返回 true
+ */
+bool SizeHistogram::dump(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) {
+        return false;
+    }
+    fprintf(file, "# size count\n");
+    for (size_t bucket = 0; bucket + 1 < NUM_BUCKETS; ++bucket) {
+        uint64_t count = counts_[bucket].load(std::memory_order_relaxed);
+        if (count != 0) {
+            fprintf(file, "%zu %llu\n", (bucket + 1) * ALIGNMENT, static_cast<unsigned long long>(count));
+        }
+    }
+    return fclose(file) == 0;
+}
+
+uint64_t SizeHistogram::largeCount() {
+    return counts_[NUM_BUCKETS - 1].load(std::memory_order_relaxed);
+}
+
+void SizeHistogram::reset() {
+    for (auto& count : counts_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+}   // namespace MemoryPoolV2
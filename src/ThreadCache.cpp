@@ -1,12 +1,50 @@
 //
 // Created by 11361 on 25-3-26.
 //
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include "../include/ThreadCache.h"
 #include "../include/CentralCache.h"
+#include "../include/PageCache.h"
+#include "../include/Heap.h"
 #include "ThreadCache.h"
 
 namespace MemoryPoolV2
 {
+namespace
+{
+/**
+ * 使进程内所有正在运行的线程执行一次完整的内存屏障（未运行的线程在切换时已经执行过），
+ * 所有者线程的快速路径因此只需要编译器屏障
+ * @return 系统不支持 MEMBARRIER_CMD_PRIVATE_EXPEDITED 时返回 false
+ */
+bool processWideBarrier() {
+    static const bool registered = syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+    return registered && syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) == 0;
+}
+}   // namespace
+
+// 不经过内联快速路径的操作（批量分配/释放、预留）：进入时标记 BUSY 并处理挂起的请求，离开时标记 TOUCHED
+struct ThreadCache::SlowOperation {
+    explicit SlowOperation(ThreadCache& cache) : cache(cache) {
+        cache.beginOperation();
+        if (cache.onSlowPath()) {
+            cache.flush();
+        }
+    }
+    ~SlowOperation() {
+        cache.endOperation();
+    }
+    ThreadCache& cache;
+};
+
+ThreadCache& ThreadCache::getInstance() {
+    return Heap::defaultThreadCache();
+}
 
 /**
  * 通过从中心缓存批量获取内存块，将其中一个返回给调用者，其余的内存块插入到线程本地的自由链表中
@@ -15,33 +53,23 @@ namespace MemoryPoolV2
  */
 void* ThreadCache::fetchFromCentralCache(size_t index) {
     // 根据对象内存大小计算批量获取的数量
-    size_t size = (index + 1) * ALIGNMENT;
+    size_t size = SizeClass::classSize(index);
     size_t num_batch = getBatchNum(size);
 
     // 从中心缓存批量获取内存
-    void* start = CentralCache::getInstance().fetchRange(index, num_batch);
+    void* start = central_cache_.fetchRange(index, num_batch);
     if (start == nullptr) {
         return nullptr;
     }
-    // // 取一个返回，其余放入自由链表
-    // void* result = start;
-    // free_list_[index] = *reinterpret_cast<void**>(start);
-    // // 计算从中心缓存获取的内存块数量
-    // size_t num_batch = 0;
-    // void* cur = start;
-    // while (cur) {
-    //     num_batch++;
-    //     cur = *reinterpret_cast<void**>(cur);
-    // }
-
-    // 更新freeListSize_，增加获取的内存块数量
-    free_list_size_[index] += num_batch;
-    // 取一个返回，其余放入线程本地自由链表
-    void* result = start;
-    if (num_batch > 1) {
-        free_list_[index] = *reinterpret_cast<void**>(start);
+    // 中心缓存中剩余的块可能少于 num_batch，按实际获取的数量更新 free_list_size_
+    size_t num_fetched = 1;
+    for (void* cur = *reinterpret_cast<void**>(start); cur != nullptr; cur = *reinterpret_cast<void**>(cur)) {
+        ++num_fetched;
     }
-    return result;
+    // 取一个返回，其余放入线程本地自由链表
+    free_list_size_[index] += num_fetched - 1;
+    free_list_[index] = *reinterpret_cast<void**>(start);
+    return start;
 }
 
 /**
@@ -52,8 +80,6 @@ void* ThreadCache::fetchFromCentralCache(size_t index) {
 void ThreadCache::returnToCentralCache(void* start, size_t size) {
     // 根据大小计算对应的索引
     size_t index = SizeClass::getIndex(size);
-    // 获取对齐后的实际块大小
-    size_t aligned_size = SizeClass::roundUp(size);
 
     // 计算要归还内存块数量
     size_t num_batch = free_list_size_[index];
@@ -86,9 +112,107 @@ void ThreadCache::returnToCentralCache(void* start, size_t size) {
         free_list_size_[index] = num_keep;
         // 将剩余部分返回给 CentralCache
         if (num_return > 0 && next_node != nullptr) {
-            CentralCache::getInstance().returnRange(next_node, num_return * aligned_size, index);
+            central_cache_.returnRange(next_node, num_return, index);
+        }
+    }
+}
+
+void ThreadCache::collectCachedBlocks(size_t* counts) const {
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        // 所有者线程可能正在修改，按原子方式读取得到近似值
+        counts[index] += __atomic_load_n(&free_list_size_[index], __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * 将线程本地缓存中所有的内存块归还给中心缓存
+ */
+void ThreadCache::flush() {
+    releaseCached(false, false);
+}
+
+bool ThreadCache::releaseCached(bool keep_reserved, bool try_lock) {
+    bool complete = true;
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        if (free_list_[index] == nullptr || (keep_reserved && free_list_limit_[index] != 0)) {
+            continue;
         }
+        if (try_lock) {
+            if (!central_cache_.tryReturnRange(free_list_[index], free_list_size_[index], index)) {
+                complete = false;
+                continue;
+            }
+        } else {
+            central_cache_.returnRange(free_list_[index], free_list_size_[index], index);
+        }
+        free_list_[index] = nullptr;
+        free_list_size_[index] = 0;
     }
+    return complete;
+}
+
+/**
+ * 将线程本地缓存中所有的内存块归还给中心缓存，并清除挂起的裁剪请求。归还的内存块可以被其他线程复用
+ */
+void ThreadCache::trim() {
+    beginOperation();
+    onSlowPath();
+    flush();
+    endOperation();
+}
+
+void ThreadCache::requestTrim() {
+    // 回收进行中时不覆盖 CONTROL_RECLAIM，回收结束后不再需要裁剪
+    uint8_t control = CONTROL_NONE;
+    control_.compare_exchange_strong(control, CONTROL_TRIM, std::memory_order_relaxed);
+}
+
+/**
+ * 所有者线程进入慢速路径时调用：其他线程正在回收时等待其结束（回收不会等待所有者线程，不会死锁），
+ * 并取走挂起的裁剪请求
+ * @return 有挂起的裁剪请求时返回 true
+ */
+bool ThreadCache::onSlowPath() {
+    uint8_t control = control_.load(std::memory_order_acquire);
+    while (control != CONTROL_NONE) {
+        if (control == CONTROL_RECLAIM) {
+            std::this_thread::yield();
+            control = control_.load(std::memory_order_acquire);
+        } else if (control_.compare_exchange_weak(control, CONTROL_NONE, std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * 回收其他线程的缓存：先将 control_ 设置为 CONTROL_RECLAIM，经过进程范围的内存屏障后再读取 activity_。
+ * 所有者线程在操作自由链表之前写入 BUSY 再读取 control_，因此要么回收方看到 BUSY 而放弃，
+ * 要么所有者线程看到 CONTROL_RECLAIM 而在慢速路径上等待，双方不会同时修改自由链表。
+ * 所有者线程可能在等待，回收方因此不能等待中心缓存的锁：正被占用的类别跳过，留到下一次回收
+ * （持有类别锁的线程可能正因软限制调用 Heap::releaseMemory，等待回收方持有的堆锁）
+ * @param only_if_idle 只回收自上一次扫描以来没有操作过的线程缓存
+ * @return 所有类别（reserve 的类别除外）都已归还时返回 true
+ */
+bool ThreadCache::tryReclaim(bool only_if_idle) {
+    uint8_t control = control_.load(std::memory_order_relaxed);
+    if (control == CONTROL_RECLAIM ||
+        !control_.compare_exchange_strong(control, CONTROL_RECLAIM, std::memory_order_acq_rel)) {
+        return false;
+    }
+    bool reclaimed = false;
+    if (processWideBarrier()) {
+        uint8_t activity = activity_.load(std::memory_order_acquire);
+        if (activity == ACTIVITY_IDLE || (!only_if_idle && activity == ACTIVITY_TOUCHED)) {
+            reclaimed = releaseCached(true, true);
+        }
+    } else {
+        // 无法直接回收，退化为由所有者线程在下一次分配/释放时裁剪
+        control = CONTROL_TRIM;
+    }
+    // 恢复之前的裁剪请求（回收期间所有者线程不会修改 control_）
+    control_.store(control, std::memory_order_release);
+    return reclaimed;
 }
 
 /**
@@ -97,7 +221,7 @@ void ThreadCache::returnToCentralCache(void* start, size_t size) {
  * @return
  */
 bool ThreadCache::shouldReturnToCentralCache(size_t index) {
-    return free_list_size_[index] > threshold_;
+    return free_list_size_[index] > std::max<size_t>(threshold_, free_list_limit_[index]);
 }
 
 /**
@@ -122,54 +246,271 @@ size_t ThreadCache::getBatchNum(size_t size)
     size_t maxNum = std::max(size_t(1), MAX_BATCH_SIZE / size);
 
     // 取最小值，但确保至少返回1
-    return std::max(sizeof(1), std::min(maxNum, num_batch));
+    return std::max(size_t(1), std::min(maxNum, num_batch));
 }
 
 /**
- * 从线程本地缓存（ThreadCache）中分配指定大小的内存块。如果线程本地缓存中没有可用的内存块，则从中心缓存（CentralCache）获取一批内存块
+ * 分配的慢速路径：大对象直接从系统分配；线程本地自由链表为空时从中心缓存（CentralCache）获取一批内存块
  * @param size
  * @return
  */
-void* ThreadCache::allocate(size_t size) {
-    if (size == 0) {
-        size = ALIGNMENT;   // 至少分配一个对齐大小
+void* ThreadCache::allocateSlow(size_t size) {
+    if (onSlowPath()) {
+        flush();
     }
     // 大对象直接从系统分配
     if (size > MAX_BYTES) {
-        return malloc(size);
+        return page_cache_.allocateLarge(size);
     }
-    // 计算索引并更新自由链表大小
+    // 因裁剪/回收请求进入慢速路径时自由链表可能不为空
     size_t index = SizeClass::getIndex(size);
-    free_list_size_[index]--;
-    // 检查线程本地自由链表
     if (void* ptr = free_list_[index]) {
-        // 将链表头指针后移一位
         free_list_[index] = *reinterpret_cast<void**>(ptr);
+        free_list_size_[index]--;
         return ptr;
     }
-    // 如果线程本地自由链表为空，则从中心缓存获取一批内存
+    // 如果线程本地自由链表为空，则从中心缓存获取一批内存（size 为 0 时按一个对齐大小分配）
     return fetchFromCentralCache(index);
 }
 
 /**
- * 将不再使用的内存块归还给线程本地缓存（ThreadCache），并且在必要时将部分内存块从线程本地缓存归还给中心缓存（CentralCache）
+ * 释放的慢速路径：大对象直接归还给系统；小对象插入线程本地自由链表（有裁剪请求时随其他内存块一起归还），
+ * 链表长度超过阈值时将部分内存块归还给中心缓存（CentralCache）
  * @param ptr
  * @param size
  */
-void ThreadCache::deallocate(void* ptr, size_t size) {
+void ThreadCache::deallocateSlow(void* ptr, size_t size) {
+    bool trim_requested = onSlowPath();
+    if (size > MAX_BYTES) {
+        page_cache_.deallocateLarge(ptr, size);
+    } else {
+        size_t index = SizeClass::getIndex(size);
+        *reinterpret_cast<void**>(ptr) = free_list_[index];
+        free_list_[index] = ptr;
+        if (++free_list_size_[index] > threshold_) {
+            returnExcess(index);
+        }
+    }
+    if (trim_requested) {
+        flush();
+    }
+}
+
+void ThreadCache::returnExcess(size_t index) {
+    // 判断是否需要将部分内存回收给中心缓存（reserve 可能提高了该大小类别的上限）
+    if (shouldReturnToCentralCache(index)) {
+        returnToCentralCache(free_list_[index], SizeClass::classSize(index));
+    }
+}
+
+/**
+ * 批量分配 n 个大小为 size 的内存块：先从线程本地自由链表整段摘取，不足部分直接向中心缓存按需批量获取，
+ * 每个大小类别只需计算一次索引、每次 fetchRange 只需加锁一次
+ * @param size 每个内存块的大小
+ * @param n    需要分配的数量
+ * @param out  用于保存结果的数组，至少能容纳 n 个指针
+ * @return 实际分配的数量，小于 n 说明内存不足
+ */
+size_t ThreadCache::allocateBatch(size_t size, size_t n, void** out) {
+#ifdef MEMORYPOOL_SIZE_STATS
+    SizeHistogram::record(size, n);
+#endif
+    SlowOperation operation(*this);
+    if (size == 0) {
+        size = ALIGNMENT;
+    }
+    if (size > MAX_BYTES) {
+        for (size_t i = 0; i < n; ++i) {
+            if ((out[i] = page_cache_.allocateLarge(size)) == nullptr) {
+                return i;
+            }
+        }
+        return n;
+    }
+    size_t index = SizeClass::getIndex(size);
+    size_t count = 0;
+
+    // 1. 从线程本地自由链表中摘取
+    void* cur = free_list_[index];
+    while (cur != nullptr && count < n) {
+        out[count++] = cur;
+        cur = *reinterpret_cast<void**>(cur);
+    }
+    free_list_[index] = cur;
+    free_list_size_[index] -= count;
+
+    // 2. 不足的部分直接从中心缓存获取，不经过线程本地自由链表
+    while (count < n) {
+        void* start = central_cache_.fetchRange(index, n - count);
+        if (start == nullptr) {
+            break;
+        }
+        for (cur = start; cur != nullptr && count < n; cur = *reinterpret_cast<void**>(cur)) {
+            out[count++] = cur;
+        }
+    }
+    return count;
+}
+
+/**
+ * 批量释放 n 个大小为 size 的内存块：线程本地缓存中最多保留 threshold_ 个，超出部分串成一条链表一次性归还给中心缓存
+ * @param ptrs 需要释放的内存块数组
+ * @param n    数量
+ * @param size 每个内存块的大小
+ */
+void ThreadCache::deallocateBatch(void** ptrs, size_t n, size_t size) {
+    if (n == 0) {
+        return;
+    }
+    SlowOperation operation(*this);
     if (size > MAX_BYTES) {
-        free(ptr);
+        for (size_t i = 0; i < n; ++i) {
+            page_cache_.deallocateLarge(ptrs[i], size);
+        }
         return;
     }
-    // 将内存块插入线程本地自由链表
     size_t index = SizeClass::getIndex(size);
-    *reinterpret_cast<void**>(ptr) = free_list_[index];
-    free_list_[index] = ptr;
-    free_list_size_[index]++;
-    // 判断是否需要将部分内存回收给中心缓存
-    if (shouldReturnToCentralCache(index)) {
-        returnToCentralCache(free_list_[index], size);
+    size_t num_keep = free_list_size_[index] < threshold_ ? std::min(n, threshold_ - free_list_size_[index]) : 0;
+
+    // 1. 保留的部分插入线程本地自由链表
+    for (size_t i = 0; i < num_keep; ++i) {
+        *reinterpret_cast<void**>(ptrs[i]) = free_list_[index];
+        free_list_[index] = ptrs[i];
     }
+    free_list_size_[index] += num_keep;
+
+    // 2. 超出的部分串成链表归还给中心缓存
+    if (num_keep < n) {
+        for (size_t i = num_keep; i + 1 < n; ++i) {
+            *reinterpret_cast<void**>(ptrs[i]) = ptrs[i + 1];
+        }
+        *reinterpret_cast<void**>(ptrs[n - 1]) = nullptr;
+        central_cache_.returnRange(ptrs[num_keep], n - num_keep, index);
+    }
+}
+
+/**
+ * 预先准备 count 个内存块：直接从中心缓存批量获取（中心缓存为空时由 PageCache 分配并切分新的 Span），
+ * 对跨页的内存块逐页触发缺页，然后放入线程本地自由链表
+ * @param size  内存块大小
+ * @param count 需要准备的数量
+ * @return 线程本地缓存中该大小类别的内存块数量（内存不足时可能小于 count）；大对象不经过线程缓存，返回 0
+ */
+size_t ThreadCache::reserve(size_t size, size_t count) {
+    SlowOperation operation(*this);
+    if (size == 0) {
+        size = ALIGNMENT;
+    }
+    if (size > MAX_BYTES) {
+        return 0;
+    }
+    size_t index = SizeClass::getIndex(size);
+    size_t block_size = SizeClass::classSize(index);
+    free_list_limit_[index] = static_cast<uint32_t>(std::min<size_t>(
+        std::max<size_t>(free_list_limit_[index], count), UINT32_MAX));
+
+    while (free_list_size_[index] < count) {
+        void* start = central_cache_.fetchRange(index, count - free_list_size_[index]);
+        if (start == nullptr) {
+            break;
+        }
+        // 小于一页的块在切分时已写入 next 指针，所在页均已触发缺页
+        void* cur = start;
+        void* tail = start;
+        size_t num = 0;
+        while (cur != nullptr) {
+            if (block_size >= PageCache::PAGE_SIZE) {
+                PageCache::prefault(cur, block_size);
+            }
+            tail = cur;
+            cur = *reinterpret_cast<void**>(cur);
+            ++num;
+        }
+        *reinterpret_cast<void**>(tail) = free_list_[index];
+        free_list_[index] = start;
+        free_list_size_[index] += num;
+    }
+    return free_list_size_[index];
+}
+
+void ThreadCache::prewarm(const WarmupProfile& profile) {
+    for (const auto& [size, count] : profile) {
+        reserve(size, count);
+    }
+}
+
+/**
+ * 按 align 对齐分配内存。将 size 向上取整到 align 的倍数后按普通大小类别分配，
+ * 由于块在页对齐的 Span 中等距切分，得到的块天然按 align 对齐，额外开销不超过 align - 1 字节
+ * @param size  需要分配的字节数
+ * @param align 对齐要求，必须为 2 的幂且不超过页大小
+ * @return 内存地址，对齐要求非法时返回 nullptr
+ */
+void* ThreadCache::allocateAligned(size_t size, size_t align) {
+    if (align == 0 || (align & (align - 1)) != 0 || align > PageCache::PAGE_SIZE) {
+        return nullptr;
+    }
+    size_t aligned_size = SizeClass::alignedSize(size, align);
+    // 大对象直接通过 mmap 分配，天然按页对齐
+    return allocate(aligned_size);
+}
+
+/**
+ * 释放通过 allocateAligned 分配的内存
+ * @param ptr
+ * @param size  分配时传入的字节数
+ * @param align 分配时传入的对齐要求
+ */
+void ThreadCache::deallocateAligned(void* ptr, size_t size, size_t align) {
+    if (ptr == nullptr) {
+        return;
+    }
+    deallocate(ptr, SizeClass::alignedSize(size, align));
+}
+
+/**
+ * 调整内存块大小。新旧大小属于同一大小类别时直接返回原地址；独占 Span 的块通过 PageCache 原地扩缩页数；
+ * 大对象通过 mremap 调整；其余情况分配新块、拷贝数据并释放旧块
+ * @param ptr      原内存块地址，为 nullptr 时等价于 allocate(new_size)
+ * @param old_size 分配时的字节数
+ * @param new_size 新的字节数
+ * @return 新地址，失败返回 nullptr 且原内存块保持不变
+ */
+void* ThreadCache::reallocate(void* ptr, size_t old_size, size_t new_size) {
+    if (ptr == nullptr) {
+        return allocate(new_size);
+    }
+    old_size = std::max(old_size, ALIGNMENT);
+    new_size = std::max(new_size, ALIGNMENT);
+
+    if (old_size <= MAX_BYTES && new_size <= MAX_BYTES) {
+        size_t old_index = SizeClass::getIndex(old_size);
+        size_t new_index = SizeClass::getIndex(new_size);
+        // 1. 仍在同一大小类别中
+        if (old_index == new_index) {
+            return ptr;
+        }
+        // 2. 块独占一个 Span，直接调整 Span 的页数（释放时按新大小归还到新的大小类别）
+        if (CentralCache::isPageLevel(old_index) && CentralCache::isPageLevel(new_index)) {
+            size_t num_pages = (SizeClass::classSize(new_index) + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
+            if (page_cache_.resizeSpan(ptr, num_pages)) {
+                central_cache_.moveBlock(ptr, old_index, new_index);
+                return ptr;
+            }
+        }
+    } else if (old_size > MAX_BYTES && new_size > MAX_BYTES) {
+        // 3. 大对象使用 mremap
+        return page_cache_.reallocateLarge(ptr, old_size, new_size);
+    }
+
+    // 4. 分配新块并拷贝数据
+    void* result = allocate(new_size);
+    if (result == nullptr) {
+        return nullptr;
+    }
+    memcpy(result, ptr, std::min(old_size, new_size));
+    deallocate(ptr, old_size);
+    return result;
 }
 
 }   // namespace MemoryPoolV2
\ No newline at end of file
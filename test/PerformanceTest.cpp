@@ -2,16 +2,106 @@
 // Created by 11361 on 25-3-27.
 //
 #include "../include/MemoryPool.h"
+#include "../include/Arena.h"
+#include "../include/PoolAllocator.h"
+#include "../include/Probes.h"
+#include "../include/DeferredFree.h"
+#include "../include/SingleThreadHeap.h"
 #include <iostream>
 #include <vector>
 #include <chrono>
 #include <random>
 #include <iomanip>
 #include <thread>
+#include <algorithm>
+#include <map>
+#include <list>
+#include <unordered_map>
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include "../include/CoroutineFrame.h"
+#define MEMORYPOOL_HAS_COROUTINES 1
+#endif
 
 using namespace MemoryPoolV2;
 using namespace std::chrono;
 
+#ifdef MEMORYPOOL_HAS_COROUTINES
+// 使用全局 operator new 分配协程帧的 promise 基类
+struct DefaultPromise {};
+
+// 下一个要恢复的协程。协程之间不直接恢复对方，而是由 reportPingPong 的循环依次恢复，
+// 避免 -O0 下没有尾调用时对称转移使栈不断增长
+std::coroutine_handle<> g_ready;
+
+// 可以被 co_await 的协程任务，PromiseBase 决定协程帧的分配方式。
+// 初始挂起，被等待时调度该协程，结束时调度等待者
+template<typename PromiseBase>
+struct PingTask
+{
+    struct promise_type : PromiseBase
+    {
+        int value = 0;
+        std::coroutine_handle<> continuation;
+
+        PingTask get_return_object() { return PingTask{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+            void await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                g_ready = h.promise().continuation;
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(int v) { value = v; }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit PingTask(std::coroutine_handle<promise_type> h) : handle(h) {}
+    PingTask(PingTask&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+    PingTask(const PingTask&) = delete;
+    ~PingTask()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> awaiting)
+    {
+        handle.promise().continuation = awaiting;
+        g_ready = handle;
+    }
+    int await_resume() { return handle.promise().value; }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+template<typename PromiseBase>
+PingTask<PromiseBase> pong(int value)
+{
+    co_return value + 1;
+}
+
+// 每一轮创建一个新的 pong 协程并等待其结果，即每轮分配与释放一个协程帧
+template<typename PromiseBase>
+PingTask<PromiseBase> ping(int num_rounds)
+{
+    int sum = 0;
+    for (int i = 0; i < num_rounds; ++i)
+    {
+        sum += co_await pong<PromiseBase>(i) - i;
+    }
+    co_return sum;
+}
+#endif
+
 // 计时器类
 class Timer
 {
@@ -298,6 +388,440 @@ public:
                       << t.elapsed() << " ms" << std::endl;
         }
     }
+
+    // 5. 请求级批量释放测试（Arena）
+    static void testArenaAllocation()
+    {
+        constexpr size_t NUM_REQUESTS = 1000;
+        constexpr size_t ALLOCS_PER_REQUEST = 1000;
+        const size_t SIZES[] = {16, 24, 32, 48, 64, 96, 128, 256};
+
+        std::cout << "\nTesting request-scoped allocations (" << NUM_REQUESTS << " requests, "
+                  << ALLOCS_PER_REQUEST << " allocations each):" << std::endl;
+
+        // 测试内存池：逐个释放
+        {
+            Timer t;
+            std::vector<std::pair<void*, size_t>> ptrs;
+            ptrs.reserve(ALLOCS_PER_REQUEST);
+
+            for (size_t r = 0; r < NUM_REQUESTS; ++r)
+            {
+                for (size_t i = 0; i < ALLOCS_PER_REQUEST; ++i)
+                {
+                    size_t size = SIZES[i % 8];
+                    ptrs.emplace_back(MemoryPool::allocate(size), size);
+                }
+                for (const auto& [ptr, size] : ptrs)
+                {
+                    MemoryPool::deallocate(ptr, size);
+                }
+                ptrs.clear();
+            }
+
+            std::cout << "Memory Pool: " << std::fixed << std::setprecision(3)
+                      << t.elapsed() << " ms" << std::endl;
+        }
+
+        // 测试 Arena：请求结束时整体 reset
+        {
+            Timer t;
+            Arena arena;
+
+            for (size_t r = 0; r < NUM_REQUESTS; ++r)
+            {
+                for (size_t i = 0; i < ALLOCS_PER_REQUEST; ++i)
+                {
+                    arena.allocate(SIZES[i % 8]);
+                }
+                arena.reset();
+            }
+
+            std::cout << "Arena: " << std::fixed << std::setprecision(3)
+                      << t.elapsed() << " ms" << std::endl;
+        }
+
+        // 测试new/delete
+        {
+            Timer t;
+            std::vector<void*> ptrs;
+            ptrs.reserve(ALLOCS_PER_REQUEST);
+
+            for (size_t r = 0; r < NUM_REQUESTS; ++r)
+            {
+                for (size_t i = 0; i < ALLOCS_PER_REQUEST; ++i)
+                {
+                    ptrs.push_back(new char[SIZES[i % 8]]);
+                }
+                for (void* ptr : ptrs)
+                {
+                    delete[] static_cast<char*>(ptr);
+                }
+                ptrs.clear();
+            }
+
+            std::cout << "New/Delete: " << std::fixed << std::setprecision(3)
+                      << t.elapsed() << " ms" << std::endl;
+        }
+    }
+
+    // 6. 批量分配测试
+    static void testBatchAllocation()
+    {
+        constexpr size_t NUM_ROUNDS = 1000;
+        constexpr size_t BATCH = 1000;
+        constexpr size_t SIZE = 48;
+
+        std::cout << "\nTesting batch allocations (" << NUM_ROUNDS << " rounds of "
+                  << BATCH << " x " << SIZE << " bytes):" << std::endl;
+
+        std::vector<void*> ptrs(BATCH);
+
+        // 逐个分配
+        {
+            Timer t;
+            for (size_t r = 0; r < NUM_ROUNDS; ++r)
+            {
+                for (size_t i = 0; i < BATCH; ++i)
+                {
+                    ptrs[i] = MemoryPool::allocate(SIZE);
+                }
+                for (size_t i = 0; i < BATCH; ++i)
+                {
+                    MemoryPool::deallocate(ptrs[i], SIZE);
+                }
+            }
+            std::cout << "Memory Pool (single): " << std::fixed << std::setprecision(3)
+                      << t.elapsed() << " ms" << std::endl;
+        }
+
+        // 批量分配
+        {
+            Timer t;
+            for (size_t r = 0; r < NUM_ROUNDS; ++r)
+            {
+                MemoryPool::allocate_batch(SIZE, BATCH, ptrs.data());
+                MemoryPool::deallocate_batch(ptrs.data(), BATCH, SIZE);
+            }
+            std::cout << "Memory Pool (batch): " << std::fixed << std::setprecision(3)
+                      << t.elapsed() << " ms" << std::endl;
+        }
+    }
+
+    // 7. 多线程多大小类别测试：每个线程使用相邻的不同大小类别，且每轮的分配量超过线程缓存上限，频繁访问中心缓存
+    static void testMultiClassCentral()
+    {
+        constexpr size_t NUM_THREADS = 8;
+        constexpr size_t NUM_ROUNDS = 2000;
+        constexpr size_t BLOCKS_PER_ROUND = 256;
+
+        std::cout << "\nTesting multi-class central cache traffic (" << NUM_THREADS << " threads, adjacent size classes, "
+                  << NUM_ROUNDS << " rounds of " << BLOCKS_PER_ROUND << " blocks):" << std::endl;
+
+        auto threadFunc = [](size_t size)
+        {
+            std::vector<void*> ptrs(BLOCKS_PER_ROUND);
+            for (size_t r = 0; r < NUM_ROUNDS; ++r)
+            {
+                for (size_t i = 0; i < BLOCKS_PER_ROUND; ++i)
+                {
+                    ptrs[i] = MemoryPool::allocate(size);
+                }
+                for (size_t i = 0; i < BLOCKS_PER_ROUND; ++i)
+                {
+                    MemoryPool::deallocate(ptrs[i], size);
+                }
+            }
+        };
+
+        Timer t;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < NUM_THREADS; ++i)
+        {
+            threads.emplace_back(threadFunc, (i + 1) * ALIGNMENT);
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        std::cout << "Memory Pool: " << std::fixed << std::setprecision(3)
+                  << t.elapsed() << " ms" << std::endl;
+    }
+
+    // 8. 容器插入/删除/查找混合测试
+    static void testContainerChurn()
+    {
+        constexpr int NUM_KEYS = 100000;
+        constexpr int NUM_ROUNDS = 5;
+
+        std::cout << "\nTesting container churn (" << NUM_KEYS << " keys, "
+                  << NUM_ROUNDS << " rounds of insert/lookup/erase):" << std::endl;
+
+        using PoolPair = PoolAllocator<std::pair<const int, int>>;
+        std::pmr::memory_resource* resource = &PoolMemoryResource::getInstance();
+
+        std::cout << "std::map" << std::endl;
+        {
+            std::map<int, int> m;
+            reportChurn("New/Delete", mapChurn(m, NUM_KEYS, NUM_ROUNDS));
+        }
+        {
+            std::map<int, int, std::less<int>, PoolPair> m;
+            reportChurn("PoolAllocator", mapChurn(m, NUM_KEYS, NUM_ROUNDS));
+        }
+        {
+            std::pmr::map<int, int> m(resource);
+            reportChurn("pmr Pool", mapChurn(m, NUM_KEYS, NUM_ROUNDS));
+        }
+
+        std::cout << "std::unordered_map" << std::endl;
+        {
+            std::unordered_map<int, int> m;
+            reportChurn("New/Delete", mapChurn(m, NUM_KEYS, NUM_ROUNDS));
+        }
+        {
+            std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, PoolPair> m;
+            reportChurn("PoolAllocator", mapChurn(m, NUM_KEYS, NUM_ROUNDS));
+        }
+        {
+            std::pmr::unordered_map<int, int> m(resource);
+            reportChurn("pmr Pool", mapChurn(m, NUM_KEYS, NUM_ROUNDS));
+        }
+
+        std::cout << "std::list" << std::endl;
+        {
+            std::list<int> l;
+            reportChurn("New/Delete", listChurn(l, NUM_KEYS, NUM_ROUNDS));
+        }
+        {
+            std::list<int, PoolAllocator<int>> l;
+            reportChurn("PoolAllocator", listChurn(l, NUM_KEYS, NUM_ROUNDS));
+        }
+        {
+            std::pmr::list<int> l(resource);
+            reportChurn("pmr Pool", listChurn(l, NUM_KEYS, NUM_ROUNDS));
+        }
+    }
+
+    // 9. 释放延迟测试：逐次记录释放耗时，对比直接释放与延迟释放的 p99.9 与最大值
+    static void testFreeLatency()
+    {
+        constexpr size_t NUM_ROUNDS = 200;
+        constexpr size_t BLOCKS_PER_ROUND = 512;
+        constexpr size_t SIZE = 64;
+
+        std::cout << "\nTesting per-free latency (" << NUM_ROUNDS << " rounds of "
+                  << BLOCKS_PER_ROUND << " blocks, " << SIZE << " bytes):" << std::endl;
+
+        auto measure = [](bool deferred)
+        {
+            std::vector<double> latencies;
+            std::thread worker([&latencies, deferred]()
+            {
+                if (deferred)
+                {
+                    DeferredFree::enable(BLOCKS_PER_ROUND * 2);
+                }
+                std::vector<void*> ptrs(BLOCKS_PER_ROUND);
+                latencies.reserve(NUM_ROUNDS * BLOCKS_PER_ROUND);
+                for (size_t r = 0; r < NUM_ROUNDS; ++r)
+                {
+                    for (size_t i = 0; i < BLOCKS_PER_ROUND; ++i)
+                    {
+                        ptrs[i] = MemoryPool::allocate(SIZE);
+                    }
+                    for (size_t i = 0; i < BLOCKS_PER_ROUND; ++i)
+                    {
+                        auto start = high_resolution_clock::now();
+                        if (deferred)
+                        {
+                            DeferredFree::deallocate(ptrs[i], SIZE);
+                        }
+                        else
+                        {
+                            MemoryPool::deallocate(ptrs[i], SIZE);
+                        }
+                        latencies.push_back(duration<double, std::nano>(high_resolution_clock::now() - start).count());
+                    }
+                }
+            });
+            if (deferred)
+            {
+                DeferredReclaimer reclaimer(milliseconds(1));
+                worker.join();
+            }
+            else
+            {
+                worker.join();
+            }
+            std::sort(latencies.begin(), latencies.end());
+            return std::make_pair(latencies[latencies.size() * 999 / 1000], latencies.back());
+        };
+
+        auto direct = measure(false);
+        auto deferred = measure(true);
+        std::cout << std::fixed << std::setprecision(0)
+                  << "Direct free:   p99.9 " << direct.first << " ns, max " << direct.second << " ns\n"
+                  << "Deferred free: p99.9 " << deferred.first << " ns, max " << deferred.second << " ns" << std::endl;
+    }
+
+    // 10. 单线程堆测试：同一单线程负载分别在多线程分层结构（Heap）与单线程堆上运行
+    static void testSingleThreadHeap()
+    {
+        constexpr size_t NUM_ROUNDS = 50;
+        constexpr size_t NUM_ALLOCS = 20000;
+
+        std::cout << "\nTesting single-threaded heap (" << NUM_ROUNDS << " rounds of "
+                  << NUM_ALLOCS << " mixed-size allocations):" << std::endl;
+
+        std::vector<size_t> sizes(NUM_ALLOCS);
+        std::mt19937 gen(7);
+        std::uniform_int_distribution<size_t> dist(8, 512);
+        for (size_t& size : sizes)
+        {
+            size = dist(gen);
+        }
+
+        Heap heap;
+        SingleThreadHeap single_heap;
+        double heap_time = singleThreadChurn(heap, sizes, NUM_ROUNDS);
+        double single_time = singleThreadChurn(single_heap, sizes, NUM_ROUNDS);
+        std::cout << "Heap (thread/central tiers): " << std::fixed << std::setprecision(3)
+                  << heap_time << " ms" << std::endl;
+        std::cout << "SingleThreadHeap: " << std::fixed << std::setprecision(3)
+                  << single_time << " ms" << std::endl;
+    }
+
+#ifdef MEMORYPOOL_HAS_COROUTINES
+    // 11. 协程 ping-pong 测试：对比全局 operator new、MemoryPool 与协程帧缓存分配协程帧
+    static void testCoroutinePingPong()
+    {
+        constexpr int NUM_ROUNDS = 1000000;
+
+        std::cout << "\nTesting coroutine ping-pong (" << NUM_ROUNDS << " short-lived coroutine frames):" << std::endl;
+
+        reportPingPong<DefaultPromise>("New/Delete", NUM_ROUNDS);
+        reportPingPong<PooledPromise>("Memory Pool", NUM_ROUNDS);
+        reportPingPong<RecycledPromise>("Frame cache", NUM_ROUNDS);
+    }
+#endif
+
+private:
+    static void reportChurn(const char* name, double ms)
+    {
+        std::cout << "  " << name << ": " << std::fixed << std::setprecision(3)
+                  << ms << " ms" << std::endl;
+    }
+
+#ifdef MEMORYPOOL_HAS_COROUTINES
+    template<typename PromiseBase>
+    static void reportPingPong(const char* name, int num_rounds)
+    {
+        Timer t;
+        PingTask<PromiseBase> task = ping<PromiseBase>(num_rounds);
+        g_ready = task.handle;
+        while (g_ready)
+        {
+            std::coroutine_handle<> next = g_ready;
+            g_ready = nullptr;
+            next.resume();
+        }
+        double elapsed = t.elapsed();
+        if (task.handle.promise().value != num_rounds)
+        {
+            std::cerr << "unexpected ping-pong result" << std::endl;
+        }
+        std::cout << name << ": " << std::fixed << std::setprecision(3) << elapsed << " ms" << std::endl;
+    }
+#endif
+
+    // 每轮：按 sizes 依次分配，释放其中一半后再释放剩余部分
+    template<typename HeapType>
+    static double singleThreadChurn(HeapType& heap, const std::vector<size_t>& sizes, size_t num_rounds)
+    {
+        std::vector<void*> ptrs(sizes.size());
+        Timer t;
+        for (size_t r = 0; r < num_rounds; ++r)
+        {
+            for (size_t i = 0; i < sizes.size(); ++i)
+            {
+                ptrs[i] = heap.allocate(sizes[i]);
+            }
+            for (size_t i = 0; i < sizes.size(); i += 2)
+            {
+                heap.deallocate(ptrs[i], sizes[i]);
+            }
+            for (size_t i = 1; i < sizes.size(); i += 2)
+            {
+                heap.deallocate(ptrs[i], sizes[i]);
+            }
+        }
+        return t.elapsed();
+    }
+
+    // 每轮：插入全部键、查找全部键、删除一半键、再删除剩余的键
+    template<typename Map>
+    static double mapChurn(Map& m, int num_keys, int num_rounds)
+    {
+        std::vector<int> keys(num_keys);
+        for (int i = 0; i < num_keys; ++i)
+        {
+            keys[i] = i;
+        }
+        std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+        Timer t;
+        size_t hits = 0;
+        for (int r = 0; r < num_rounds; ++r)
+        {
+            for (int k : keys)
+            {
+                m.emplace(k, k);
+            }
+            for (int k : keys)
+            {
+                hits += m.count(k);
+            }
+            for (int i = 0; i < num_keys; i += 2)
+            {
+                m.erase(keys[i]);
+            }
+            for (int i = 1; i < num_keys; i += 2)
+            {
+                m.erase(keys[i]);
+            }
+        }
+        double elapsed = t.elapsed();
+        if (hits != static_cast<size_t>(num_keys) * num_rounds)
+        {
+            std::cerr << "unexpected lookup result" << std::endl;
+        }
+        return elapsed;
+    }
+
+    // 每轮：尾部插入全部元素，从中间交替删除，再清空
+    template<typename List>
+    static double listChurn(List& l, int num_elems, int num_rounds)
+    {
+        Timer t;
+        for (int r = 0; r < num_rounds; ++r)
+        {
+            for (int i = 0; i < num_elems; ++i)
+            {
+                l.push_back(i);
+            }
+            for (auto it = l.begin(); it != l.end();)
+            {
+                it = l.erase(it);
+                if (it != l.end())
+                {
+                    ++it;
+                }
+            }
+            l.clear();
+        }
+        return t.elapsed();
+    }
 };
 
 int main()
@@ -309,8 +833,29 @@ int main()
 
     // 运行测试
     PerformanceTest::testSmallAllocation();
+#ifndef MEMORYPOOL_SINGLE_THREADED
     PerformanceTest::testMultiThreaded();
+#endif
     PerformanceTest::testMixedSizes();
+    PerformanceTest::testArenaAllocation();
+    PerformanceTest::testBatchAllocation();
+#ifndef MEMORYPOOL_SINGLE_THREADED
+    PerformanceTest::testMultiClassCentral();
+#endif
+    PerformanceTest::testContainerChurn();
+#ifndef MEMORYPOOL_SINGLE_THREADED
+    PerformanceTest::testFreeLatency();
+#endif
+    PerformanceTest::testSingleThreadHeap();
+#ifdef MEMORYPOOL_HAS_COROUTINES
+    PerformanceTest::testCoroutinePingPong();
+#endif
+
+#ifdef MEMORYPOOL_PROBES
+    // 慢速路径事件的次数与延迟分布
+    std::cout << "\nSlow path events:" << std::endl;
+    Probes::print(stdout);
+#endif
 
     return 0;
 }
\ No newline at end of file
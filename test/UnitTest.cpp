@@ -1,12 +1,33 @@
 #include "../include/MemoryPool.h"
+#include "../include/Arena.h"
+#include "../include/PoolAllocator.h"
+#include "../include/Heap.h"
+#include "../include/MetadataAllocator.h"
+#include "../include/SizeHistogram.h"
+#include "../include/AllocTrace.h"
+#include "../include/HeapReporter.h"
+#include "../include/Probes.h"
+#include "../include/CacheScavenger.h"
+#include "../include/CachedObjectPool.h"
+#include "../include/DeferredFree.h"
+#include "../include/SharedRegion.h"
+#include "../include/SingleThreadHeap.h"
+#include "../include/CoroutineFrame.h"
 #include <iostream>
 #include <vector>
 #include <thread>
 #include <cassert>
 #include <cstring>
+#include <cstdio>
+#include <string>
 #include <random>
 #include <algorithm>
 #include <atomic>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace MemoryPoolV2;
 
@@ -182,6 +203,1540 @@ void testStress()
     std::cout << "Stress test passed!" << std::endl;
 }
 
+// Arena 测试
+void testArena()
+{
+    std::cout << "Running arena test..." << std::endl;
+
+    Arena arena(1);
+    // 对齐检查
+    void* p1 = arena.allocate(3);
+    void* p2 = arena.allocate(64, 64);
+    assert(p1 != nullptr && p2 != nullptr);
+    assert((reinterpret_cast<uintptr_t>(p2) & 63) == 0);
+
+    // 嵌套检查点
+    Arena::Checkpoint outer = arena.checkpoint();
+    void* p3 = arena.allocate(100);
+    Arena::Checkpoint inner = arena.checkpoint();
+    void* p4 = arena.allocate(200);
+    arena.rewind(inner);
+    assert(arena.allocate(200) == p4);
+    arena.rewind(outer);
+    assert(arena.allocate(100) == p3);
+
+    // 跨越多个 chunk 的分配以及大于 chunk 的分配
+    std::vector<char*> ptrs;
+    for (int i = 0; i < 1000; ++i)
+    {
+        char* p = static_cast<char*>(arena.allocate(48));
+        assert(p != nullptr);
+        memset(p, i & 0xff, 48);
+        ptrs.push_back(p);
+    }
+    for (int i = 0; i < 1000; ++i)
+    {
+        assert(ptrs[i][0] == static_cast<char>(i & 0xff) && ptrs[i][47] == static_cast<char>(i & 0xff));
+    }
+    void* big = arena.allocate(3 * 4096);
+    assert(big != nullptr);
+    memset(big, 0, 3 * 4096);
+
+    // reset 后复用已申请的 Span，不再向 PageCache 申请
+    size_t reserved = arena.bytesReserved();
+    arena.reset();
+    assert(arena.bytesUsed() == 0);
+    assert(arena.allocate(3) == p1);
+    for (int i = 0; i < 1000; ++i)
+    {
+        arena.allocate(48);
+    }
+    assert(arena.bytesReserved() == reserved);
+
+    // release 后所有 Span 归还给 PageCache，Arena 仍可继续使用
+    arena.release();
+    assert(arena.bytesReserved() == 0);
+    assert(arena.allocate(16) != nullptr);
+
+    std::cout << "Arena test passed!" << std::endl;
+}
+
+// 对齐分配测试
+void testAlignedAllocation()
+{
+    std::cout << "Running aligned allocation test..." << std::endl;
+
+    auto isAligned = [](void* p, size_t align) {
+        return (reinterpret_cast<uintptr_t>(p) & (align - 1)) == 0;
+    };
+
+    // 默认大小类别中 16/64 的整数倍类别天然对齐；生成的大小类别不保证这一点
+#ifndef MEMORYPOOL_SIZE_CLASS_HEADER
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 100; ++i)
+    {
+        void* p48 = MemoryPool::allocate(48);
+        void* p192 = MemoryPool::allocate(192);
+        assert(isAligned(p48, 16));
+        assert(isAligned(p192, 64));
+        ptrs.push_back(p48);
+        ptrs.push_back(p192);
+    }
+    for (size_t i = 0; i < ptrs.size(); i += 2)
+    {
+        MemoryPool::deallocate(ptrs[i], 48);
+        MemoryPool::deallocate(ptrs[i + 1], 192);
+    }
+#endif
+
+    // 各种对齐要求，包括大于 MAX_BYTES 的大对象
+    for (size_t align : {8, 16, 32, 64, 128, 1024, 4096})
+    {
+        for (size_t size : {size_t(0), size_t(1), size_t(24), size_t(40), size_t(100), size_t(5000), MAX_BYTES + 1})
+        {
+            std::vector<void*> blocks;
+            for (int i = 0; i < 10; ++i)
+            {
+                void* p = MemoryPool::allocate_aligned(size, align);
+                assert(p != nullptr);
+                assert(isAligned(p, align));
+                memset(p, 0xab, size);
+                blocks.push_back(p);
+            }
+            for (void* p : blocks)
+            {
+                MemoryPool::deallocate_aligned(p, size, align);
+            }
+        }
+    }
+
+    // 非法的对齐要求
+    assert(MemoryPool::allocate_aligned(64, 48) == nullptr);
+    assert(MemoryPool::allocate_aligned(64, 8192) == nullptr);
+
+    std::cout << "Aligned allocation test passed!" << std::endl;
+}
+
+// 内存块大小调整测试
+void testReallocate()
+{
+    std::cout << "Running reallocate test..." << std::endl;
+
+    auto fill = [](void* p, size_t size) {
+        for (size_t i = 0; i < size; ++i)
+        {
+            static_cast<unsigned char*>(p)[i] = static_cast<unsigned char>(i * 7);
+        }
+    };
+    auto check = [](void* p, size_t size) {
+        for (size_t i = 0; i < size; ++i)
+        {
+            if (static_cast<unsigned char*>(p)[i] != static_cast<unsigned char>(i * 7))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // 同一大小类别内调整，返回原地址
+    void* p = MemoryPool::allocate(20);
+    assert(MemoryPool::reallocate(p, 20, 24) == p);
+    assert(MemoryPool::reallocate(p, 24, 17) == p);
+
+    // 小块增长为页级块，再增长为大对象，最后缩回小块，数据保持不变
+    fill(p, 17);
+    void* q = MemoryPool::reallocate(p, 17, 40 * 1024);
+    assert(q != nullptr && check(q, 17));
+    fill(q, 40 * 1024);
+    void* r = MemoryPool::reallocate(q, 40 * 1024, MAX_BYTES * 4);
+    assert(r != nullptr && check(r, 40 * 1024));
+    fill(r, MAX_BYTES * 4);
+    void* s = MemoryPool::reallocate(r, MAX_BYTES * 4, MAX_BYTES * 16);
+    assert(s != nullptr && check(s, MAX_BYTES * 4));
+    void* t = MemoryPool::reallocate(s, MAX_BYTES * 16, 100);
+    assert(t != nullptr && check(t, 100));
+    MemoryPool::deallocate(t, 100);
+
+    // 页级块原地缩小后再原地扩大（释放出的尾页紧邻原块）
+    const size_t PAGE = 4096;
+    void* page_block = MemoryPool::allocate(36 * PAGE);
+    fill(page_block, 32 * PAGE);
+    assert(MemoryPool::reallocate(page_block, 36 * PAGE, 33 * PAGE) == page_block);
+    assert(MemoryPool::reallocate(page_block, 33 * PAGE, 32 * PAGE) == page_block);
+    assert(MemoryPool::reallocate(page_block, 32 * PAGE, 36 * PAGE) == page_block);
+    assert(check(page_block, 32 * PAGE));
+    MemoryPool::deallocate(page_block, 36 * PAGE);
+
+    // nullptr 等价于 allocate
+    void* n = MemoryPool::reallocate(nullptr, 0, 64);
+    assert(n != nullptr);
+    MemoryPool::deallocate(n, 64);
+
+    std::cout << "Reallocate test passed!" << std::endl;
+}
+
+// STL 分配器与 pmr 内存资源测试
+void testStlAdapters()
+{
+    std::cout << "Running STL adapters test..." << std::endl;
+
+    // PoolAllocator
+    std::map<int, int, std::less<int>, PoolAllocator<std::pair<const int, int>>> m;
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, PoolAllocator<std::pair<const int, int>>> um;
+    std::list<int, PoolAllocator<int>> l;
+    for (int i = 0; i < 10000; ++i)
+    {
+        m[i] = i * 2;
+        um[i] = i * 3;
+        l.push_back(i);
+    }
+    for (int i = 0; i < 10000; i += 2)
+    {
+        m.erase(i);
+        um.erase(i);
+    }
+    l.remove_if([](int v) { return v % 2 == 0; });
+    assert(m.size() == 5000 && um.size() == 5000 && l.size() == 5000);
+    for (int i = 1; i < 10000; i += 2)
+    {
+        assert(m.at(i) == i * 2 && um.at(i) == i * 3);
+    }
+
+    // 过对齐类型
+    struct alignas(64) Counter { long value; };
+    std::vector<Counter, PoolAllocator<Counter>> counters(100);
+    assert((reinterpret_cast<uintptr_t>(counters.data()) & 63) == 0);
+
+    // pmr 容器
+    std::pmr::memory_resource* resource = &PoolMemoryResource::getInstance();
+    std::pmr::map<int, std::pmr::string> pm(resource);
+    for (int i = 0; i < 1000; ++i)
+    {
+        pm.emplace(i, std::pmr::string(100, static_cast<char>('a' + i % 26)));
+    }
+    assert(pm.at(27)[99] == 'b');
+    void* p = resource->allocate(100, 256);
+    assert((reinterpret_cast<uintptr_t>(p) & 255) == 0);
+    resource->deallocate(p, 100, 256);
+
+    PoolMemoryResource other;
+    assert(resource->is_equal(other));
+    assert(!resource->is_equal(*std::pmr::new_delete_resource()));
+
+    std::cout << "STL adapters test passed!" << std::endl;
+}
+
+// 批量分配/释放测试
+void testBatchAllocation()
+{
+    std::cout << "Running batch allocation test..." << std::endl;
+
+    for (size_t size : {size_t(8), size_t(32), size_t(200), size_t(4096), size_t(40 * 1024), MAX_BYTES + 1})
+    {
+        const size_t n = size > 4096 ? 20 : 1000;
+        std::vector<void*> ptrs(n);
+        size_t got = MemoryPool::allocate_batch(size, n, ptrs.data());
+        assert(got == n);
+
+        // 每个块互不重叠且可写
+        for (size_t i = 0; i < n; ++i)
+        {
+            assert(ptrs[i] != nullptr);
+            memset(ptrs[i], static_cast<int>(i & 0xff), size);
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            assert(static_cast<unsigned char*>(ptrs[i])[size - 1] == (i & 0xff));
+        }
+        std::vector<void*> sorted = ptrs;
+        std::sort(sorted.begin(), sorted.end());
+        assert(std::unique(sorted.begin(), sorted.end()) == sorted.end());
+
+        MemoryPool::deallocate_batch(ptrs.data(), n, size);
+    }
+
+    // 批量释放的块可以被单独分配复用，单独分配的块也可以批量释放
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 100; ++i)
+    {
+        ptrs.push_back(MemoryPool::allocate(64));
+    }
+    MemoryPool::deallocate_batch(ptrs.data(), ptrs.size(), 64);
+    for (int i = 0; i < 100; ++i)
+    {
+        ptrs[i] = MemoryPool::allocate(64);
+        assert(ptrs[i] != nullptr);
+    }
+    for (void* p : ptrs)
+    {
+        MemoryPool::deallocate(p, 64);
+    }
+
+    std::cout << "Batch allocation test passed!" << std::endl;
+}
+
+// 多堆隔离测试
+void testHeaps()
+{
+    std::cout << "Running heaps test..." << std::endl;
+
+    Heap heap_a;
+    Heap heap_b;
+
+    // 每个堆独立向系统申请内存
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 1000; ++i)
+    {
+        void* p = heap_a.allocate(128);
+        assert(p != nullptr);
+        memset(p, 0x5a, 128);
+        ptrs.push_back(p);
+    }
+    void* large = heap_a.allocate(MAX_BYTES * 2);
+    assert(large != nullptr);
+    HeapStats stats_a = heap_a.getStats();
+    HeapStats stats_b = heap_b.getStats();
+    assert(stats_a.system_bytes > 0 && stats_a.large_bytes >= MAX_BYTES * 2);
+    assert(stats_a.num_thread_caches == 1);
+    assert(stats_b.system_bytes == 0 && stats_b.num_thread_caches == 0);
+
+    // 其他线程使用堆时创建各自的线程缓存，线程退出时注销
+    std::thread worker([&heap_b]() {
+        std::vector<void*> blocks;
+        for (int i = 0; i < 1000; ++i)
+        {
+            blocks.push_back(heap_b.allocate(64));
+        }
+        assert(heap_b.getStats().num_thread_caches == 1);
+        for (void* p : blocks)
+        {
+            heap_b.deallocate(p, 64);
+        }
+    });
+    worker.join();
+    assert(heap_b.getStats().num_thread_caches == 0);
+    assert(heap_b.getStats().system_bytes > 0);
+
+    // destroy 一次性释放整个堆，其他堆不受影响
+    heap_a.destroy();
+    stats_a = heap_a.getStats();
+    assert(stats_a.system_bytes == 0 && stats_a.large_bytes == 0 && stats_a.num_spans == 0);
+    assert(stats_a.num_thread_caches == 0);
+    assert(heap_b.getStats().system_bytes > 0);
+
+    // 销毁后的堆可以继续使用
+    void* p = heap_a.allocate(128);
+    assert(p != nullptr);
+    heap_a.deallocate(p, 128);
+    assert(heap_a.getStats().num_thread_caches == 1);
+
+    // 堆析构后槽位可以被新的堆复用
+    {
+        Heap heap_c;
+        heap_c.allocate(32);
+    }
+    Heap heap_d;
+    void* q = heap_d.allocate(32);
+    assert(q != nullptr);
+    heap_d.deallocate(q, 32);
+
+    std::cout << "Heaps test passed!" << std::endl;
+}
+
+// 元数据分配器测试
+void testMetadataAllocator()
+{
+    std::cout << "Running metadata allocator test..." << std::endl;
+
+    struct alignas(32) Meta { char data[40]; };
+    FixedSizeAllocator allocator(sizeof(Meta), alignof(Meta));
+
+    // 跨越多个 chunk，每个对象满足对齐要求且互不重叠
+    std::vector<void*> objs;
+    for (size_t i = 0; i < 3 * FixedSizeAllocator::CHUNK_BYTES / sizeof(Meta); ++i)
+    {
+        void* p = allocator.allocate();
+        assert(p != nullptr);
+        assert((reinterpret_cast<uintptr_t>(p) & 31) == 0);
+        memset(p, static_cast<int>(i & 0xff), sizeof(Meta));
+        objs.push_back(p);
+    }
+    std::vector<void*> sorted = objs;
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t i = 1; i < sorted.size(); ++i)
+    {
+        assert(static_cast<char*>(sorted[i]) - static_cast<char*>(sorted[i - 1]) >= static_cast<ptrdiff_t>(sizeof(Meta)));
+    }
+
+    // 释放的对象被复用
+    void* last = objs.back();
+    allocator.deallocate(last);
+    assert(allocator.allocate() == last);
+    for (void* p : objs)
+    {
+        allocator.deallocate(p);
+    }
+
+    // 元数据容器
+    std::map<int, int, std::less<int>, MetadataStlAllocator<std::pair<const int, int>>> m;
+    std::vector<int, MetadataStlAllocator<int>> v;
+    for (int i = 0; i < 10000; ++i)
+    {
+        m[i] = i;
+        v.push_back(i);
+    }
+    assert(m.size() == 10000 && v[9999] == 9999);
+
+    std::cout << "Metadata allocator test passed!" << std::endl;
+}
+
+// 预热测试
+void testReserve()
+{
+    std::cout << "Running reserve test..." << std::endl;
+
+    Heap heap;
+    ThreadCache& cache = heap.getThreadCache();
+    assert(cache.reserve(64, 1000) == 1000);
+    assert(cache.reserve(64 * 1024, 4) == 4);
+    assert(cache.reserve(MAX_BYTES + 1, 4) == 0);
+
+    // 预热之后的分配全部命中线程本地缓存，不会再向页缓存申请内存
+    HeapStats before = heap.getStats();
+    std::vector<void*> small;
+    std::vector<void*> pages;
+    for (int i = 0; i < 1000; ++i)
+    {
+        void* p = heap.allocate(64);
+        memset(p, 0x5a, 64);
+        small.push_back(p);
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        void* p = heap.allocate(64 * 1024);
+        memset(p, 0x5a, 64 * 1024);
+        pages.push_back(p);
+    }
+    HeapStats after = heap.getStats();
+    assert(after.system_bytes == before.system_bytes);
+    assert(after.num_spans == before.num_spans);
+
+    // 缓存上限随预热提高，释放后的块保留在线程本地缓存中
+    for (void* p : small)
+    {
+        heap.deallocate(p, 64);
+    }
+    for (void* p : pages)
+    {
+        heap.deallocate(p, 64 * 1024);
+    }
+    assert(cache.reserve(64, 1000) == 1000);
+
+    // 按配置预热默认堆
+    MemoryPool::prewarm({{16, 100}, {200, 50}, {4096, 8}});
+    assert(MemoryPool::reserve(16, 100) >= 100);
+    void* p = MemoryPool::allocate(200);
+    assert(p != nullptr);
+    MemoryPool::deallocate(p, 200);
+
+    std::cout << "Reserve test passed!" << std::endl;
+}
+
+// 分配大小直方图测试
+void testSizeHistogram()
+{
+    std::cout << "Running size histogram test..." << std::endl;
+
+    SizeHistogram::reset();
+    SizeHistogram::record(20, 3);
+    SizeHistogram::record(24);
+    SizeHistogram::record(1);
+    SizeHistogram::record(MAX_BYTES + 1);
+    assert(SizeHistogram::largeCount() == 1);
+
+    const char* path = "size_histogram_test.txt";
+    assert(SizeHistogram::dump(path));
+    std::map<size_t, unsigned long long> counts;
+    FILE* file = fopen(path, "r");
+    assert(file != nullptr);
+    char line[128];
+    while (fgets(line, sizeof(line), file))
+    {
+        size_t size;
+        unsigned long long count;
+        if (line[0] != '#' && sscanf(line, "%zu %llu", &size, &count) == 2)
+        {
+            counts[size] = count;
+        }
+    }
+    fclose(file);
+    remove(path);
+    assert(counts.size() == 2 && counts[8] == 1 && counts[24] == 4);
+
+    // 生成的大小类别表（或默认大小类别）必须能容纳请求的大小
+    for (size_t size = 1; size <= MAX_BYTES; size += 77)
+    {
+        assert(SizeClass::classSize(SizeClass::getIndex(size)) >= size);
+    }
+    SizeHistogram::reset();
+
+    std::cout << "Size histogram test passed!" << std::endl;
+}
+
+// 分配追踪测试
+void testAllocTrace()
+{
+    std::cout << "Running alloc trace test..." << std::endl;
+
+    // 通过环境变量 MEMORYPOOL_TRACE_FILE 追踪整个测试程序时跳过
+    if (AllocTrace::isActive())
+    {
+        std::cout << "Alloc trace test skipped (tracing from environment)" << std::endl;
+        return;
+    }
+    const char* path = "alloc_trace_test.bin";
+    assert(AllocTrace::start(path, 4));
+    assert(!AllocTrace::start(path));
+
+    int a = 0, b = 0;
+    AllocTrace::record(TraceOp::Alloc, &a, 24);
+    std::thread worker([&b]() {
+        AllocTrace::record(TraceOp::Alloc, &b, 100, 64);
+    });
+    worker.join();
+    AllocTrace::record(TraceOp::Free, &a, 24);
+    AllocTrace::record(TraceOp::Free, &b, 100, 64);
+    AllocTrace::record(TraceOp::Alloc, &a, 8);  // 超出容量，被丢弃
+    assert(AllocTrace::stop() == 4);
+    assert(!AllocTrace::isActive());
+
+    FILE* file = fopen(path, "rb");
+    assert(file != nullptr);
+    TraceHeader header;
+    TraceRecord records[5];
+    assert(fread(&header, sizeof(header), 1, file) == 1);
+    assert(header.magic == AllocTrace::MAGIC && header.record_size == sizeof(TraceRecord));
+    assert(header.count.load() == 4 && header.capacity == 4);
+    assert(fread(records, sizeof(TraceRecord), 5, file) == 4);
+    fclose(file);
+    remove(path);
+
+    assert(records[0].op == static_cast<uint8_t>(TraceOp::Alloc) && records[0].size == 24);
+    assert(records[0].ptr == reinterpret_cast<uintptr_t>(&a));
+    assert(records[1].thread != records[0].thread && records[1].align_log2 == 6);
+    assert(records[2].op == static_cast<uint8_t>(TraceOp::Free) && records[2].thread == records[0].thread);
+    assert(records[3].ptr == reinterpret_cast<uintptr_t>(&b));
+    assert(records[0].timestamp <= records[3].timestamp);
+
+    std::cout << "Alloc trace test passed!" << std::endl;
+}
+
+// 堆遍历测试
+void testHeapWalk()
+{
+    std::cout << "Running heap walk test..." << std::endl;
+
+    Heap heap;
+    std::vector<void*> blocks;
+    for (int i = 0; i < 1000; ++i)
+    {
+        blocks.push_back(heap.allocate(64));
+    }
+    for (int i = 0; i < 200; ++i)
+    {
+        heap.deallocate(blocks.back(), 64);
+        blocks.pop_back();
+    }
+    {
+        Arena arena(16, heap.getPageCache());
+        arena.allocate(1000);
+        HeapReport report = heap.walk();
+        assert(report.other_span_bytes >= 16 * PageCache::PAGE_SIZE);
+    }
+
+    HeapReport report = heap.walk();
+    auto iter = std::find_if(report.classes.begin(), report.classes.end(),
+                             [](const SizeClassReport& item) { return item.class_size == 64; });
+    assert(iter != report.classes.end());
+    assert(iter->in_use_blocks == 800);
+    assert(iter->central_free_blocks + iter->thread_free_blocks + iter->in_use_blocks == iter->num_blocks);
+    assert(iter->thread_free_blocks > 0 && iter->thread_free_blocks <= 64);
+    assert(iter->span_bytes >= iter->num_blocks * 64);
+    assert(iter->utilization > 0.0 && iter->utilization <= 1.0);
+    assert(report.in_use_bytes >= 800 * 64);
+    // Arena 释放的 Span 成为空闲区间
+    assert(report.free_spans.num_free_runs >= 1 && report.free_spans.largest_free_run >= 16);
+    assert(report.other_span_bytes == 0);
+
+    // 周期性报告
+    FILE* out = tmpfile();
+    assert(out != nullptr);
+    {
+        HeapReporter reporter(heap, std::chrono::milliseconds(10), out);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    assert(ftell(out) > 0);
+    fclose(out);
+
+    for (void* p : blocks)
+    {
+        heap.deallocate(p, 64);
+    }
+    std::cout << "Heap walk test passed!" << std::endl;
+}
+
+// 空闲线程缓存回收测试
+void testIdleCacheScavenge()
+{
+    std::cout << "Running idle cache scavenge test..." << std::endl;
+
+    Heap heap;
+    auto threadFreeBlocks = [&heap](size_t size) {
+        for (const SizeClassReport& item : heap.walk().classes)
+        {
+            if (item.class_size == SizeClass::classSize(SizeClass::getIndex(size)))
+            {
+                return item.thread_free_blocks;
+            }
+        }
+        return size_t(0);
+    };
+    std::atomic<int> stage{0};
+    std::thread worker([&]() {
+        std::vector<void*> blocks;
+        for (int i = 0; i < 65; ++i)
+        {
+            blocks.push_back(heap.allocate(64));
+        }
+        for (int i = 0; i < 64; ++i)
+        {
+            heap.deallocate(blocks[i], 64);
+        }
+        // 预留的大小类别不会被回收
+        heap.getThreadCache().reserve(256, 100);
+        stage = 1;
+        // 模拟长时间阻塞的线程，被唤醒后再释放一次
+        while (stage != 2)
+        {
+            std::this_thread::yield();
+        }
+        heap.deallocate(blocks[64], 64);
+        void* p = heap.allocate(256);
+        heap.deallocate(p, 256);
+        stage = 3;
+        while (stage != 4)
+        {
+            std::this_thread::yield();
+        }
+    });
+    while (stage != 1)
+    {
+        std::this_thread::yield();
+    }
+    assert(threadFreeBlocks(64) >= 32);
+    assert(threadFreeBlocks(256) >= 100);
+
+    // 第一次扫描将两个线程缓存标记为空闲；当前线程在两次扫描之间有分配/释放（只命中线程缓存），不会被回收
+    void* p = heap.allocate(128);
+    heap.deallocate(p, 128);
+    heap.scavengeIdleCaches();
+    p = heap.allocate(128);
+    heap.deallocate(p, 128);
+    assert(heap.scavengeIdleCaches() == 1);
+    assert(threadFreeBlocks(128) > 0);
+    // 阻塞的工作线程的缓存被直接回收，不需要等待其醒来
+    assert(threadFreeBlocks(64) == 0);
+    assert(threadFreeBlocks(256) >= 100);
+    // 已回收且之后没有操作的线程缓存不会重复回收
+    p = heap.allocate(128);
+    heap.deallocate(p, 128);
+    assert(heap.scavengeIdleCaches() == 0);
+    stage = 2;
+    while (stage != 3)
+    {
+        std::this_thread::yield();
+    }
+    assert(threadFreeBlocks(64) == 1);
+    stage = 4;
+    worker.join();
+
+    // 当前线程主动裁剪
+    p = heap.allocate(128);
+    heap.deallocate(p, 128);
+    assert(heap.walk().thread_free_bytes > 0);
+    heap.getThreadCache().trim();
+    assert(heap.walk().thread_free_bytes == 0);
+
+    // 后台扫描线程
+    p = heap.allocate(128);
+    heap.deallocate(p, 128);
+    {
+        CacheScavenger scavenger(heap, std::chrono::milliseconds(5));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        assert(scavenger.getNumReclaimed() > 0);
+    }
+    assert(heap.walk().thread_free_bytes == 0);
+    // 后台扫描线程与软限制同时工作：持有中心缓存类别锁的线程触发 releaseMemory 时，回收不能等待该类别的锁
+    {
+        Heap pressured;
+        MemoryLimits limits;
+        limits.soft_bytes = 1;
+        pressured.setMemoryLimits(limits);
+        CacheScavenger scavenger(pressured, std::chrono::milliseconds(1));
+        std::atomic<bool> done{false};
+        std::thread parked([&]() {
+            std::vector<void*> cached;
+            for (int i = 0; i < 64; ++i)
+            {
+                cached.push_back(pressured.allocate(4096));
+            }
+            for (void* ptr : cached)
+            {
+                pressured.deallocate(ptr, 4096);
+            }
+            while (!done)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+        std::thread churn([&]() {
+            std::vector<void*> blocks;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+            while (std::chrono::steady_clock::now() < deadline)
+            {
+                for (int i = 0; i < 512; ++i)
+                {
+                    blocks.push_back(pressured.allocate(4096));
+                    assert(blocks.back() != nullptr);
+                }
+                for (void* ptr : blocks)
+                {
+                    pressured.deallocate(ptr, 4096);
+                }
+                blocks.clear();
+            }
+        });
+        churn.join();
+        done = true;
+        parked.join();
+    }
+    p = MemoryPool::allocate(64);
+    MemoryPool::deallocate(p, 64);
+    MemoryPool::trim_thread_cache();
+    std::cout << "Idle cache scavenge test passed!" << std::endl;
+}
+
+// 内存限制测试
+std::atomic<int> g_limit_handler_calls{0};
+
+bool rejectOverLimit(size_t, size_t)
+{
+    ++g_limit_handler_calls;
+    return false;
+}
+
+void testMemoryLimits()
+{
+    std::cout << "Running memory limits test..." << std::endl;
+
+    constexpr size_t LARGE = 512 * 1024;
+    Heap heap;
+    PageCache& page_cache = heap.getPageCache();
+
+    // 1. 空闲 Span 归还给系统
+    {
+        Arena arena(32, page_cache);
+        arena.allocate(1000);
+    }
+    size_t mapped = page_cache.getMappedBytes();
+    assert(mapped >= 32 * PageCache::PAGE_SIZE);
+    assert(heap.releaseMemory() >= 32 * PageCache::PAGE_SIZE);
+    assert(page_cache.getMappedBytes() == mapped - 32 * PageCache::PAGE_SIZE);
+    assert(heap.getStats().free_span_bytes == 0);
+
+    // 2. 超过软限制时自动释放空闲 Span
+    {
+        Arena arena(32, page_cache);
+        arena.allocate(1000);
+    }
+    MemoryLimits limits;
+    limits.soft_bytes = page_cache.getMappedBytes();
+    heap.setMemoryLimits(limits);
+    void* large = heap.allocate(LARGE);
+    assert(large != nullptr);
+    assert(heap.getStats().free_span_bytes == 0);
+    heap.deallocate(large, LARGE);
+
+    // 3. 超过硬限制时调用处理函数，最终返回 nullptr
+    limits.soft_bytes = 0;
+    limits.hard_bytes = page_cache.getMappedBytes() + 2 * LARGE;
+    limits.handler = rejectOverLimit;
+    heap.setMemoryLimits(limits);
+    std::vector<void*> blocks;
+    while (void* p = heap.allocate(LARGE))
+    {
+        blocks.push_back(p);
+        assert(blocks.size() <= 2);
+    }
+    assert(blocks.size() == 2);
+    assert(g_limit_handler_calls == 1);
+    assert(page_cache.getMappedBytes() <= limits.hard_bytes);
+
+    // 4. 按设置抛出 std::bad_alloc
+    limits.throw_on_failure = true;
+    heap.setMemoryLimits(limits);
+    bool thrown = false;
+    try
+    {
+        heap.allocate(LARGE);
+    }
+    catch (const std::bad_alloc&)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // 5. 释放内存后重新允许分配，解除限制
+    heap.deallocate(blocks.back(), LARGE);
+    blocks.pop_back();
+    blocks.push_back(heap.allocate(LARGE));
+    assert(blocks.back() != nullptr);
+    heap.setMemoryLimits(MemoryLimits{});
+    for (void* p : blocks)
+    {
+        heap.deallocate(p, LARGE);
+    }
+    // 6. 超过软限制时立即回收阻塞线程缓存中的内存块
+    constexpr size_t PAGE_LEVEL = CentralCache::SPAN_PAGES * PageCache::PAGE_SIZE;
+    std::atomic<int> stage{0};
+    std::thread worker([&]() {
+        std::vector<void*> cached;
+        for (int i = 0; i < 32; ++i)
+        {
+            cached.push_back(heap.allocate(PAGE_LEVEL));
+        }
+        for (void* p : cached)
+        {
+            heap.deallocate(p, PAGE_LEVEL);
+        }
+        stage = 1;
+        while (stage != 2)
+        {
+            std::this_thread::yield();
+        }
+    });
+    while (stage != 1)
+    {
+        std::this_thread::yield();
+    }
+    assert(heap.walk().thread_free_bytes >= 32 * PAGE_LEVEL);
+    mapped = page_cache.getMappedBytes();
+    limits = MemoryLimits{};
+    limits.soft_bytes = mapped;
+    heap.setMemoryLimits(limits);
+    large = heap.allocate(LARGE);
+    assert(large != nullptr);
+    assert(heap.walk().thread_free_bytes < PAGE_LEVEL);
+    assert(page_cache.getMappedBytes() < mapped + LARGE);
+    heap.deallocate(large, LARGE);
+    heap.setMemoryLimits(MemoryLimits{});
+    stage = 2;
+    worker.join();
+    std::cout << "Memory limits test passed!" << std::endl;
+}
+
+// Span 占用率与空 Span 归还测试
+void testSpanOccupancy()
+{
+    std::cout << "Running span occupancy test..." << std::endl;
+
+    constexpr size_t BLOCKS_PER_SPAN = CentralCache::SPAN_PAGES * PageCache::PAGE_SIZE / 64;
+    Heap heap;
+    auto classReport = [&heap]() {
+        HeapReport report = heap.walk();
+        auto iter = std::find_if(report.classes.begin(), report.classes.end(),
+                                 [](const SizeClassReport& item) { return item.class_size == 64; });
+        return iter != report.classes.end() ? *iter : SizeClassReport{};
+    };
+
+    // 两个 Span：A 只保留 10 个块，B 保留大部分块
+    std::vector<char*> blocks;
+    for (size_t i = 0; i < 2 * BLOCKS_PER_SPAN; ++i)
+    {
+        blocks.push_back(static_cast<char*>(heap.allocate(64)));
+    }
+    char* span_b_begin = *std::min_element(blocks.begin() + BLOCKS_PER_SPAN, blocks.end());
+    char* span_b_end = *std::max_element(blocks.begin() + BLOCKS_PER_SPAN, blocks.end()) + 64;
+    std::vector<char*> live;
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        if (i < 10 || i >= BLOCKS_PER_SPAN + 100)
+        {
+            live.push_back(blocks[i]);
+        }
+        else
+        {
+            heap.deallocate(blocks[i], 64);
+        }
+    }
+    heap.getThreadCache().trim();
+    assert(classReport().span_bytes == 2 * CentralCache::SPAN_PAGES * PageCache::PAGE_SIZE);
+
+    // 新的分配优先来自更满的 Span B
+    for (int i = 0; i < 50; ++i)
+    {
+        char* p = static_cast<char*>(heap.allocate(64));
+        assert(p >= span_b_begin && p < span_b_end);
+        live.push_back(p);
+    }
+
+    // 全部释放后只保留一个空 Span，其余归还给 PageCache
+    size_t free_span_bytes = heap.getStats().free_span_bytes;
+    for (char* p : live)
+    {
+        heap.deallocate(p, 64);
+    }
+    heap.getThreadCache().trim();
+    SizeClassReport item = classReport();
+    assert(item.span_bytes == CentralCache::SPAN_PAGES * PageCache::PAGE_SIZE);
+    assert(item.central_free_blocks == item.num_blocks);
+    assert(heap.getStats().free_span_bytes == free_span_bytes + CentralCache::SPAN_PAGES * PageCache::PAGE_SIZE);
+    // releaseMemory 归还保留的空 Span
+    heap.releaseMemory();
+    assert(classReport().span_bytes == 0);
+    std::cout << "Span occupancy test passed!" << std::endl;
+}
+
+// V1 内存池归还空闲内存块测试
+void testV1Trim()
+{
+    std::cout << "Running V1 trim test..." << std::endl;
+
+    MemoryPoolV1::MemoryPool pool;
+    pool.init(128);
+    std::vector<void*> slots;
+    for (int i = 0; i < 1000; ++i)
+    {
+        slots.push_back(pool.allocate());
+        memset(slots.back(), i & 0xff, 128);
+    }
+    // 保留第一个槽，其所在的内存块不能被归还
+    for (size_t i = 1; i < slots.size(); ++i)
+    {
+        pool.deallocate(slots[i]);
+    }
+    size_t num_released = pool.trim();
+    assert(num_released > 0);
+    // 第二次 trim 没有可归还的内存块
+    assert(pool.trim() == 0);
+    // 归还的内存块保持映射，其他线程读取旧链表头中的 next 指针不会访问已解除映射的内存
+    assert(*static_cast<volatile unsigned char*>(slots.back()) == 0);
+    unsigned char* first = static_cast<unsigned char*>(slots[0]);
+    assert(first[0] == 0 && first[127] == 0);
+
+    // 归还后仍可继续分配，空闲槽被复用
+    std::vector<void*> again;
+    for (int i = 0; i < 1000; ++i)
+    {
+        again.push_back(pool.allocate());
+        memset(again.back(), 0x5a, 128);
+    }
+    assert(std::find(again.begin(), again.end(), slots[0]) == again.end());
+    for (void* p : again)
+    {
+        pool.deallocate(p);
+    }
+    pool.deallocate(slots[0]);
+    assert(pool.trim() >= num_released);
+
+    // trim 与分配/释放并发
+    std::atomic<bool> stop{false};
+    std::thread trimmer([&]() {
+        while (!stop)
+        {
+            pool.trim();
+            std::this_thread::yield();
+        }
+    });
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; ++t)
+    {
+        workers.emplace_back([&pool, t]() {
+            std::vector<unsigned char*> local;
+            for (int round = 0; round < 200; ++round)
+            {
+                for (int i = 0; i < 64; ++i)
+                {
+                    auto p = static_cast<unsigned char*>(pool.allocate());
+                    memset(p, t, 128);
+                    local.push_back(p);
+                }
+                for (unsigned char* p : local)
+                {
+                    assert(p[0] == t && p[127] == t);
+                    pool.deallocate(p);
+                }
+                local.clear();
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+    stop = true;
+    trimmer.join();
+    std::cout << "V1 trim test passed!" << std::endl;
+}
+
+// 构造缓存对象池测试
+struct alignas(64) PooledBuffer
+{
+    static std::atomic<int> num_constructed;
+    static std::atomic<int> num_destroyed;
+    std::vector<int> data;
+    std::mutex mutex;
+
+    PooledBuffer()
+    {
+        data.reserve(1024);
+        ++num_constructed;
+    }
+    ~PooledBuffer()
+    {
+        ++num_destroyed;
+    }
+};
+std::atomic<int> PooledBuffer::num_constructed{0};
+std::atomic<int> PooledBuffer::num_destroyed{0};
+
+void testCachedObjectPool()
+{
+    std::cout << "Running cached object pool test..." << std::endl;
+
+    int num_reset = 0;
+    {
+        CachedObjectPool<PooledBuffer> pool([&num_reset](PooledBuffer& buffer) {
+            buffer.data.clear();
+            ++num_reset;
+        }, [](void* ptr) { new(ptr) PooledBuffer(); }, 8);
+
+        // 反复获取/放回同一个对象，只构造一次，放回时调用 reset
+        for (int i = 0; i < 100; ++i)
+        {
+            PooledBuffer* buffer = pool.acquire();
+            assert(reinterpret_cast<uintptr_t>(buffer) % 64 == 0);
+            assert(buffer->data.empty() && buffer->data.capacity() >= 1024);
+            buffer->data.push_back(i);
+            pool.release(buffer);
+        }
+        assert(PooledBuffer::num_constructed == 1 && PooledBuffer::num_destroyed == 0);
+        assert(num_reset == 100);
+
+        // 超过线程缓存容量的对象进入共享仓库，仍保持构造状态
+        std::vector<PooledBuffer*> buffers;
+        for (int i = 0; i < 20; ++i)
+        {
+            buffers.push_back(pool.acquire());
+        }
+        for (PooledBuffer* buffer : buffers)
+        {
+            pool.release(buffer);
+        }
+        assert(PooledBuffer::num_constructed == 20 && PooledBuffer::num_destroyed == 0);
+        assert(pool.getNumCached() == 20);
+
+        // 其他线程退出时缓存的对象移入共享仓库，可被当前线程复用
+        std::thread worker([&pool]() {
+            std::vector<PooledBuffer*> local;
+            for (int i = 0; i < 30; ++i)
+            {
+                local.push_back(pool.acquire());
+            }
+            for (PooledBuffer* buffer : local)
+            {
+                pool.release(buffer);
+            }
+        });
+        worker.join();
+        int num_constructed = PooledBuffer::num_constructed;
+        assert(num_constructed > 20 && pool.getNumCached() == static_cast<size_t>(num_constructed));
+        buffers.clear();
+        for (int i = 0; i < num_constructed; ++i)
+        {
+            buffers.push_back(pool.acquire());
+        }
+        assert(PooledBuffer::num_constructed == num_constructed);
+        for (PooledBuffer* buffer : buffers)
+        {
+            pool.release(buffer);
+        }
+
+        // trim 时才真正析构
+        assert(pool.trim() == static_cast<size_t>(num_constructed));
+        assert(PooledBuffer::num_destroyed == num_constructed && pool.getNumCached() == 0);
+        pool.release(pool.acquire());
+        assert(PooledBuffer::num_constructed == num_constructed + 1);
+    }
+    // 对象池析构时销毁剩余的对象
+    assert(PooledBuffer::num_destroyed == PooledBuffer::num_constructed);
+    std::cout << "Cached object pool test passed!" << std::endl;
+}
+
+// 延迟释放测试
+void testDeferredFree()
+{
+    std::cout << "Running deferred free test..." << std::endl;
+
+    std::thread worker([]() {
+        assert(!DeferredFree::isEnabled());
+        DeferredFree::enable(10);
+        assert(DeferredFree::isEnabled());
+
+        // 释放只压入缓冲区，drain 时才真正释放
+        for (int i = 0; i < 8; ++i)
+        {
+            DeferredFree::deallocate(MemoryPool::allocate(64), 64);
+        }
+        assert(DeferredFree::drain() == 8);
+        assert(DeferredFree::drain() == 0);
+
+        // 缓冲区容量向上取整为 16，超出部分直接释放
+        for (int i = 0; i < 20; ++i)
+        {
+            DeferredFree::deallocate(MemoryPool::allocate(128), 128);
+        }
+        assert(DeferredFree::drain() == 16);
+
+        // 大对象同样可以延迟释放
+        void* large = MemoryPool::allocate(1 << 20);
+        memset(large, 0x5A, 1 << 20);
+        DeferredFree::deallocate(large, 1 << 20);
+        assert(DeferredFree::drain() == 1);
+
+        // 回收线程释放缓冲区中的内存
+        {
+            DeferredReclaimer reclaimer(std::chrono::milliseconds(5));
+            for (int i = 0; i < 12; ++i)
+            {
+                DeferredFree::deallocate(MemoryPool::allocate(32), 32);
+            }
+        }
+        assert(DeferredFree::drain() == 0);
+
+        // 关闭后直接释放；线程退出时也会自动关闭
+        DeferredFree::disable();
+        assert(!DeferredFree::isEnabled());
+        DeferredFree::deallocate(MemoryPool::allocate(64), 64);
+        DeferredFree::enable();
+        DeferredFree::deallocate(MemoryPool::allocate(64), 64);
+    });
+    worker.join();
+    assert(DeferredFree::drainAll() == 0);
+
+    std::cout << "Deferred free test passed!" << std::endl;
+}
+
+// 共享内存区域测试
+void testSharedRegion()
+{
+    std::cout << "Running shared region test..." << std::endl;
+
+    const size_t region_bytes = 1 << 20;
+    const size_t page = SharedRegion::PAGE_SIZE;
+    {
+        // 分配/释放后相邻区间合并，空闲字节数恢复
+        SharedRegion region;
+        assert(region.create(SharedBacking::Memfd, "memorypool-test", region_bytes));
+        size_t initial_free = region.getFreeBytes();
+        assert(initial_free == region_bytes - page);
+        size_t a = region.allocate(3 * page);
+        size_t b = region.allocate(1);
+        size_t c = region.allocate(page);
+        assert(a == page && b == a + 3 * page && c == b + page);
+        region.deallocate(a, 3 * page);
+        region.deallocate(c, page);
+        region.deallocate(b, 1);
+        assert(region.getFreeBytes() == initial_free);
+        assert(region.allocate(initial_free) == page);
+        assert(region.allocate(page) == 0);
+        region.deallocate(page, initial_free);
+
+        // 通过文件描述符再映射一次：地址不同，偏移指向相同的数据
+        size_t offset = region.allocate(100);
+        strcpy(static_cast<char*>(region.toPointer(offset)), "shared");
+        SharedRegion mirror;
+        assert(mirror.attach(region.getFd()));
+        assert(mirror.toPointer(offset) != region.toPointer(offset));
+        assert(strcmp(static_cast<char*>(mirror.toPointer(offset)), "shared") == 0);
+        mirror.deallocate(offset, 100);
+        assert(region.getFreeBytes() == initial_free);
+    }
+
+    {
+        // 两个进程通过命名共享内存交换偏移：子进程读取父进程的消息、释放它并分配回复
+        std::string name = "/memorypool-test-" + std::to_string(getpid());
+        SharedRegion region;
+        assert(region.create(SharedBacking::Shm, name.c_str(), region_bytes));
+        size_t initial_free = region.getFreeBytes();
+        const size_t message_bytes = 64 * 1024;
+        size_t message = region.allocate(message_bytes);
+        memset(region.toPointer(message), 0x3C, message_bytes);
+
+        int pipe_fds[2];
+        assert(pipe(pipe_fds) == 0);
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (pid == 0)
+        {
+            SharedRegion child;
+            if (!child.open(SharedBacking::Shm, name.c_str()))
+            {
+                _exit(1);
+            }
+            auto data = static_cast<unsigned char*>(child.toPointer(message));
+            for (size_t i = 0; i < message_bytes; ++i)
+            {
+                if (data[i] != 0x3C)
+                {
+                    _exit(2);
+                }
+            }
+            child.deallocate(message, message_bytes);
+            size_t reply = child.allocate(2 * page);
+            memset(child.toPointer(reply), 0x7E, 2 * page);
+            _exit(write(pipe_fds[1], &reply, sizeof(reply)) == sizeof(reply) ? 0 : 3);
+        }
+        size_t reply = 0;
+        assert(read(pipe_fds[0], &reply, sizeof(reply)) == sizeof(reply));
+        int status = 0;
+        waitpid(pid, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        auto data = static_cast<unsigned char*>(region.toPointer(reply));
+        assert(data[0] == 0x7E && data[2 * page - 1] == 0x7E);
+        region.deallocate(reply, 2 * page);
+        assert(region.getFreeBytes() == initial_free);
+        assert(SharedRegion::remove(SharedBacking::Shm, name.c_str()));
+    }
+
+    {
+        // 以共享区域为后端的堆：小对象与大对象都来自区域，destroy 后全部归还
+        SharedRegion region;
+        assert(region.create(SharedBacking::Memfd, "memorypool-heap", 4 << 20));
+        size_t initial_free = region.getFreeBytes();
+        {
+            Heap heap(&region);
+            char* small = static_cast<char*>(heap.allocate(64));
+            char* large = static_cast<char*>(heap.allocate(300 * 1024));
+            size_t large_offset = region.toOffset(large);
+            assert(region.toOffset(small) < region.getSize() && large_offset < region.getSize());
+            memset(large, 0x11, 300 * 1024);
+            large = static_cast<char*>(heap.getThreadCache().reallocate(large, 300 * 1024, 600 * 1024));
+            assert(large != nullptr && large[300 * 1024 - 1] == 0x11);
+            assert(region.getFreeBytes() < initial_free);
+            heap.deallocate(small, 64);
+            heap.deallocate(large, 600 * 1024);
+        }
+        assert(region.getFreeBytes() == initial_free);
+    }
+
+    std::cout << "Shared region test passed!" << std::endl;
+}
+
+// 生命周期提示测试
+void testLifetimeHints()
+{
+    std::cout << "Running lifetime hints test..." << std::endl;
+
+    Heap heap;
+    const size_t num_objects = 4096;
+    const size_t size = 64;
+    // 短生命周期对象中穿插少量长期存活的对象
+    std::vector<void*> short_ptrs, long_ptrs;
+    for (size_t i = 0; i < num_objects; ++i)
+    {
+        short_ptrs.push_back(heap.allocate(size, Lifetime::Short));
+        if (i % 64 == 0)
+        {
+            long_ptrs.push_back(heap.allocate(size, Lifetime::Long));
+            memset(long_ptrs.back(), 0x2B, size);
+        }
+    }
+    // 短生命周期对象全部释放后，它们的 Span 不被长期存活的对象占用，可以全部归还
+    for (void* ptr : short_ptrs)
+    {
+        heap.deallocate(ptr, size, Lifetime::Short);
+    }
+    heap.getThreadCache().trim();
+    LifetimeStats short_stats = heap.getLifetimeStats(Lifetime::Short);
+    LifetimeStats long_stats = heap.getLifetimeStats(Lifetime::Long);
+    assert(short_stats.num_allocs == num_objects && short_stats.num_frees == num_objects);
+    assert(short_stats.in_use_bytes == 0);
+    assert(long_stats.num_allocs == long_ptrs.size() && long_stats.num_frees == 0);
+    assert(long_stats.in_use_bytes == long_ptrs.size() * size);
+    assert(long_stats.span_bytes > 0 && long_stats.utilization > 0.0);
+    // 堆遍历单独报告 Long 的 Span，不计入 other_span_bytes
+    HeapReport report = heap.walk();
+    assert(report.long_span_bytes == long_stats.span_bytes);
+    assert(report.long_in_use_bytes == long_stats.in_use_bytes);
+    assert(report.other_span_bytes == 0);
+    heap.releaseMemory();
+    assert(heap.getLifetimeStats(Lifetime::Short).span_bytes == 0);
+    for (void* ptr : long_ptrs)
+    {
+        assert(*static_cast<unsigned char*>(ptr) == 0x2B);
+        heap.deallocate(ptr, size, Lifetime::Long);
+    }
+    assert(heap.getLifetimeStats(Lifetime::Long).in_use_bytes == 0);
+
+    // 长期存活的大对象
+    void* large = heap.allocate(MAX_BYTES + 1, Lifetime::Long);
+    memset(large, 0, MAX_BYTES + 1);
+    heap.deallocate(large, MAX_BYTES + 1, Lifetime::Long);
+
+    // 永久对象碰撞分配，连续分配的地址相邻
+    char* first = static_cast<char*>(heap.allocate(24, Lifetime::Permanent));
+    char* second = static_cast<char*>(heap.allocate(40, Lifetime::Permanent));
+    assert(second == first + 24);
+    heap.deallocate(first, 24, Lifetime::Permanent);
+    for (int i = 0; i < 1000; ++i)
+    {
+        assert(heap.allocate(100, Lifetime::Permanent) != nullptr);
+    }
+    LifetimeStats permanent_stats = heap.getLifetimeStats(Lifetime::Permanent);
+    assert(permanent_stats.num_allocs == 1002 && permanent_stats.num_frees == 0);
+    assert(permanent_stats.in_use_bytes >= 64 + 1000 * 100);
+    assert(permanent_stats.span_bytes >= permanent_stats.in_use_bytes);
+    heap.destroy();
+    assert(heap.getLifetimeStats(Lifetime::Permanent).span_bytes == 0);
+
+    // 默认堆的接口
+    void* ptr = MemoryPool::allocate(128, Lifetime::Long);
+    MemoryPool::deallocate(ptr, 128, Lifetime::Long);
+    assert(MemoryPool::get_lifetime_stats(Lifetime::Long).num_frees >= 1);
+
+    std::cout << "Lifetime hints test passed!" << std::endl;
+}
+
+// 单线程堆测试
+void testSingleThreadHeap()
+{
+    std::cout << "Running single-thread heap test..." << std::endl;
+
+    SingleThreadHeap heap;
+    // 释放的块直接留在自由链表中，下一次同类别分配立即复用
+    void* a = heap.allocate(48);
+    void* b = heap.allocate(48);
+    assert(static_cast<char*>(b) == static_cast<char*>(a) + SizeClass::classSize(SizeClass::getIndex(48)));
+    heap.deallocate(a, 48);
+    assert(heap.allocate(44) == a);
+    heap.deallocate(a, 44);
+    heap.deallocate(b, 48);
+
+    // 跨越多个 Span 的分配与写入
+    std::vector<void*> ptrs;
+    for (size_t i = 0; i < 5000; ++i)
+    {
+        size_t size = (i % 64 + 1) * 24;
+        void* ptr = heap.allocate(size);
+        memset(ptr, static_cast<int>(i & 0xFF), size);
+        ptrs.push_back(ptr);
+    }
+    for (size_t i = 0; i < ptrs.size(); ++i)
+    {
+        assert(*static_cast<unsigned char*>(ptrs[i]) == (i & 0xFF));
+        heap.deallocate(ptrs[i], (i % 64 + 1) * 24);
+    }
+
+    // 对齐、批量、调整大小、预留
+    void* aligned = heap.allocateAligned(100, 256);
+    assert(reinterpret_cast<uintptr_t>(aligned) % 256 == 0);
+    heap.deallocateAligned(aligned, 100, 256);
+    void* batch[32];
+    assert(heap.allocateBatch(64, 32, batch) == 32);
+    heap.deallocateBatch(batch, 32, 64);
+    char* grown = static_cast<char*>(heap.allocate(16));
+    strcpy(grown, "single");
+    grown = static_cast<char*>(heap.reallocate(grown, 16, 4096));
+    assert(strcmp(grown, "single") == 0);
+    grown = static_cast<char*>(heap.reallocate(grown, 4096, MAX_BYTES + 100));
+    assert(strcmp(grown, "single") == 0);
+    heap.deallocate(grown, MAX_BYTES + 100);
+    assert(heap.reserve(1024, 200) >= 200);
+
+    // destroy 后可以继续使用
+    heap.destroy();
+    assert(heap.getPageCache().getStats().system_bytes == 0);
+    void* ptr = heap.allocate(64);
+    heap.deallocate(ptr, 64);
+
+    std::cout << "Single-thread heap test passed!" << std::endl;
+}
+
+// 协程帧缓存测试
+void testCoroutineFrameCache()
+{
+    std::cout << "Running coroutine frame cache test..." << std::endl;
+
+    std::thread worker([]() {
+        // 同一大小的帧释放后被下一次分配直接复用
+        void* frame = CoroutineFrameCache::allocate(200);
+        CoroutineFrameCache::deallocate(frame, 200);
+        assert(CoroutineFrameCache::getNumCached() == 1);
+        assert(CoroutineFrameCache::allocate(200) == frame);
+        assert(CoroutineFrameCache::getNumCached() == 0);
+
+        // 每个大小最多缓存 MAX_CACHED 个帧
+        std::vector<void*> frames;
+        for (size_t i = 0; i < CoroutineFrameCache::MAX_CACHED + 10; ++i)
+        {
+            frames.push_back(CoroutineFrameCache::allocate(200));
+        }
+        for (void* f : frames)
+        {
+            CoroutineFrameCache::deallocate(f, 200);
+        }
+        assert(CoroutineFrameCache::getNumCached() == CoroutineFrameCache::MAX_CACHED);
+
+        // 映射到同一槽位的其他大小不会挤掉已缓存的帧
+        size_t other = 200 + CoroutineFrameCache::NUM_SLOTS * ALIGNMENT;
+        void* other_frame = CoroutineFrameCache::allocate(other);
+        memset(other_frame, 0, other);
+        CoroutineFrameCache::deallocate(other_frame, other);
+        assert(CoroutineFrameCache::getNumCached() == CoroutineFrameCache::MAX_CACHED);
+
+        // promise 基类的 operator new/delete
+        void* pooled = PooledPromise::operator new(96);
+        PooledPromise::operator delete(pooled, 96);
+        void* recycled = RecycledPromise::operator new(96);
+        auto recycled_addr = reinterpret_cast<uintptr_t>(recycled);
+        RecycledPromise::operator delete(recycled, 96);
+        recycled = RecycledPromise::operator new(96);
+        assert(reinterpret_cast<uintptr_t>(recycled) == recycled_addr);
+        RecycledPromise::operator delete(recycled, 96);
+        assert(CoroutineFrameCache::getNumCached() == CoroutineFrameCache::MAX_CACHED + 1);
+
+        CoroutineFrameCache::flush();
+        assert(CoroutineFrameCache::getNumCached() == 0);
+        // 线程退出时剩余的帧自动归还
+        CoroutineFrameCache::deallocate(CoroutineFrameCache::allocate(64), 64);
+    });
+    worker.join();
+
+    std::cout << "Coroutine frame cache test passed!" << std::endl;
+}
+
+// PageCache 小 Span 分片缓存测试
+void testPageCacheShards()
+{
+    std::cout << "Running page cache shards test..." << std::endl;
+
+    PageCache page_cache;
+    const size_t page_size = PageCache::PAGE_SIZE;
+    // 释放的小 Span 进入分片缓存，再次分配相同页数时直接复用
+    void* span = page_cache.allocateSpan(8);
+    assert(span != nullptr);
+    page_cache.deallocateSpan(span, 8);
+    assert(page_cache.allocateSpan(8) == span);
+    page_cache.deallocateSpan(span, 8);
+
+    // 分片缓存中的 Span 计入空闲字节数
+    std::vector<void*> spans;
+    for (int i = 0; i < 40; ++i)
+    {
+        spans.push_back(page_cache.allocateSpan(4));
+        memset(spans.back(), 0x5C, 4 * page_size);
+    }
+    size_t free_bytes = page_cache.getStats().free_bytes;
+    for (void* ptr : spans)
+    {
+        page_cache.deallocateSpan(ptr, 4);
+    }
+    PageCacheStats stats = page_cache.getStats();
+    assert(stats.free_bytes == free_bytes + 40 * 4 * page_size);
+    assert(stats.free_bytes == stats.system_bytes);
+
+    // releaseFreeMemory 先将分片缓存中的 Span 插入空闲链表，合并后归还给系统
+    assert(page_cache.releaseFreeMemory() > 0);
+    stats = page_cache.getStats();
+    assert(stats.free_bytes == stats.system_bytes);
+
+    // 多线程交替分配/释放不同页数的小 Span，结束后所有 Span 都处于空闲状态
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&page_cache, t]() {
+            std::mt19937 rng(t);
+            std::vector<std::pair<void*, size_t>> live;
+            for (int i = 0; i < 2000; ++i)
+            {
+                if (live.size() < 32 && rng() % 2 == 0)
+                {
+                    size_t num_pages = rng() % 8 + 1;
+                    void* ptr = page_cache.allocateSpan(num_pages);
+                    assert(ptr != nullptr);
+                    *static_cast<int*>(ptr) = t;
+                    live.emplace_back(ptr, num_pages);
+                }
+                else if (!live.empty())
+                {
+                    assert(*static_cast<int*>(live.back().first) == t);
+                    page_cache.deallocateSpan(live.back().first, live.back().second);
+                    live.pop_back();
+                }
+            }
+            for (auto& [ptr, num_pages] : live)
+            {
+                page_cache.deallocateSpan(ptr, num_pages);
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    stats = page_cache.getStats();
+    assert(stats.free_bytes == stats.system_bytes);
+    page_cache.releaseFreeMemory();
+
+    std::cout << "Page cache shards test passed!" << std::endl;
+}
+
+// 慢速路径探针测试
+void testProbes()
+{
+    std::cout << "Running probes test..." << std::endl;
+
+    Probes::reset();
+    Probes::fire(ProbeEvent::SystemMap, 4096, 0, 0);
+    Probes::fire(ProbeEvent::SystemMap, 4096, 0, 100);
+    Probes::fire(ProbeEvent::SystemMap, 4096, 0, 5000);
+    LatencyHistogram histogram = Probes::getHistogram(ProbeEvent::SystemMap);
+    assert(histogram.count == 3 && histogram.total_ns == 5100 && histogram.max_ns == 5000);
+    assert(histogram.buckets[0] == 1 && histogram.buckets[6] == 1 && histogram.buckets[12] == 1);
+    assert(histogram.percentile(0.5) == 127 && histogram.percentile(0.99) == 5000);
+    assert(std::string(Probes::eventName(ProbeEvent::CentralLockWait)) == "central_lock_wait");
+
+#ifdef MEMORYPOOL_PROBES
+    // 新堆的第一次分配依次经过中心缓存、PageCache 与 mmap
+    Probes::reset();
+    {
+        Heap heap;
+        void* p = heap.allocate(100);
+        heap.deallocate(p, 100);
+    }
+    assert(Probes::getHistogram(ProbeEvent::CentralFetch).count >= 1);
+    assert(Probes::getHistogram(ProbeEvent::SpanAlloc).count >= 1);
+    assert(Probes::getHistogram(ProbeEvent::SystemMap).count >= 1);
+#endif
+    Probes::reset();
+
+    std::cout << "Probes test passed!" << std::endl;
+}
+
 int main()
 {
     try
@@ -190,9 +1745,37 @@ int main()
 
         testBasicAllocation();
         testMemoryWriting();
+#ifndef MEMORYPOOL_SINGLE_THREADED
+        // 单线程版本的 MemoryPool 不能被多个线程同时使用
         testMultiThreading();
+#endif
         testEdgeCases();
         testStress();
+        testArena();
+        testAlignedAllocation();
+        testReallocate();
+        testStlAdapters();
+        testBatchAllocation();
+        testHeaps();
+        testMetadataAllocator();
+        testReserve();
+        testSizeHistogram();
+        testAllocTrace();
+        testHeapWalk();
+        testProbes();
+        testIdleCacheScavenge();
+        testMemoryLimits();
+        testSpanOccupancy();
+        testV1Trim();
+#ifndef MEMORYPOOL_SINGLE_THREADED
+        testCachedObjectPool();
+        testDeferredFree();
+#endif
+        testSharedRegion();
+        testLifetimeHints();
+        testSingleThreadHeap();
+        testCoroutineFrameCache();
+        testPageCacheShards();
 
         std::cout << "All tests passed successfully!" << std::endl;
         return 0;
@@ -0,0 +1,252 @@
+//
+// Created by 11361 on 25-4-24.
+//
+// 大小类别表生成工具：读取分配大小直方图，在给定类别数量下搜索使“内部碎片 + Span 尾部浪费”最小的大小类别表，
+// 并输出供内存池编译使用的 constexpr 头文件。
+//
+// 用法: size_class_gen <直方图文件> <类别数量> <输出头文件> [相邻类别最大比例，默认 1.25]
+// 直方图每行为“大小 次数”，以 # 开头的行为注释（SizeHistogram::dump 的输出格式）
+//
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../include/Common.h"
+#include "../include/PageCache.h"
+#include "../include/CentralCache.h"
+
+using namespace MemoryPoolV2;
+
+namespace
+{
+constexpr size_t PAGE_BYTES = PageCache::PAGE_SIZE;
+constexpr size_t SPAN_BYTES = CentralCache::SPAN_PAGES * PageCache::PAGE_SIZE;
+
+// 与 CentralCache 的切分方式一致：小于 SPAN_BYTES 的类别从 SPAN_PAGES 页的 Span 中切分，
+// 更大的类别每个块独占一个按页向上取整的 Span。返回平均到每个块上的 Span 尾部浪费字节数
+double tailWaste(size_t class_size) {
+    size_t span_bytes = class_size < SPAN_BYTES ? SPAN_BYTES : (class_size + PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES;
+    size_t num_block = span_bytes / class_size;
+    return static_cast<double>(span_bytes - num_block * class_size) / num_block;
+}
+
+// 相邻类别之间允许的最大间距，保证直方图中没有出现的大小也不会产生过大的内部碎片
+size_t maxNextClass(size_t class_size, double max_ratio) {
+    size_t next = static_cast<size_t>(class_size * max_ratio) / ALIGNMENT * ALIGNMENT;
+    return std::max(next, class_size + ALIGNMENT);
+}
+
+struct Histogram {
+    std::map<size_t, uint64_t> counts;  // 按 ALIGNMENT 向上取整后的大小 -> 次数
+    uint64_t total = 0;
+    double total_bytes = 0;
+};
+
+bool loadHistogram(const char* path, Histogram& histogram) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream in(line);
+        size_t size;
+        uint64_t count;
+        if (!(in >> size >> count) || count == 0) {
+            continue;
+        }
+        if (size > MAX_BYTES) {
+            continue;   // 大对象不经过大小类别
+        }
+        size = SizeClass::roundUp(std::max(size, size_t(1)));
+        histogram.counts[size] += count;
+        histogram.total += count;
+        histogram.total_bytes += static_cast<double>(size) * count;
+    }
+    return true;
+}
+
+// 候选类别：直方图中出现的大小，加上每个 2 的幂区间内 8 等分的网格点（保证比例约束总能满足），以及 MAX_BYTES
+std::vector<size_t> candidateClasses(const Histogram& histogram) {
+    std::set<size_t> candidates;
+    for (auto& [size, count] : histogram.counts) {
+        candidates.insert(size);
+    }
+    for (size_t base = ALIGNMENT; base < MAX_BYTES; base *= 2) {
+        size_t step = std::max(ALIGNMENT, base / 8);
+        for (size_t size = base; size < base * 2; size += step) {
+            candidates.insert(size);
+        }
+    }
+    candidates.insert(MAX_BYTES);
+    return std::vector<size_t>(candidates.begin(), candidates.end());
+}
+
+struct CostStats {
+    double internal = 0;    // 内部碎片字节数（按分配次数加权）
+    double tail = 0;        // Span 尾部浪费字节数（按分配次数加权）
+};
+
+// 计算直方图在给定大小类别表下的浪费
+CostStats evaluate(const Histogram& histogram, const std::vector<size_t>& classes) {
+    CostStats stats;
+    size_t index = 0;
+    for (auto& [size, count] : histogram.counts) {
+        while (classes[index] < size) {
+            ++index;
+        }
+        stats.internal += static_cast<double>(classes[index] - size) * count;
+        stats.tail += tailWaste(classes[index]) * count;
+    }
+    return stats;
+}
+
+/**
+ * 动态规划搜索最优的大小类别表：dp[k][j] 表示用 k 个类别覆盖 (0, candidates[j]] 且最大类别为 candidates[j] 时的最小浪费。
+ * 每个类别 c 覆盖 (上一个类别, c] 内的所有大小，浪费为 Σ count * (c - size + tailWaste(c))，借助前缀和 O(1) 计算
+ * @param histogram
+ * @param candidates 候选类别（升序，最后一个为 MAX_BYTES）
+ * @param num_classes 类别数量
+ * @param max_ratio 相邻类别的最大比例
+ * @return 大小类别表，无解（类别数量不足以满足比例约束）时返回空
+ */
+std::vector<size_t> searchClasses(const Histogram& histogram, const std::vector<size_t>& candidates,
+                                  size_t num_classes, double max_ratio) {
+    const size_t m = candidates.size();
+    const double INF = std::numeric_limits<double>::infinity();
+
+    // 前缀和：weight[j] 为不超过 candidates[j] 的分配次数，bytes[j] 为其字节数之和
+    std::vector<double> weight(m + 1, 0), bytes(m + 1, 0);
+    auto iter = histogram.counts.begin();
+    for (size_t j = 0; j < m; ++j) {
+        weight[j + 1] = weight[j];
+        bytes[j + 1] = bytes[j];
+        for (; iter != histogram.counts.end() && iter->first <= candidates[j]; ++iter) {
+            weight[j + 1] += static_cast<double>(iter->second);
+            bytes[j + 1] += static_cast<double>(iter->first) * iter->second;
+        }
+    }
+    // 类别 candidates[j] 覆盖 (candidates[i], candidates[j]] 的浪费，i == m 表示没有上一个类别
+    auto cost = [&](size_t i, size_t j) {
+        double w = weight[j + 1] - (i == m ? 0 : weight[i + 1]);
+        double b = bytes[j + 1] - (i == m ? 0 : bytes[i + 1]);
+        return w * (static_cast<double>(candidates[j]) + tailWaste(candidates[j])) - b;
+    };
+
+    std::vector<std::vector<double>> dp(num_classes + 1, std::vector<double>(m, INF));
+    std::vector<std::vector<size_t>> from(num_classes + 1, std::vector<size_t>(m, m));
+    for (size_t j = 0; j < m && candidates[j] <= maxNextClass(0, max_ratio); ++j) {
+        dp[1][j] = cost(m, j);
+    }
+    for (size_t k = 2; k <= num_classes; ++k) {
+        for (size_t j = 1; j < m; ++j) {
+            // 从大到小枚举上一个类别，超出比例约束后即可停止
+            for (size_t i = j; i-- > 0;) {
+                if (maxNextClass(candidates[i], max_ratio) < candidates[j]) {
+                    break;
+                }
+                if (dp[k - 1][i] == INF) {
+                    continue;
+                }
+                double value = dp[k - 1][i] + cost(i, j);
+                if (value < dp[k][j]) {
+                    dp[k][j] = value;
+                    from[k][j] = i;
+                }
+            }
+        }
+    }
+
+    std::vector<size_t> classes;
+    if (dp[num_classes][m - 1] == INF) {
+        return classes;
+    }
+    for (size_t k = num_classes, j = m - 1; k > 0; j = from[k][j], --k) {
+        classes.push_back(candidates[j]);
+    }
+    return std::vector<size_t>(classes.rbegin(), classes.rend());
+}
+
+bool writeHeader(const char* path, const char* source, const std::vector<size_t>& classes,
+                 const CostStats& stats, const CostStats& baseline, const Histogram& histogram) {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    auto percent = [&](double bytes) { return histogram.total_bytes > 0 ? 100.0 * bytes / histogram.total_bytes : 0.0; };
+    char summary[256];
+    snprintf(summary, sizeof(summary), "// 内部碎片 %.2f%%，Span 尾部浪费 %.2f%%（默认大小类别：%.2f%%，%.2f%%）\n",
+             percent(stats.internal), percent(stats.tail), percent(baseline.internal), percent(baseline.tail));
+
+    out << "//\n"
+        << "// 由 size_class_gen 根据 " << source << " 生成，请勿手动修改\n"
+        << summary
+        << "//\n\n"
+        << "#pragma once\n"
+        << "#include <cstddef>\n\n"
+        << "namespace MemoryPoolV2\n{\n"
+        << "namespace GeneratedSizeClasses\n{\n"
+        << "constexpr size_t NUM_CLASSES = " << classes.size() << ";\n"
+        << "constexpr size_t CLASS_SIZES[NUM_CLASSES] = {";
+    for (size_t i = 0; i < classes.size(); ++i) {
+        out << (i % 8 == 0 ? "\n    " : " ") << classes[i] << (i + 1 < classes.size() ? "," : "");
+    }
+    out << "\n};\n"
+        << "}   // namespace GeneratedSizeClasses\n"
+        << "}   // namespace MemoryPoolV2\n";
+    return static_cast<bool>(out);
+}
+}   // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "usage: " << argv[0] << " <histogram> <num_classes> <output_header> [max_ratio]" << std::endl;
+        return 1;
+    }
+    size_t num_classes = std::strtoul(argv[2], nullptr, 10);
+    double max_ratio = argc > 4 ? std::strtod(argv[4], nullptr) : 1.25;
+    if (num_classes == 0 || num_classes > UINT16_MAX || max_ratio <= 1.0) {
+        std::cerr << "invalid num_classes or max_ratio" << std::endl;
+        return 1;
+    }
+
+    Histogram histogram;
+    if (!loadHistogram(argv[1], histogram)) {
+        std::cerr << "cannot read histogram " << argv[1] << std::endl;
+        return 1;
+    }
+    std::vector<size_t> candidates = candidateClasses(histogram);
+    num_classes = std::min(num_classes, candidates.size());
+    std::vector<size_t> classes = searchClasses(histogram, candidates, num_classes, max_ratio);
+    if (classes.empty()) {
+        std::cerr << num_classes << " classes cannot cover sizes up to " << MAX_BYTES
+                  << " with max ratio " << max_ratio << ", use more classes or a larger ratio" << std::endl;
+        return 1;
+    }
+
+    // 默认的按 ALIGNMENT 等距划分的大小类别，作为对比
+    std::vector<size_t> default_classes;
+    for (size_t size = ALIGNMENT; size <= MAX_BYTES; size += ALIGNMENT) {
+        default_classes.push_back(size);
+    }
+    CostStats stats = evaluate(histogram, classes);
+    CostStats baseline = evaluate(histogram, default_classes);
+    if (!writeHeader(argv[3], argv[1], classes, stats, baseline, histogram)) {
+        std::cerr << "cannot write " << argv[3] << std::endl;
+        return 1;
+    }
+    std::cout << "size_class_gen: " << classes.size() << " classes, internal fragmentation "
+              << (histogram.total_bytes > 0 ? 100.0 * stats.internal / histogram.total_bytes : 0.0) << "%, span tail waste "
+              << (histogram.total_bytes > 0 ? 100.0 * stats.tail / histogram.total_bytes : 0.0) << "%" << std::endl;
+    return 0;
+}
@@ -0,0 +1,425 @@
+//
+// Created by 11361 on 25-4-25.
+//
+// 分配追踪回放工具：读取 AllocTrace 记录的追踪文件，按记录中的线程与交错顺序在 MemoryPoolV2、MemoryPoolV1
+// 和系统 malloc 上重新执行，输出吞吐量、峰值 RSS 以及随时间变化的碎片率，用于在真实负载上评估分配器的改动。
+//
+// 用法: trace_replay <追踪文件> [v2|v1|malloc|all] [--samples N] [--single-thread]
+//   --samples N      碎片率采样点数量（默认 20）
+//   --single-thread  在一个线程中按顺序执行所有记录，只测量分配器本身（默认按记录的线程交错执行）
+//
+// 每个分配器在单独 fork 出的子进程中回放，互不影响 RSS 统计。
+//
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../include/AllocTrace.h"
+#include "../include/MemoryPool.h"
+
+using namespace MemoryPoolV2;
+
+namespace
+{
+constexpr uint32_t NO_BLOCK = UINT32_MAX;
+constexpr size_t TOUCH_STRIDE = 4096;
+
+// 预处理后的操作：地址被替换为连续的内存块编号
+struct ReplayOp {
+    uint64_t timestamp;
+    uint32_t id;        // Alloc/Realloc：新内存块；Free：被释放的内存块
+    uint32_t old_id;    // Realloc：原内存块（NO_BLOCK 表示原内存块在追踪开始前分配，此时等价于分配）
+    uint32_t size;
+    uint16_t thread;
+    uint8_t op;         // TraceOp::Alloc / Free / ReallocTo
+    uint8_t align_log2;
+};
+
+struct Trace {
+    std::vector<ReplayOp> ops;
+    std::vector<uint32_t> block_size;   // 每个内存块编号对应的大小
+    size_t num_threads = 0;
+    size_t skipped = 0;                 // 无法关联的记录（释放了追踪开始前分配的内存）
+};
+
+// 分配器接口
+struct Backend {
+    const char* name;
+    void (*init)();
+    void* (*allocate)(size_t size, size_t align);
+    void (*deallocate)(void* ptr, size_t size, size_t align);
+    void* (*reallocate)(void* ptr, size_t old_size, size_t new_size);
+};
+
+void noInit() {}
+
+void* v2Allocate(size_t size, size_t align) {
+    return align > ALIGNMENT ? MemoryPool::allocate_aligned(size, align) : MemoryPool::allocate(size);
+}
+
+void v2Deallocate(void* ptr, size_t size, size_t align) {
+    if (align > ALIGNMENT) {
+        MemoryPool::deallocate_aligned(ptr, size, align);
+    } else {
+        MemoryPool::deallocate(ptr, size);
+    }
+}
+
+void* v2Reallocate(void* ptr, size_t old_size, size_t new_size) {
+    return MemoryPool::reallocate(ptr, old_size, new_size);
+}
+
+// V1 不支持对齐分配，对齐要求超过 8 字节的分配使用 aligned_alloc
+void v1Init() {
+    MemoryPoolV1::HashBucket::initMemoryPool();
+}
+
+void* v1Allocate(size_t size, size_t align) {
+    if (align > ALIGNMENT) {
+        return aligned_alloc(align, (std::max(size, size_t(1)) + align - 1) & ~(align - 1));
+    }
+    return MemoryPoolV1::HashBucket::useMemory(std::max(size, size_t(1)));
+}
+
+void v1Deallocate(void* ptr, size_t size, size_t align) {
+    if (align > ALIGNMENT) {
+        free(ptr);
+    } else {
+        MemoryPoolV1::HashBucket::freeMemory(ptr, std::max(size, size_t(1)));
+    }
+}
+
+void* v1Reallocate(void* ptr, size_t old_size, size_t new_size) {
+    void* result = v1Allocate(new_size, 0);
+    if (result != nullptr) {
+        memcpy(result, ptr, std::min(old_size, new_size));
+        v1Deallocate(ptr, old_size, 0);
+    }
+    return result;
+}
+
+void* mallocAllocate(size_t size, size_t align) {
+    if (align > ALIGNMENT) {
+        return aligned_alloc(align, (std::max(size, size_t(1)) + align - 1) & ~(align - 1));
+    }
+    return malloc(size);
+}
+
+void mallocDeallocate(void* ptr, size_t, size_t) {
+    free(ptr);
+}
+
+void* mallocReallocate(void* ptr, size_t, size_t new_size) {
+    return realloc(ptr, new_size);
+}
+
+const Backend BACKENDS[] = {
+    {"v2", noInit, v2Allocate, v2Deallocate, v2Reallocate},
+    {"v1", v1Init, v1Allocate, v1Deallocate, v1Reallocate},
+    {"malloc", noInit, mallocAllocate, mallocDeallocate, mallocReallocate},
+};
+
+/**
+ * 读取追踪文件，并将地址转换为内存块编号：同一地址在释放后可能被再次分配，
+ * 因此按记录顺序维护“地址 -> 当前存活的内存块编号”
+ * @param path
+ * @param trace
+ * @return 成功返回 true
+ */
+bool loadTrace(const char* path, Trace& trace) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(TraceHeader)) {
+        close(fd);
+        return false;
+    }
+    void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    auto header = static_cast<const TraceHeader*>(ptr);
+    if (header->magic != AllocTrace::MAGIC || header->record_size != sizeof(TraceRecord)) {
+        munmap(ptr, st.st_size);
+        return false;
+    }
+    // 未调用 stop 的追踪文件中记录数可能超过容量
+    size_t count = std::min<uint64_t>(header->count.load(std::memory_order_relaxed), header->capacity);
+    count = std::min(count, (st.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord));
+    auto records = reinterpret_cast<const TraceRecord*>(header + 1);
+
+    std::unordered_map<uint64_t, uint32_t> live;
+    // 线程 -> ReallocFrom 记录的原地址与内存块编号
+    std::unordered_map<uint16_t, std::pair<uint64_t, uint32_t>> pending_realloc;
+    trace.ops.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        const TraceRecord& record = records[i];
+        trace.num_threads = std::max(trace.num_threads, size_t(record.thread) + 1);
+        ReplayOp op{record.timestamp, NO_BLOCK, NO_BLOCK, record.size, record.thread, record.op, record.align_log2};
+        switch (static_cast<TraceOp>(record.op)) {
+        case TraceOp::Alloc:
+            if (record.ptr == 0) {
+                continue;
+            }
+            op.id = static_cast<uint32_t>(trace.block_size.size());
+            trace.block_size.push_back(record.size);
+            live[record.ptr] = op.id;
+            break;
+        case TraceOp::Free: {
+            auto iter = live.find(record.ptr);
+            if (iter == live.end()) {
+                ++trace.skipped;
+                continue;
+            }
+            op.id = iter->second;
+            live.erase(iter);
+            break;
+        }
+        case TraceOp::ReallocFrom: {
+            auto iter = live.find(record.ptr);
+            pending_realloc[record.thread] = {record.ptr, iter == live.end() ? NO_BLOCK : iter->second};
+            continue;
+        }
+        case TraceOp::ReallocTo: {
+            auto iter = pending_realloc.find(record.thread);
+            uint64_t old_ptr = 0;
+            uint32_t old_id = NO_BLOCK;
+            if (iter != pending_realloc.end()) {
+                old_ptr = iter->second.first;
+                old_id = iter->second.second;
+                pending_realloc.erase(iter);
+            }
+            if (record.ptr == 0) {
+                continue;   // 调整失败，原内存块保持不变
+            }
+            // 原内存块移动后其地址可能已被其他线程重新分配，只有仍指向原内存块时才移除
+            auto old_iter = live.find(old_ptr);
+            if (old_id != NO_BLOCK && old_iter != live.end() && old_iter->second == old_id) {
+                live.erase(old_iter);
+            }
+            op.old_id = old_id;
+            op.id = static_cast<uint32_t>(trace.block_size.size());
+            trace.block_size.push_back(record.size);
+            live[record.ptr] = op.id;
+            break;
+        }
+        default:
+            ++trace.skipped;
+            continue;
+        }
+        trace.ops.push_back(op);
+    }
+    munmap(ptr, st.st_size);
+    return true;
+}
+
+// 进程当前的匿名内存驻留量（不包括追踪文件等文件映射）
+size_t anonRssBytes() {
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file == nullptr) {
+        return 0;
+    }
+    unsigned long size = 0, resident = 0, shared = 0;
+    int n = fscanf(file, "%lu %lu %lu", &size, &resident, &shared);
+    fclose(file);
+    return n == 3 ? (resident - shared) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+struct Sample {
+    size_t op_index;
+    uint64_t timestamp;
+    size_t live_bytes;
+    size_t rss_bytes;
+};
+
+// 回放状态：同一时刻只有一个线程在执行操作（由 next_op 的 acquire/release 保证），因此其余成员无需加锁
+struct Replayer {
+    const Trace& trace;
+    const Backend& backend;
+    size_t sample_interval;
+    size_t baseline_rss;
+    std::vector<void*> blocks;
+    std::vector<Sample> samples;
+    size_t live_bytes = 0;
+    std::atomic<size_t> next_op{0};
+
+    Replayer(const Trace& t, const Backend& b, size_t num_samples)
+        : trace(t), backend(b), sample_interval(std::max(size_t(1), t.ops.size() / std::max(size_t(1), num_samples))),
+          baseline_rss(0), blocks(t.block_size.size(), nullptr) {
+        samples.reserve(num_samples + 2);
+    }
+
+    // 每个分配得到的内存块逐页写入一个字节，使 RSS 反映实际使用的内存
+    static void touch(void* ptr, size_t size) {
+        char* p = static_cast<char*>(ptr);
+        for (size_t offset = 0; offset < size; offset += TOUCH_STRIDE) {
+            p[offset] = 1;
+        }
+    }
+
+    void execute(size_t index) {
+        const ReplayOp& op = trace.ops[index];
+        size_t align = op.align_log2 == 0 ? 0 : size_t(1) << op.align_log2;
+        switch (static_cast<TraceOp>(op.op)) {
+        case TraceOp::Alloc:
+            blocks[op.id] = backend.allocate(op.size, align);
+            if (blocks[op.id] != nullptr) {
+                touch(blocks[op.id], op.size);
+                live_bytes += op.size;
+            }
+            break;
+        case TraceOp::Free:
+            if (blocks[op.id] != nullptr) {
+                backend.deallocate(blocks[op.id], trace.block_size[op.id], align);
+                blocks[op.id] = nullptr;
+                live_bytes -= trace.block_size[op.id];
+            }
+            break;
+        default:    // ReallocTo
+            if (op.old_id == NO_BLOCK || blocks[op.old_id] == nullptr) {
+                blocks[op.id] = backend.allocate(op.size, 0);
+            } else {
+                size_t old_size = trace.block_size[op.old_id];
+                blocks[op.id] = backend.reallocate(blocks[op.old_id], old_size, op.size);
+                if (blocks[op.id] != nullptr) {
+                    blocks[op.old_id] = nullptr;
+                    live_bytes -= old_size;
+                }
+            }
+            if (blocks[op.id] != nullptr) {
+                touch(blocks[op.id], op.size);
+                live_bytes += op.size;
+            }
+            break;
+        }
+        if (index % sample_interval == 0) {
+            size_t rss = anonRssBytes();
+            samples.push_back(Sample{index, op.timestamp, live_bytes, rss > baseline_rss ? rss - baseline_rss : 0});
+        }
+    }
+
+    // 线程 thread 按全局顺序执行属于自己的记录，轮到其他线程时等待
+    void runThread(const std::vector<size_t>& indices) {
+        for (size_t index : indices) {
+            while (next_op.load(std::memory_order_acquire) != index) {
+                std::this_thread::yield();
+            }
+            execute(index);
+            next_op.store(index + 1, std::memory_order_release);
+        }
+    }
+
+    double run(bool single_thread) {
+        baseline_rss = anonRssBytes();
+        auto start = std::chrono::steady_clock::now();
+        if (single_thread || trace.num_threads <= 1) {
+            for (size_t i = 0; i < trace.ops.size(); ++i) {
+                execute(i);
+            }
+        } else {
+            std::vector<std::vector<size_t>> indices(trace.num_threads);
+            for (size_t i = 0; i < trace.ops.size(); ++i) {
+                indices[trace.ops[i].thread].push_back(i);
+            }
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < trace.num_threads; ++t) {
+                threads.emplace_back([this, &indices, t]() { runThread(indices[t]); });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(end - start).count();
+    }
+};
+
+// 在子进程中回放并输出结果
+void replayInChild(const Trace& trace, const Backend& backend, size_t num_samples, bool single_thread) {
+    backend.init();
+    Replayer replayer(trace, backend, num_samples);
+    double seconds = replayer.run(single_thread);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double mops = seconds > 0 ? trace.ops.size() / seconds / 1e6 : 0;
+    printf("[%s] %zu ops in %.3f s, %.2f Mops/s, peak RSS %ld KB (replay +%zu KB at last sample)\n",
+           backend.name, trace.ops.size(), seconds, mops, usage.ru_maxrss,
+           replayer.samples.empty() ? size_t(0) : replayer.samples.back().rss_bytes / 1024);
+    printf("  %12s %12s %12s %12s %8s\n", "op", "trace_ms", "live_KB", "rss_KB", "frag%");
+    for (const Sample& sample : replayer.samples) {
+        // 碎片率：回放期间新增的驻留内存中没有被存活内存块使用的比例
+        double frag = sample.rss_bytes > 0 ? 100.0 * (1.0 - static_cast<double>(sample.live_bytes) / sample.rss_bytes) : 0;
+        printf("  %12zu %12.3f %12zu %12zu %8.1f\n", sample.op_index, sample.timestamp / 1e6,
+               sample.live_bytes / 1024, sample.rss_bytes / 1024, std::max(frag, 0.0));
+    }
+    fflush(stdout);
+}
+}   // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [v2|v1|malloc|all] [--samples N] [--single-thread]\n", argv[0]);
+        return 1;
+    }
+    std::string which = "all";
+    size_t num_samples = 20;
+    bool single_thread = false;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--samples" && i + 1 < argc) {
+            num_samples = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--single-thread") {
+            single_thread = true;
+        } else {
+            which = arg;
+        }
+    }
+
+    Trace trace;
+    if (!loadTrace(argv[1], trace)) {
+        fprintf(stderr, "cannot read trace %s\n", argv[1]);
+        return 1;
+    }
+    printf("trace %s: %zu ops, %zu blocks, %zu threads, %zu unmatched records\n",
+           argv[1], trace.ops.size(), trace.block_size.size(), trace.num_threads, trace.skipped);
+    fflush(stdout);
+
+    int status = 0;
+    for (const Backend& backend : BACKENDS) {
+        if (which != "all" && which != backend.name) {
+            continue;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            replayInChild(trace, backend, num_samples, single_thread);
+            _exit(0);
+        }
+        int child_status = 0;
+        waitpid(pid, &child_status, 0);
+        if (!WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0) {
+            fprintf(stderr, "[%s] replay failed\n", backend.name);
+            status = 1;
+        }
+    }
+    return status;
+}